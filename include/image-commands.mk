@@ -189,17 +189,17 @@ define Build/zip
 endef
 
 define Build/jffs2
-	rm -rf $(KDIR_TMP)/$(DEVICE_NAME)/jffs2 && \
-		mkdir -p $(KDIR_TMP)/$(DEVICE_NAME)/jffs2/$$(dirname $(1)) && \
-		cp $@ $(KDIR_TMP)/$(DEVICE_NAME)/jffs2/$(1) && \
+	rm -rf $(DEVICE_TMP)/$(notdir $@).jffs2 && \
+		mkdir -p $(DEVICE_TMP)/$(notdir $@).jffs2/$$(dirname $(1)) && \
+		cp $@ $(DEVICE_TMP)/$(notdir $@).jffs2/$(1) && \
 		$(STAGING_DIR_HOST)/bin/mkfs.jffs2 --pad \
 			$(if $(CONFIG_BIG_ENDIAN),--big-endian,--little-endian) \
 			--squash-uids -v -e $(patsubst %k,%KiB,$(BLOCKSIZE)) \
 			-o $@.new \
-			-d $(KDIR_TMP)/$(DEVICE_NAME)/jffs2 \
+			-d $(DEVICE_TMP)/$(notdir $@).jffs2 \
 			2>&1 1>/dev/null | awk '/^.+$$$$/' && \
 		$(STAGING_DIR_HOST)/bin/padjffs2 $@.new -J $(patsubst %k,,$(BLOCKSIZE))
-	-rm -rf $(KDIR_TMP)/$(DEVICE_NAME)/jffs2/
+	-rm -rf $(DEVICE_TMP)/$(notdir $@).jffs2/
 	@mv $@.new $@
 endef
 
@@ -35,6 +35,9 @@ mkfs_target_dir = $(if $(call param_get,pkg,$(1)),$(KDIR)/target-dir-$(call para
 
 KDIR=$(KERNEL_BUILD_DIR)
 KDIR_TMP=$(KDIR)/tmp
+# scratch space of the device a recipe runs for, the image pipelines of
+# different devices run in parallel and must not share temporary files
+DEVICE_TMP=$(KDIR_TMP)/$(DEVICE_NAME)
 DTS_DIR:=$(LINUX_DIR)/arch/$(LINUX_KARCH)/boot/dts
 
 IMG_PREFIX_EXTRA:=$(if $(EXTRA_IMAGE_NAME),$(call sanitize,$(EXTRA_IMAGE_NAME))-)
@@ -126,6 +129,13 @@ define concat_cmd
 $(call split_args,$(1),build_cmd)
 endef
 
+# $(1): start or stop
+# $(2): device name
+# $(3): pipeline step
+define device_time
+@$(SCRIPT_DIR)/image-time.pl $(1) $(KDIR_TMP)/$(2) $(3)
+endef
+
 # pad to 4k, 8k, 16k, 64k, 128k, 256k and add jffs2 end-of-filesystem mark
 define prepare_generic_squashfs
 	$(STAGING_DIR_HOST)/bin/padjffs2 $(1) 4 8 16 64 128 256
@@ -234,6 +244,8 @@ endef
 $(eval $(foreach S,$(JFFS2_BLOCKSIZE),$(call Image/mkfs/jffs2/template,$(S))))
 $(eval $(foreach S,$(NAND_BLOCKSIZE),$(call Image/mkfs/jffs2-nand/template,$(S))))
 
+# with more than one processor the mksquashfs4 output depends on thread
+# scheduling, keep a single one so images are reproducible
 define Image/mkfs/squashfs
 	$(STAGING_DIR_HOST)/bin/mksquashfs4 $(call mkfs_target_dir,$(1)) $@ \
 		-nopad -noappend -root-owned \
@@ -247,14 +259,16 @@ endef
 # $(4): compat string
 ifneq ($(CONFIG_NAND_SUPPORT),)
    define Image/Build/SysupgradeNAND
-	mkdir -p "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/"
-	echo "BOARD=$(if $(4),$(4),$(1))" > "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/CONTROL"
-	[ -z "$(2)" ] || $(CP) "$(KDIR)/root.$(2)" "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/root"
-	[ -z "$(3)" ] || $(CP) "$(3)" "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/kernel"
-	(cd "$(KDIR_TMP)"; $(TAR) cvf \
+	rm -rf "$(KDIR_TMP)/$(1)-$(2)"
+	mkdir -p "$(KDIR_TMP)/$(1)-$(2)/sysupgrade-$(if $(4),$(4),$(1))/"
+	echo "BOARD=$(if $(4),$(4),$(1))" > "$(KDIR_TMP)/$(1)-$(2)/sysupgrade-$(if $(4),$(4),$(1))/CONTROL"
+	[ -z "$(2)" ] || $(CP) "$(KDIR)/root.$(2)" "$(KDIR_TMP)/$(1)-$(2)/sysupgrade-$(if $(4),$(4),$(1))/root"
+	[ -z "$(3)" ] || $(CP) "$(3)" "$(KDIR_TMP)/$(1)-$(2)/sysupgrade-$(if $(4),$(4),$(1))/kernel"
+	(cd "$(KDIR_TMP)/$(1)-$(2)"; $(TAR) cvf \
 		"$(BIN_DIR)/$(IMG_PREFIX)-$(1)-$(2)-sysupgrade.tar" sysupgrade-$(if $(4),$(4),$(1)) \
 			$(if $(SOURCE_DATE_EPOCH),--mtime="@$(SOURCE_DATE_EPOCH)") \
 	)
+	rm -rf "$(KDIR_TMP)/$(1)-$(2)"
    endef
 
 # $(1) board name
@@ -494,7 +508,9 @@ define Device/Build/initramfs
 
   $(KDIR)/tmp/$$(KERNEL_INITRAMFS_IMAGE): $(KDIR)/$$(KERNEL_INITRAMFS_NAME) $(CURDIR)/Makefile $$(KERNEL_DEPENDS) image_prepare
 	@rm -f $$@
+	$(call device_time,start,$(1),initramfs)
 	$$(call concat_cmd,$$(KERNEL_INITRAMFS))
+	$(call device_time,stop,$(1),initramfs)
 endef
 endif
 
@@ -538,8 +554,10 @@ define Device/Build/kernel
     endif
     $$(KDIR_KERNEL_IMAGE): $(KDIR)/$$(KERNEL_NAME) $(CURDIR)/Makefile $$(KERNEL_DEPENDS) image_prepare
 	@rm -f $$@
+	$(call device_time,start,$(1),kernel)
 	$$(call concat_cmd,$$(KERNEL))
 	$$(if $$(KERNEL_SIZE),$$(call Build/check-size,$$(KERNEL_SIZE)))
+	$(call device_time,stop,$(1),kernel)
   endif
 endef
 
@@ -558,11 +576,18 @@ define Device/Build/image
 	)
   ifndef IB
     $$(ROOTFS/$(1)/$(3)): $(if $(TARGET_PER_DEVICE_ROOTFS),target-dir-$$(ROOTFS_ID/$(3)))
+    # some recipes embed the initramfs kernel if it exists, make sure
+    # it is built before and not concurrently with the image
+    ifdef CONFIG_TARGET_ROOTFS_INITRAMFS
+      $(KDIR)/tmp/$(call IMAGE_NAME,$(1),$(2)): | $$(if $$(KERNEL_INITRAMFS),$(KDIR)/tmp/$$(KERNEL_INITRAMFS_IMAGE))
+    endif
   endif
   $(KDIR)/tmp/$(call IMAGE_NAME,$(1),$(2)): $$(KDIR_KERNEL_IMAGE) $$(ROOTFS/$(1)/$(3))
 	@rm -f $$@
 	[ -f $$(word 1,$$^) -a -f $$(word 2,$$^) ]
+	$(call device_time,start,$(3),$(1)-$(2))
 	$$(call concat_cmd,$(if $(IMAGE/$(2)/$(1)),$(IMAGE/$(2)/$(1)),$(IMAGE/$(2))))
+	$(call device_time,stop,$(3),$(1)-$(2))
 
   .IGNORE: $(BIN_DIR)/$(call IMAGE_NAME,$(1),$(2))
 
@@ -607,7 +632,9 @@ define Device/Build/artifact
   $(eval $(call Device/Export,$(KDIR)/tmp/$(IMAGE_PREFIX)-$(1)))
   $(KDIR)/tmp/$(IMAGE_PREFIX)-$(1): $$(KDIR_KERNEL_IMAGE)
 	@rm -f $$@
+	$(call device_time,start,$(2),$(1))
 	$$(call concat_cmd,$(ARTIFACT/$(1)))
+	$(call device_time,stop,$(2),$(1))
 
   .IGNORE: $(BIN_DIR)/$(IMAGE_PREFIX)-$(1)
 
@@ -628,7 +655,7 @@ define Device/Build
       $$(call Device/Build/image,$$(fs),$$(image),$(1)))))
 
   $$(eval $$(foreach artifact,$$(ARTIFACTS), \
-    $$(call Device/Build/artifact,$$(artifact))))
+    $$(call Device/Build/artifact,$$(artifact),$(1))))
 
 endef
 
@@ -702,6 +729,7 @@ define BuildImage
 
     image_prepare: compile
 		mkdir -p $(BIN_DIR) $(KDIR)/tmp
+		rm -f $(KDIR)/tmp/*/.time*
 		rm -rf $(BUILD_DIR)/json_info_files
 		$(call Image/Prepare)
 
@@ -711,6 +739,7 @@ define BuildImage
   else
     image_prepare:
 		mkdir -p $(BIN_DIR) $(KDIR)/tmp
+		rm -f $(KDIR)/tmp/*/.time*
   endif
 
   kernel_prepare: image_prepare
@@ -724,6 +753,7 @@ define BuildImage
   $(foreach device,$(LEGACY_DEVICES),$(call LegacyDevice,$(device)))
 
   install-images: kernel_prepare $(foreach fs,$(filter-out $(if $(UBIFS_OPTS),,ubifs),$(TARGET_FILESYSTEMS) $(fs-subtypes-y)),$(KDIR)/root.$(fs))
+	@$(SCRIPT_DIR)/image-time.pl report $(KDIR_TMP)
 	$(foreach fs,$(TARGET_FILESYSTEMS),
 		$(call Image/Build,$(fs))
 	)
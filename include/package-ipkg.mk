@@ -11,7 +11,7 @@ endif
 
 # invoke ipkg-build with some default options
 IPKG_BUILD:= \
-  $(SCRIPT_DIR)/ipkg-build -c -o 0 -g 0
+  $(STAGING_DIR_HOST)/bin/ipkg-build -c -o 0 -g 0
 
 IPKG_REMOVE:= \
   $(SCRIPT_DIR)/ipkg-remove
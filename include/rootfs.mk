@@ -1,25 +1,17 @@
 ifdef CONFIG_USE_MKLIBS
   define mklibs
-	rm -rf $(TMP_DIR)/mklibs-progs $(TMP_DIR)/mklibs-out
-	# first find all programs and add them to the mklibs list
-	find $(STAGING_DIR_ROOT) -type f -perm /100 -exec \
-		file -r -N -F '' {} + | \
-		awk ' /executable.*dynamically/ { print $$1 }' > $(TMP_DIR)/mklibs-progs
-	# find all loadable objects that are not regular libraries and add them to the list as well
-	find $(STAGING_DIR_ROOT) -type f -name \*.so\* -exec \
-		file -r -N -F '' {} + | \
-		awk ' /shared object/ { print $$1 }' > $(TMP_DIR)/mklibs-libs
+	rm -rf $(TMP_DIR)/mklibs-out
+	# all dynamically linked programs and libraries are found by mklibs itself
 	mkdir -p $(TMP_DIR)/mklibs-out
 	$(STAGING_DIR_HOST)/bin/mklibs -D \
 		-d $(TMP_DIR)/mklibs-out \
 		--sysroot $(STAGING_DIR_ROOT) \
-		`cat $(TMP_DIR)/mklibs-libs | sed 's:/*[^/]\+/*$$::' | uniq | sed 's:^$(STAGING_DIR_ROOT):-L :'` \
 		--ldlib $(patsubst $(STAGING_DIR_ROOT)/%,/%,$(firstword $(wildcard \
 			$(foreach name,ld-uClibc.so.* ld-linux.so.* ld-*.so ld-musl-*.so.*, \
 			  $(STAGING_DIR_ROOT)/lib/$(name) \
 			)))) \
 		--target $(REAL_GNU_TARGET_NAME) \
-		`cat $(TMP_DIR)/mklibs-progs $(TMP_DIR)/mklibs-libs` 2>&1
+		$(STAGING_DIR_ROOT) 2>&1
 	$(RSTRIP) $(TMP_DIR)/mklibs-out
 	for lib in `ls $(TMP_DIR)/mklibs-out/*.so.* 2>/dev/null`; do \
 		LIB="$${lib##*/}"; \
@@ -66,27 +58,7 @@ define prepare_rootfs
 	fi)
 	@mkdir -p $(1)/etc/rc.d
 	@mkdir -p $(1)/var/lock
-	@( \
-		cd $(1); \
-		for script in ./usr/lib/opkg/info/*.postinst; do \
-			IPKG_INSTROOT=$(1) $$(which bash) $$script; \
-			ret=$$?; \
-			if [ $$ret -ne 0 ]; then \
-				echo "postinst script $$script has failed with exit code $$ret" >&2; \
-				exit 1; \
-			fi; \
-		done; \
-		for script in ./etc/init.d/*; do \
-			grep '#!/bin/sh /etc/rc.common' $$script >/dev/null || continue; \
-			if ! echo " $(3) " | grep -q " $$(basename $$script) "; then \
-				IPKG_INSTROOT=$(1) $$(which bash) ./etc/rc.common $$script enable; \
-				echo "Enabling" $$(basename $$script); \
-			else \
-				IPKG_INSTROOT=$(1) $$(which bash) ./etc/rc.common $$script disable; \
-				echo "Disabling" $$(basename $$script); \
-			fi; \
-		done || true \
-	)
+	@$(SCRIPT_DIR)/rootfs-postinst.pl -j $(NPROC) $(1) $(3)
 	$(if $(SOURCE_DATE_EPOCH),sed -i "s/Installed-Time: .*/Installed-Time: $(SOURCE_DATE_EPOCH)/" $(1)/usr/lib/opkg/status)
 	@-find $(1) -name CVS   | $(XARGS) rm -rf
 	@-find $(1) -name .svn  | $(XARGS) rm -rf
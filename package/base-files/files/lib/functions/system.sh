@@ -12,6 +12,15 @@ get_mac_binary() {
 		return
 	fi
 
+	# maccalc reads the flash once per boot, the result is kept in /tmp/sysinfo
+	if [ -x /usr/sbin/maccalc ]; then
+		case "$path" in
+		/dev/random|/dev/urandom) maccalc batch "$path@$offset" 2>/dev/null;;
+		*) maccalc batch -c /tmp/sysinfo/macaddr "$path@$offset" 2>/dev/null;;
+		esac
+		return
+	fi
+
 	hexdump -v -n 6 -s $offset -e '5/1 "%02x:" 1/1 "%02x"' $path 2>/dev/null
 }
 
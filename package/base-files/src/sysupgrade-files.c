@@ -0,0 +1,725 @@
+/*
+ * sysupgrade-files - build the list of files for a sysupgrade backup
+ *
+ * Replaces the find/cmp/grep pipelines of sysupgrade, which fork twice
+ * per file for -u and match every overlay file against every package
+ * file with grep -F. Package file lists are loaded into a hash set once,
+ * the overlay is walked once and files are only compared against /rom
+ * when their sizes match.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPKG_INFO	"/usr/lib/opkg/info"
+#define OPKG_STATUS	"/usr/lib/opkg/status"
+#define OVERLAY		"/overlay/upper"
+#define ROM		"/rom"
+
+struct entry {
+	struct entry *next;
+	char *val;
+	char path[];
+};
+
+struct set {
+	struct entry **buckets;
+	size_t size;
+	size_t count;
+};
+
+struct list {
+	char **paths;
+	size_t count;
+	size_t size;
+};
+
+static const char *root = "";
+static bool skip_unchanged;
+static struct set conffiles, keepfiles, pkgfiles, excludes;
+static struct list output;
+
+static uint8_t buf1[32768], buf2[32768];
+
+/**************************************************
+ * Helpers
+ **************************************************/
+
+static void *xalloc(size_t size)
+{
+	void *ptr = calloc(1, size);
+
+	if (!ptr) {
+		perror("calloc");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static const char *rootpath(const char *prefix, const char *path)
+{
+	static char buf[2][PATH_MAX];
+	static int idx;
+
+	idx ^= 1;
+	snprintf(buf[idx], sizeof(buf[idx]), "%s%s%s", root, prefix, path);
+
+	return buf[idx];
+}
+
+static uint32_t hash_str(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (uint8_t) *s++) * 16777619u;
+
+	return h;
+}
+
+static struct entry *set_get(struct set *s, const char *path)
+{
+	struct entry *e;
+
+	if (!s->size)
+		return NULL;
+
+	for (e = s->buckets[hash_str(path) & (s->size - 1)]; e; e = e->next)
+		if (!strcmp(e->path, path))
+			return e;
+
+	return NULL;
+}
+
+static struct entry *set_add(struct set *s, const char *path)
+{
+	struct entry *e, *next, **buckets;
+	size_t i, size;
+
+	e = set_get(s, path);
+	if (e)
+		return e;
+
+	if (s->count >= s->size) {
+		size = s->size ? s->size * 2 : 1024;
+		buckets = xalloc(size * sizeof(*buckets));
+
+		for (i = 0; i < s->size; i++) {
+			for (e = s->buckets[i]; e; e = next) {
+				next = e->next;
+				e->next = buckets[hash_str(e->path) & (size - 1)];
+				buckets[hash_str(e->path) & (size - 1)] = e;
+			}
+		}
+
+		free(s->buckets);
+		s->buckets = buckets;
+		s->size = size;
+	}
+
+	e = xalloc(sizeof(*e) + strlen(path) + 1);
+	strcpy(e->path, path);
+	e->next = s->buckets[hash_str(path) & (s->size - 1)];
+	s->buckets[hash_str(path) & (s->size - 1)] = e;
+	s->count++;
+
+	return e;
+}
+
+static void list_add(struct list *l, const char *path)
+{
+	if (l->count == l->size) {
+		l->size = l->size ? l->size * 2 : 256;
+		l->paths = realloc(l->paths, l->size * sizeof(*l->paths));
+		if (!l->paths) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	l->paths[l->count] = strdup(path);
+	if (!l->paths[l->count++]) {
+		perror("strdup");
+		exit(1);
+	}
+}
+
+static int list_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static char *trim(char *s)
+{
+	char *end;
+
+	s += strspn(s, " \t");
+	end = s + strlen(s);
+	while (end > s && strchr(" \t\r\n", end[-1]))
+		*--end = 0;
+
+	return s;
+}
+
+/**************************************************
+ * SHA-256, for opkg conffile checksums
+ **************************************************/
+
+struct sha256 {
+	uint32_t h[8];
+	uint64_t len;
+	uint8_t buf[64];
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct sha256 *c, const uint8_t *p)
+{
+	uint32_t w[64], s[8], t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t) p[4 * i] << 24 | p[4 * i + 1] << 16 |
+		       p[4 * i + 2] << 8 | p[4 * i + 3];
+
+	for (; i < 64; i++)
+		w[i] = w[i - 16] + w[i - 7] +
+		       (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+		       (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+	memcpy(s, c->h, sizeof(s));
+	for (i = 0; i < 64; i++) {
+		t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) +
+		     ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) +
+		     ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+		memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		c->h[i] += s[i];
+}
+
+static void sha256_init(struct sha256 *c)
+{
+	static const uint32_t h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(c->h, h, sizeof(h));
+	c->len = 0;
+}
+
+static void sha256_update(struct sha256 *c, const uint8_t *p, size_t len)
+{
+	size_t used = c->len % 64, n;
+
+	c->len += len;
+
+	if (used) {
+		n = 64 - used < len ? 64 - used : len;
+		memcpy(c->buf + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		sha256_block(c, c->buf);
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+		sha256_block(c, p);
+
+	memcpy(c->buf, p, len);
+}
+
+static void sha256_final(struct sha256 *c, char *hex)
+{
+	uint64_t bits = c->len * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t padlen = 64 - (c->len + 8) % 64;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		pad[padlen + i] = bits >> (56 - 8 * i);
+	sha256_update(c, pad, padlen + 8);
+
+	for (i = 0; i < 32; i++)
+		sprintf(hex + 2 * i, "%02x", (c->h[i / 4] >> (24 - 8 * (i % 4))) & 0xff);
+}
+
+static bool sha256_file(const char *path, char *hex)
+{
+	struct sha256 c;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	sha256_init(&c);
+	while ((len = read(fd, buf1, sizeof(buf1))) > 0)
+		sha256_update(&c, buf1, len);
+	close(fd);
+
+	if (len < 0)
+		return false;
+
+	sha256_final(&c, hex);
+	return true;
+}
+
+/**************************************************
+ * Package data
+ **************************************************/
+
+/* Conffiles of all installed packages, with their checksums */
+static void load_conffiles(void)
+{
+	char line[PATH_MAX + 80], *path, *csum;
+	struct entry *e;
+	bool in_conffiles = false;
+	FILE *f;
+
+	f = fopen(rootpath(OPKG_STATUS, ""), "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Conffiles:", 10)) {
+			in_conffiles = true;
+			continue;
+		}
+
+		if (line[0] != ' ') {
+			in_conffiles = false;
+			continue;
+		}
+
+		if (!in_conffiles)
+			continue;
+
+		path = strtok(line, " \t\r\n");
+		csum = strtok(NULL, " \t\r\n");
+		if (!path)
+			continue;
+
+		e = set_add(&conffiles, path);
+		free(e->val);
+		e->val = csum ? strdup(csum) : NULL;
+	}
+
+	fclose(f);
+}
+
+static bool conffile_changed(struct entry *e)
+{
+	char hex[65];
+
+	if (!e->val || !sha256_file(rootpath(e->path, ""), hex))
+		return true;
+
+	return strcmp(hex, e->val) != 0;
+}
+
+/* Files installed by packages, including alternatives links */
+static void load_pkgfiles(void)
+{
+	char line[PATH_MAX + 80], *p, *alt;
+	struct dirent *de;
+	size_t len;
+	DIR *dir;
+	FILE *f;
+
+	dir = opendir(rootpath(OPKG_INFO, ""));
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		if (len > 5 && !strcmp(de->d_name + len - 5, ".list")) {
+			f = fopen(rootpath(OPKG_INFO "/", de->d_name), "r");
+			if (!f)
+				continue;
+
+			while (fgets(line, sizeof(line), f))
+				if (*(p = trim(line)))
+					set_add(&pkgfiles, p);
+			fclose(f);
+		} else if (len > 8 && !strcmp(de->d_name + len - 8, ".control")) {
+			f = fopen(rootpath(OPKG_INFO "/", de->d_name), "r");
+			if (!f)
+				continue;
+
+			/* Alternatives: prio:/link:/target, prio:/link:/target */
+			while (fgets(line, sizeof(line), f)) {
+				if (strncmp(line, "Alternatives: ", 14))
+					continue;
+
+				for (alt = strtok(line + 14, ","); alt; alt = strtok(NULL, ",")) {
+					p = strchr(alt, ':');
+					if (!p)
+						continue;
+					p++;
+					p[strcspn(p, ":")] = 0;
+					if (*(p = trim(p)))
+						set_add(&pkgfiles, p);
+				}
+			}
+			fclose(f);
+		}
+	}
+
+	closedir(dir);
+}
+
+/**************************************************
+ * File walk
+ **************************************************/
+
+static bool same_content(const char *a, const char *b, off_t size)
+{
+	ssize_t len1, len2;
+	int fd1, fd2;
+	bool ret = false;
+
+	fd1 = open(a, O_RDONLY);
+	if (fd1 < 0)
+		return false;
+
+	fd2 = open(b, O_RDONLY);
+	if (fd2 < 0)
+		goto out;
+
+	do {
+		len1 = read(fd1, buf1, sizeof(buf1));
+		len2 = read(fd2, buf2, sizeof(buf2));
+		if (len1 < 0 || len1 != len2 || memcmp(buf1, buf2, len1))
+			goto out_close;
+		size -= len1;
+	} while (len1 > 0);
+
+	ret = !size;
+
+out_close:
+	close(fd2);
+out:
+	close(fd1);
+	return ret;
+}
+
+/* Like "test -e /rom/file && cmp -s /file /rom/file", without forking */
+static bool unchanged(const char *path)
+{
+	struct stat st, rst;
+	const char *cur = rootpath(path, ""), *rom = rootpath(ROM, path);
+
+	if (stat(cur, &st) || stat(rom, &rst))
+		return false;
+
+	if (!S_ISREG(st.st_mode) || !S_ISREG(rst.st_mode) ||
+	    st.st_size != rst.st_size)
+		return false;
+
+	if (st.st_dev == rst.st_dev && st.st_ino == rst.st_ino)
+		return true;
+
+	return same_content(cur, rom, st.st_size);
+}
+
+static bool excluded(const char *path)
+{
+	size_t len = strlen(path);
+
+	if (set_get(&excludes, path))
+		return true;
+
+	if (len > 5 && !strcmp(path + len - 5, "-opkg"))
+		return true;
+
+	return !strncmp(path, "/usr/lib/opkg/", 14);
+}
+
+typedef void (*walk_cb)(const char *path);
+
+/* find <path> \( -type f -o -type l \), calls cb with path below base */
+static void walk(const char *base, char *path, size_t len, walk_cb cb)
+{
+	struct dirent *de;
+	struct stat st;
+	char full[PATH_MAX];
+	DIR *dir;
+
+	snprintf(full, sizeof(full), "%s%s", base, path);
+	if (lstat(full, &st))
+		return;
+
+	if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
+		cb(path);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return;
+
+	dir = opendir(full);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		size_t nlen = strlen(de->d_name);
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (len + nlen + 2 >= PATH_MAX)
+			continue;
+
+		if (len && path[len - 1] == '/')
+			len--;
+		path[len] = '/';
+		memcpy(path + len + 1, de->d_name, nlen + 1);
+		walk(base, path, len + 1 + nlen, cb);
+		path[len] = 0;
+	}
+
+	closedir(dir);
+}
+
+static void add_keepfile(const char *path)
+{
+	set_add(&keepfiles, path);
+}
+
+/* Expand the entries of sysupgrade.conf and keep.d like the shell did */
+static void load_keepfiles(void)
+{
+	char line[PATH_MAX], path[PATH_MAX], *word;
+	glob_t keep, gl;
+	size_t i, j;
+	FILE *f;
+
+	if (glob(rootpath("/lib/upgrade/keep.d/*", ""), 0, NULL, &keep))
+		keep.gl_pathc = 0;
+
+	for (i = 0; i <= keep.gl_pathc; i++) {
+		f = fopen(i ? keep.gl_pathv[i - 1] : rootpath("/etc/sysupgrade.conf", ""), "r");
+		if (!f)
+			continue;
+
+		while (fgets(line, sizeof(line), f)) {
+			word = trim(line);
+			if (!*word || *word == '#')
+				continue;
+
+			for (word = strtok(word, " \t"); word; word = strtok(NULL, " \t")) {
+				if (glob(rootpath(word, ""), GLOB_NOCHECK, NULL, &gl))
+					continue;
+
+				for (j = 0; j < gl.gl_pathc; j++) {
+					snprintf(path, sizeof(path), "%s", gl.gl_pathv[j] + strlen(root));
+					walk(root, path, strlen(path), add_keepfile);
+				}
+				globfree(&gl);
+			}
+		}
+
+		fclose(f);
+	}
+
+	if (keep.gl_pathc)
+		globfree(&keep);
+}
+
+static void add_overlayfile(const char *path)
+{
+	struct entry *e;
+
+	if (excluded(path))
+		return;
+
+	/* files from packages are restored by reinstalling them */
+	if (set_get(&pkgfiles, path) && !set_get(&keepfiles, path)) {
+		e = set_get(&conffiles, path);
+		if (!e || (skip_unchanged && !conffile_changed(e)))
+			return;
+	}
+
+	if (skip_unchanged && unchanged(path))
+		return;
+
+	list_add(&output, path);
+}
+
+/**************************************************
+ * Modes
+ **************************************************/
+
+/* sysupgrade -b: sysupgrade.conf, keep.d and changed conffiles */
+static void list_conffiles(void)
+{
+	struct entry *e;
+	size_t i;
+
+	load_keepfiles();
+	load_conffiles();
+
+	for (i = 0; i < keepfiles.size; i++)
+		for (e = keepfiles.buckets[i]; e; e = e->next)
+			if (!skip_unchanged || !unchanged(e->path))
+				list_add(&output, e->path);
+
+	for (i = 0; i < conffiles.size; i++) {
+		for (e = conffiles.buckets[i]; e; e = e->next) {
+			if (access(rootpath(e->path, ""), R_OK))
+				continue;
+			if (conffile_changed(e))
+				list_add(&output, e->path);
+		}
+	}
+}
+
+/* sysupgrade -c/-o: everything changed in the overlay */
+static void list_overlayfiles(const char *path)
+{
+	char base[PATH_MAX], buf[PATH_MAX];
+
+	if (!strcmp(path, "/")) {
+		load_keepfiles();
+		load_conffiles();
+		load_pkgfiles();
+	}
+
+	set_add(&excludes, "/etc/board.json");
+	set_add(&excludes, "/etc/urandom.seed");
+
+	snprintf(base, sizeof(base), "%s", rootpath(OVERLAY, ""));
+	snprintf(buf, sizeof(buf), "%s", path);
+	walk(base, buf, strlen(buf), add_overlayfile);
+}
+
+/* Format: pkg-name<TAB>{rom,overlay,unknown} */
+static void list_packages(void)
+{
+	struct dirent *de;
+	struct stat st;
+	char line[NAME_MAX + 16];
+	const char *where;
+	size_t len;
+	DIR *dir;
+
+	dir = opendir(rootpath(OPKG_INFO, ""));
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		if (len <= 8 || strcmp(de->d_name + len - 8, ".control"))
+			continue;
+
+		if (!stat(rootpath(ROM OPKG_INFO "/", de->d_name), &st) && S_ISREG(st.st_mode))
+			where = "rom";
+		else if (!stat(rootpath(OVERLAY OPKG_INFO "/", de->d_name), &st) && S_ISREG(st.st_mode))
+			where = "overlay";
+		else
+			where = "unknown";
+
+		snprintf(line, sizeof(line), "%.*s\t%s", (int) len - 8, de->d_name, where);
+		list_add(&output, line);
+	}
+
+	closedir(dir);
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-o <path>	List changed overlay files below path\n"
+		"			(default: sysupgrade.conf, keep.d and changed conffiles)\n"
+		"	-u		Skip files that are equal to those in /rom\n"
+		"	-x <file>	Never list file\n"
+		"	-p		List installed packages and where they come from\n"
+		"	-R <dir>	Operate on the root filesystem at dir\n"
+		"\n", prog);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *overlay = NULL;
+	bool packages = false;
+	size_t i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "o:ux:pR:")) != -1) {
+		switch (ch) {
+		case 'o':
+			overlay = optarg;
+			break;
+		case 'u':
+			skip_unchanged = true;
+			break;
+		case 'x':
+			set_add(&excludes, optarg);
+			break;
+		case 'p':
+			packages = true;
+			break;
+		case 'R':
+			root = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (packages)
+		list_packages();
+	else if (overlay)
+		list_overlayfiles(overlay);
+	else
+		list_conffiles();
+
+	qsort(output.paths, output.count, sizeof(*output.paths), list_cmp);
+	for (i = 0; i < output.count; i++)
+		if (!i || strcmp(output.paths[i], output.paths[i - 1]))
+			puts(output.paths[i]);
+
+	return 0;
+}
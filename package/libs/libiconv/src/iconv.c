@@ -13,6 +13,10 @@
 #include <unistd.h>
 #include <stdint.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* builtin charmaps */
 #include "charmaps.h"
 
@@ -138,6 +142,105 @@ static inline void put_16(unsigned char *s, wchar_t c, int endian)
 	s[endian^1] = c;
 }
 
+static inline wchar_t get_32(const unsigned char *s, int endian)
+{
+	endian = (endian & 1) * 3;
+	return (wchar_t)s[endian]<<24 | s[endian^1]<<16 | s[endian^2]<<8 | s[endian^3];
+}
+
+static inline void put_32(unsigned char *s, wchar_t c, int endian)
+{
+	endian = (endian & 1) * 3;
+	s[endian] = c>>24;
+	s[endian^1] = c>>16;
+	s[endian^2] = c>>8;
+	s[endian^3] = c;
+}
+
+/* length of the leading run of 7-bit characters */
+static size_t ascii_span(const unsigned char *s, size_t n)
+{
+	const size_t high = (size_t)-1 / 0xff * 0x80;
+	size_t i = 0, w;
+
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, s + i, sizeof(w));
+		if (w & high)
+			break;
+	}
+
+	while (i < n && s[i] < 0x80)
+		i++;
+
+	return i;
+}
+
+/*
+ * Convert a run of ASCII characters from an ASCII compatible source in one
+ * go, returns the number of input bytes consumed.
+ */
+static size_t ascii_run(unsigned char to, const unsigned char *s, size_t n,
+			char **out, size_t *outb)
+{
+	unsigned char *o = (unsigned char *)*out;
+	size_t i, w;
+
+	switch (to) {
+	case WCHAR_T:
+		w = sizeof(wchar_t);
+		break;
+	case UTF_16BE:
+	case UTF_16LE:
+		w = 2;
+		break;
+	case UTF_32BE:
+	case UTF_32LE:
+		w = 4;
+		break;
+	default:
+		w = 1;
+		break;
+	}
+
+	if (n > *outb / w)
+		n = *outb / w;
+
+	n = ascii_span(s, n);
+
+	switch (to) {
+	case WCHAR_T:
+		for (i = 0; i < n; i++)
+			((wchar_t *)o)[i] = s[i];
+		break;
+	case UTF_16BE:
+	case UTF_16LE:
+		for (i = 0; i < n; i++)
+			put_16(o + 2*i, s[i], to);
+		break;
+	case UTF_32BE:
+	case UTF_32LE:
+		for (i = 0; i < n; i++)
+			put_32(o + 4*i, s[i], to);
+		break;
+	default:
+		memcpy(o, s, n);
+		break;
+	}
+
+	*out += n * w;
+	*outb -= n * w;
+
+	return n;
+}
+
 static inline int utf8enc_wchar(char *outb, wchar_t c)
 {
 	if (c <= 0x7F) {
@@ -290,7 +393,12 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	for (; *inb; *in+=l, *inb-=l) {
 		c = *(unsigned char *)*in;
 		l = 1;
-		if (from >= UTF_8 && c < 0x80) goto charok;
+		if (from >= UTF_8 && c < 0x80) {
+			l = ascii_run(to, *in, *inb, out, outb);
+			if (l) continue;
+			l = 1;
+			goto charok;
+		}
 		switch (from) {
 		case WCHAR_T:
 			l = sizeof(wchar_t);
@@ -344,8 +452,7 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 		case UTF_32LE:
 			l = 4;
 			if (*inb < 4) goto starved;
-			// FIXME
-			// c = get_32(*in, from);
+			c = get_32(*in, from);
 			break;
 		default:
 			/* only support ascii supersets */
@@ -424,6 +531,13 @@ charok:
 			*out += 4;
 			*outb -= 4;
 			break;
+		case UTF_32BE:
+		case UTF_32LE:
+			if (*outb < 4) goto toobig;
+			put_32(*out, c, to);
+			*out += 4;
+			*outb -= 4;
+			break;
 		default:
 			goto badf;
 		}
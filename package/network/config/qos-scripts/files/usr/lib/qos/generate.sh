@@ -120,7 +120,7 @@ parse_matching_rule() {
 			;;
 			*:comment)
 				add_insmod xt_comment
-				append "$var" "-m comment --comment '$value'"
+				append "$var" "-m comment --comment \"$value\""
 			;;
 			*:tos)
 				add_insmod xt_dscp
@@ -274,9 +274,20 @@ tcrules() {
 		-v device="$dev" \
 		-v linespeed="$rate" \
 		-v direction="$dir" \
+		-v major="$major" \
 		-f $_dir/tcrules.awk
 }
 
+# The new tree is built under the major handle the current root qdisc
+# does not use, so "qdisc replace" swaps it in with a single operation
+# instead of leaving the device unshaped after a "qdisc del".
+root_major() {
+	case "$(tc qdisc show dev "$1" root 2>&-)" in
+		"qdisc hfsc 1: "*) echo 2;;
+		*) echo 1;;
+	esac
+}
+
 start_interface() {
 	local iface="$1"
 	local num_ifb="$2"
@@ -325,11 +336,12 @@ start_interface() {
 			config_get classnr "$class" classnr
 			append cstr "$classnr:$prio:$avgrate:$pktsize:$pktdelay:$maxrate:$qdisc:$filter" "$N"
 		done
+		major="$(root_major "$dev")"
 		append ${prefix}q "$(tcrules)" "$N"
-		export dev_${dir}="ifconfig $dev up >&- 2>&-
-tc qdisc del dev $dev root >&- 2>&-
-tc qdisc add dev $dev root handle 1: hfsc default ${class_default}0
-tc class add dev $dev parent 1: classid 1:1 hfsc sc rate ${rate}kbit ul rate ${rate}kbit"
+		append IFUP "ifconfig $dev up >&- 2>&-" "$N"
+		append QOS_DEVS "$dev"
+		export dev_${dir}="qdisc replace dev $dev root handle $major: hfsc default ${class_default}0
+class add dev $dev parent $major: classid $major:1 hfsc sc rate ${rate}kbit ul rate ${rate}kbit"
 	done
 	[ -n "$download" ] && {
 		add_insmod cls_u32
@@ -338,28 +350,52 @@ tc class add dev $dev parent 1: classid 1:1 hfsc sc rate ${rate}kbit ul rate ${r
 		add_insmod act_mirred
 		add_insmod sch_ingress
 	}
+	append QOS_DEVS "$device"
 	if [ -n "$halfduplex" ]; then
-		export dev_up="tc qdisc del dev $device root >&- 2>&-
-tc qdisc add dev $device root handle 1: hfsc
-tc filter add dev $device parent 1: prio 10 u32 match u32 0 0 flowid 1:1 action mirred egress redirect dev ifb$ifbdev"
+		major="$(root_major "$device")"
+		export dev_up="qdisc replace dev $device root handle $major: hfsc
+filter add dev $device parent $major: prio 10 u32 match u32 0 0 flowid $major:1 action mirred egress redirect dev ifb$ifbdev"
 	elif [ -n "$download" ]; then
-		append dev_${dir} "tc qdisc del dev $device ingress >&- 2>&-
-tc qdisc add dev $device ingress
-tc filter add dev $device parent ffff: prio 1 u32 match u32 0 0 flowid 1:1 action connmark action mirred egress redirect dev ifb$ifbdev" "$N"
+		append dev_${dir} "qdisc replace dev $device ingress
+filter del dev $device parent ffff: prio 1
+filter add dev $device parent ffff: prio 1 u32 match u32 0 0 flowid 1:1 action connmark action mirred egress redirect dev ifb$ifbdev" "$N"
+	else
+		append dev_up "qdisc del dev $device ingress" "$N"
 	fi
 	add_insmod cls_fw
 	add_insmod sch_hfsc
 
-	cat <<EOF
-${INSMOD:+$INSMOD$N}${dev_up:+$dev_up
+	append TCBATCH "${dev_up:+$dev_up
 $clsq
 }${ifbdev:+$dev_down
 $d_clsq
 $d_clsl
 $d_clsf
+}" "$N"
+	unset clsq clsf clsl d_clsq d_clsl d_clsf dev_up dev_down
 }
+
+# Print the module loading commands and a single tc batch for the
+# configured interfaces, with cleanup set also removing the qos qdiscs
+# of devices no longer used
+emit_tc() {
+	local cleanup="$1"
+	local dev
+
+	[ -n "$cleanup" ] && for dev in $(tc qdisc show | grep -E '(hfsc|ingress)' | awk '{print $5}' | sort -u); do
+		case " $QOS_DEVS " in
+			*" $dev "*) ;;
+			*) append TCBATCH "qdisc del dev $dev ingress
+qdisc del dev $dev root" "$N";;
+		esac
+	done
+
+	cat <<EOF
+${INSMOD:+$INSMOD$N}${IFUP:+$IFUP$N}tc -force -batch - >&- 2>&- <<'TCEOF'
+$TCBATCH
+TCEOF
 EOF
-	unset INSMOD clsq clsf clsl d_clsq d_clsl d_clsf dev_up dev_down
+	unset INSMOD IFUP TCBATCH
 }
 
 start_interfaces() {
@@ -367,6 +403,7 @@ start_interfaces() {
 	for iface in $INTERFACES; do
 		start_interface "$iface" "$C"
 	done
+	emit_tc cleanup
 }
 
 add_rules() {
@@ -401,23 +438,17 @@ start_cg() {
 	local pktrules
 	local sizerules
 	enum_classes "$cg"
-	for command in $iptables; do
-		add_rules iptrules "$ctrules" "$command -w -t mangle -A qos_${cg}_ct"
-	done
+	add_rules iptrules "$ctrules" "-A qos_${cg}_ct"
 	config_get classes "$cg" classes
 	for class in $classes; do
 		config_get mark "$class" classnr
 		config_get maxsize "$class" maxsize
 		[ -z "$maxsize" -o -z "$mark" ] || {
 			add_insmod xt_length
-			for command in $iptables; do
-				append pktrules "$command -w -t mangle -A qos_${cg} -m mark --mark $mark/0x0f -m length --length $maxsize: -j MARK --set-mark 0/0xff" "$N"
-			done
+			append pktrules "-A qos_${cg} -m mark --mark $mark/0x0f -m length --length $maxsize: -j MARK --set-mark 0/0xff" "$N"
 		}
 	done
-	for command in $iptables; do
-		add_rules pktrules "$rules" "$command -w -t mangle -A qos_${cg}"
-	done
+	add_rules pktrules "$rules" "-A qos_${cg}"
 	for iface in $INTERFACES; do
 		config_get classgroup "$iface" classgroup
 		config_get device "$iface" device
@@ -426,75 +457,81 @@ start_cg() {
 		config_get download "$iface" download
 		config_get halfduplex "$iface" halfduplex
 		download="${download:-${halfduplex:+$upload}}"
-		for command in $iptables; do
-			append up "$command -w -t mangle -A OUTPUT -o $device -j qos_${cg}" "$N"
-			append up "$command -w -t mangle -A FORWARD -o $device -j qos_${cg}" "$N"
-		done
+		append up "-A OUTPUT -o $device -j qos_${cg}" "$N"
+		append up "-A FORWARD -o $device -j qos_${cg}" "$N"
 	done
-	cat <<EOF
-$INSMOD
-EOF
 
-for command in $iptables; do
-	cat <<EOF
-	$command -w -t mangle -N qos_${cg} 
-	$command -w -t mangle -N qos_${cg}_ct
-EOF
-done
-cat <<EOF
-	${iptrules:+${iptrules}${N}}
-EOF
-for command in $iptables; do
-	cat <<EOF
-	$command -w -t mangle -A qos_${cg}_ct -j CONNMARK --save-mark --mask 0xff
-	$command -w -t mangle -A qos_${cg} -j CONNMARK --restore-mark --mask 0x0f
-	$command -w -t mangle -A qos_${cg} -m mark --mark 0/0x0f -j qos_${cg}_ct
-EOF
-done
-cat <<EOF
-$pktrules
-EOF
-for command in $iptables; do
-	cat <<EOF
-	$command -w -t mangle -A qos_${cg} -j CONNMARK --save-mark --mask 0xff
-EOF
-done
-cat <<EOF
-$up$N${down:+${down}$N}
-EOF
-	unset INSMOD
+	append CHAINS "qos_${cg} qos_${cg}_ct"
+	append IPTRULES "${iptrules:+${iptrules}${N}}-A qos_${cg}_ct -j CONNMARK --save-mark --mask 0xff
+-A qos_${cg} -j CONNMARK --restore-mark --mask 0x0f
+-A qos_${cg} -m mark --mark 0/0x0f -j qos_${cg}_ct
+${pktrules:+${pktrules}${N}}-A qos_${cg} -j CONNMARK --save-mark --mask 0xff
+$up${down:+$N$down}" "$N"
+}
+
+# Drop rules matching host addresses of the other family, they would
+# make the whole restore transaction fail
+filter_family() {
+	awk -v family="$1" '{
+		for (i = 1; i < NF; i++) {
+			if ($i != "-s" && $i != "-d") continue
+			addr = $(i + 1)
+			if (family == 4 && addr ~ /:/) next
+			if (family == 6 && addr ~ /^[0-9.\/]+$/) next
+		}
+		print
+	}'
+}
+
+# Print one iptables-restore transaction per family: the old jumps into
+# the qos chains are removed, stale chains deleted and the configured
+# chains flushed and refilled, all in a single commit
+emit_firewall() {
+	local command family chain stale
+
+	for command in $iptables; do
+		family=4
+		[ "$command" = ip6tables ] && family=6
+
+		echo "${command}-restore -w --noflush <<'IPTEOF'"
+		echo "*mangle"
+		for chain in $CHAINS; do
+			echo ":$chain - [0:0]"
+		done
+		$command -w -t mangle -S | grep -E -- '-j qos_' | grep -v '^-A qos_' | sed -e 's/^-A/-D/'
+		stale=
+		for chain in $($command -w -t mangle -S | sed -n -e 's/^-N \(qos_.*\)/\1/p'); do
+			case " $CHAINS " in
+				*" $chain "*) ;;
+				*) echo "-F $chain"; append stale "$chain";;
+			esac
+		done
+		for chain in $stale; do
+			echo "-X $chain"
+		done
+		[ -n "$IPTRULES" ] && echo "$IPTRULES" | filter_family $family
+		echo "COMMIT"
+		echo "IPTEOF"
+	done
 }
 
 start_firewall() {
 	add_insmod xt_multiport
 	add_insmod xt_connmark
-	stop_firewall
 	for group in $CG; do
 		start_cg $group
 	done
+	cat <<EOF
+$INSMOD
+EOF
+	unset INSMOD
+	emit_firewall
 }
 
 stop_firewall() {
-	# Builds up a list of iptables commands to flush the qos_* chains,
-	# remove rules referring to them, then delete them
-
-	# Print rules in the mangle table, like iptables-save
-	for command in $iptables; do
-		$command -w -t mangle -S |
-			# Find rules for the qos_* chains
-			grep -E '(^-N qos_|-j qos_)' |
-			# Exclude rules in qos_* chains (inter-qos_* refs)
-			grep -v '^-A qos_' |
-			# Replace -N with -X and hold, with -F and print
-			# Replace -A with -D
-			# Print held lines at the end (note leading newline)
-			sed -e '/^-N/{s/^-N/-X/;H;s/^-X/-F/}' \
-				-e 's/^-A/-D/' \
-				-e '${p;g}' |
-			# Make into proper iptables calls
-			# Note: awkward in previous call due to hold space usage
-			sed -n -e "s/^./${command} -w -t mangle &/p"
-	done
+	CHAINS=
+	IPTRULES=
+	emit_firewall
 }
 
 C="0"
@@ -525,6 +562,7 @@ case "$1" in
 	;;
 	interface)
 		start_interface "$2" "$C"
+		emit_tc
 	;;
 	interfaces)
 		start_interfaces
@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <netdb.h>
 
+#include "prefix.h"
+
 static void sighandler(__attribute__((unused)) int signal)
 {
 }
@@ -58,10 +60,26 @@ int main(int argc, const char *argv[])
 	setvbuf(fp, NULL, _IOLBF, 0);
 	fprintf(fp, "%d\n", getpid());
 
-	prefix[sizeof(prefix) - 1] = 0;
-	strncpy(prefix, argv[3], sizeof(prefix) - 1);
+	prefix[0] = 0;
+
+	if (argv[3][0]) {
+		struct in6_addr addr;
+		int len;
+
+		/* RFC6052 prefix with the host bits cleared, /96 if omitted */
+		if (prefix_parse(AF_INET6, argv[3], &addr, &len))
+			return 1;
 
-	if (!prefix[0]) {
+		if (!strchr(argv[3], '/'))
+			len = 96;
+		else if (len > 96)
+			return 1;
+
+		bmemclr(&addr, len, 128);
+		inet_ntop(AF_INET6, &addr, prefix, sizeof(prefix) - 4);
+		snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix),
+			 "/%d", len);
+	} else {
 		struct addrinfo hints = { .ai_family = AF_INET6 }, *res;
 		if (getaddrinfo("ipv4only.arpa", NULL, &hints, &res) || !res) {
 			sleep(3);
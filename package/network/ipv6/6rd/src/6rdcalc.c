@@ -25,6 +25,8 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "prefix.h"
+
 #define INET_PREFIXSTRLEN (INET_ADDRSTRLEN+3)
 #define INET6_PREFIXSTRLEN (INET6_ADDRSTRLEN+4)
 
@@ -71,8 +73,6 @@ int main(int argc, const char **argv)
 	struct in6_addr v6;
 	struct in_addr v4;
 	unsigned long v6it, v4it, mask;
-	unsigned char *byte4, *byte6;
-	unsigned char bit4, bit6;
 
 	/* Check parameters. */
 	if (argc != 3)
@@ -85,7 +85,7 @@ int main(int argc, const char **argv)
 
 	/* Parse the v4 address */
 	strncpy(v4str, argv[2], INET_PREFIXSTRLEN);
-	v6str[INET_PREFIXSTRLEN-1] = '\0';
+	v4str[INET_PREFIXSTRLEN-1] = '\0';
 	parse_str(AF_INET, v4str, &v4, &v4it);
 
 	/* Check if the combined mask is within bounds. */
@@ -93,30 +93,9 @@ int main(int argc, const char **argv)
 	if (mask > 128)
 		print_usage();
 
-	/* Combine the addresses. */
-	while (v4it < 32) {
-		byte6 = (unsigned char *)(&v6.s6_addr) + (v6it >> 3);
-		byte4 = (unsigned char *)(&v4.s_addr)  + (v4it >> 3);
-		bit6 = 128 >> (v6it & 0x07);
-		bit4 = 128 >> (v4it & 0x07);
-
-		if (*byte4 & bit4)
-			*byte6 |= bit6;
-		else
-			*byte6 &= ~bit6;
-
-		v4it++; v6it++;
-	}
-
-	/* Clear remaining bits. */
-	while (v6it < 128) {
-		byte6 = (unsigned char *)(&v6.s6_addr) + (v6it >> 3);
-		bit6 = 128 >> (v6it & 0x07);
-
-		*byte6 &= ~bit6;
-
-		v6it++;
-	}
+	/* Combine the addresses and clear the remaining bits. */
+	bmemcpybits(&v6, v6it, &v4, v4it, 32 - v4it);
+	bmemclr(&v6, mask, 128);
 
 	/* Print the subnet prefix. */
 	if (inet_ntop(AF_INET6, &v6, v6str, sizeof(v6str)) == NULL)
@@ -23,8 +23,11 @@
 #include <libubus.h>
 #include <libubox/utils.h>
 
+#include "prefix.h"
+
 
 struct blob_attr *dump = NULL;
+static bool legacy_mode = false;
 
 enum {
 	DUMP_ATTR_INTERFACE,
@@ -61,46 +64,6 @@ static const struct blobmsg_policy prefix_attrs[PREFIX_ATTR_MAX] = {
 	[PREFIX_ATTR_MASK] = { .name = "mask", .type = BLOBMSG_TYPE_INT32 },
 };
 
-static int bmemcmp(const void *av, const void *bv, size_t bits)
-{
-	const uint8_t *a = av, *b = bv;
-	size_t bytes = bits / 8;
-	bits %= 8;
-
-	int res = memcmp(a, b, bytes);
-	if (res == 0 && bits > 0)
-		res = (a[bytes] >> (8 - bits)) - (b[bytes] >> (8 - bits));
-
-	return res;
-}
-
-static void bmemcpy(void *av, const void *bv, size_t bits)
-{
-	uint8_t *a = av;
-	const uint8_t *b = bv;
-
-	size_t bytes = bits / 8;
-	bits %= 8;
-	memcpy(a, b, bytes);
-
-	if (bits > 0) {
-		uint8_t mask = (1 << (8 - bits)) - 1;
-		a[bytes] = (a[bytes] & mask) | ((~mask) & b[bytes]);
-	}
-}
-
-static void bmemcpys64(void *av, const void *bv, size_t frombits, size_t nbits)
-{
-	uint64_t buf = 0;
-	const uint8_t *b = bv;
-	size_t frombyte = frombits / 8, tobyte = (frombits + nbits) / 8;
-
-	memcpy(&buf, &b[frombyte], tobyte - frombyte + 1);
-	buf = cpu_to_be64(be64_to_cpu(buf) << (frombits % 8));
-
-	bmemcpy(av, &buf, nbits);
-}
-
 static void handle_dump(struct ubus_request *req __attribute__((unused)),
 		int type __attribute__((unused)), struct blob_attr *msg)
 {
@@ -187,232 +150,453 @@ static char *const token[] = {
 };
 
 
-int main(int argc, char *argv[])
-{
-	int status = 0;
-	const char *iface = argv[1];
 
-	const char *legacy_env = getenv("LEGACY");
-	bool legacy = legacy_env && atoi(legacy_env);
+struct map_rule {
+	struct prefix_item item;
+	const char *str;
+	const char *iface;
+	bool lw4o6;
+	bool fmr;
+	int ealen;
+	int addr4len;
+	int prefix4len;
+	int prefix6len;
+	int pdlen;
+	struct in_addr ipv4prefix;
+	struct in_addr ipv4addr;
+	struct in6_addr ipv6addr;
+	struct in6_addr ipv6prefix;
+	struct in6_addr pd;
+	int offset;
+	int psidlen;
+	int psid;
+	uint16_t psid16;
+	const char *dmr;
+	const char *br;
+};
 
+struct pd_match {
+	const char *iface;
+	struct in6_addr prefix;
+	int mask;
+};
 
-	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <interface|*> <rule1> [rule2] [...]\n", argv[0]);
-		return 1;
+static void parse_rule(struct map_rule *r, const char *str)
+{
+	memset(r, 0, sizeof(*r));
+	r->str = str;
+	r->ealen = -1;
+	r->addr4len = 32;
+	r->prefix4len = 32;
+	r->prefix6len = -1;
+	r->pdlen = -1;
+	r->offset = -1;
+	r->psidlen = -1;
+	r->psid = -1;
+
+	for (char *rule = strdup(str); *rule; ) {
+		char *value;
+		int intval;
+		int idx = getsubopt(&rule, token, &value);
+		errno = 0;
+
+		if (idx == OPT_TYPE) {
+			r->lw4o6 = (value && !strcmp(value, "lw4o6"));
+		} else if (idx == OPT_FMR) {
+			r->fmr = true;
+		} else if (idx == OPT_EALEN && (intval = strtoul(value, NULL, 0)) <= 48 && !errno) {
+			r->ealen = intval;
+		} else if (idx == OPT_PREFIX4LEN && (intval = strtoul(value, NULL, 0)) <= 32 && !errno) {
+			r->prefix4len = intval;
+		} else if (idx == OPT_PREFIX6LEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
+			r->prefix6len = intval;
+		} else if (idx == OPT_IPV4PREFIX && inet_pton(AF_INET, value, &r->ipv4prefix) == 1) {
+			// dummy
+		} else if (idx == OPT_IPV6PREFIX && inet_pton(AF_INET6, value, &r->ipv6prefix) == 1) {
+			// dummy
+		} else if (idx == OPT_PD && inet_pton(AF_INET6, value, &r->pd) == 1) {
+			// dummy
+		} else if (idx == OPT_OFFSET && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
+			r->offset = intval;
+		} else if (idx == OPT_PSIDLEN && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
+			r->psidlen = intval;
+		} else if (idx == OPT_PDLEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
+			r->pdlen = intval;
+		} else if (idx == OPT_PSID && (intval = strtoul(value, NULL, 0)) <= 65535 && !errno) {
+			r->psid = intval;
+		} else if (idx == OPT_DMR) {
+			r->dmr = value;
+		} else if (idx == OPT_BR) {
+			r->br = value;
+		} else {
+			if (idx == -1 || idx >= OPT_MAX)
+				fprintf(stderr, "Skipped invalid option: %s\n", value);
+			else
+				fprintf(stderr, "Skipped invalid value %s for option %s\n",
+						value, token[idx]);
+		}
 	}
 
-	uint32_t network_interface;
-	struct ubus_context *ubus = ubus_connect(NULL);
-	if (ubus) {
-		ubus_lookup_id(ubus, "network.interface", &network_interface);
-		ubus_invoke(ubus, network_interface, "dump", NULL, handle_dump, NULL, 5000);
+	if (r->offset < 0)
+		r->offset = (r->lw4o6) ? 0 : (legacy_mode) ? 4 : 6;
+
+	// LW4over6 doesn't have an EALEN and has no psid-autodetect
+	if (r->lw4o6) {
+		if (r->psidlen < 0)
+			r->psidlen = 0;
+
+		r->ealen = r->psidlen;
 	}
+}
 
-	int rulecnt = 0;
-	for (int i = 2; i < argc; ++i) {
-		bool lw4o6 = false;
-		bool fmr = false;
-		int ealen = -1;
-		int addr4len = 32;
-		int prefix4len = 32;
-		int prefix6len = -1;
-		int pdlen = -1;
-		struct in_addr ipv4prefix = {INADDR_ANY};
-		struct in_addr ipv4addr = {INADDR_ANY};
-		struct in6_addr ipv6addr = IN6ADDR_ANY_INIT;
-		struct in6_addr ipv6prefix = IN6ADDR_ANY_INIT;
-		struct in6_addr pd = IN6ADDR_ANY_INIT;
-		int offset = -1;
-		int psidlen = -1;
-		int psid = -1;
-		uint16_t psid16 = 0;
-		const char *dmr = NULL;
-		const char *br = NULL;
-
-		for (char *rule = strdup(argv[i]); *rule; ) {
-			char *value;
-			int intval;
-			int idx = getsubopt(&rule, token, &value);
-			errno = 0;
-
-			if (idx == OPT_TYPE) {
-				lw4o6 = (value && !strcmp(value, "lw4o6"));
-			} else if (idx == OPT_FMR) {
-				fmr = true;
-			} else if (idx == OPT_EALEN && (intval = strtoul(value, NULL, 0)) <= 48 && !errno) {
-				ealen = intval;
-			} else if (idx == OPT_PREFIX4LEN && (intval = strtoul(value, NULL, 0)) <= 32 && !errno) {
-				prefix4len = intval;
-			} else if (idx == OPT_PREFIX6LEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
-				prefix6len = intval;
-			} else if (idx == OPT_IPV4PREFIX && inet_pton(AF_INET, value, &ipv4prefix) == 1) {
-				// dummy
-			} else if (idx == OPT_IPV6PREFIX && inet_pton(AF_INET6, value, &ipv6prefix) == 1) {
-				// dummy
-			} else if (idx == OPT_PD && inet_pton(AF_INET6, value, &pd) == 1) {
-				// dummy
-			} else if (idx == OPT_OFFSET && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
-				offset = intval;
-			} else if (idx == OPT_PSIDLEN && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
-				psidlen = intval;
-			} else if (idx == OPT_PDLEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
-				pdlen = intval;
-			} else if (idx == OPT_PSID && (intval = strtoul(value, NULL, 0)) <= 65535 && !errno) {
-				psid = intval;
-			} else if (idx == OPT_DMR) {
-				dmr = value;
-			} else if (idx == OPT_BR) {
-				br = value;
-			} else {
-				if (idx == -1 || idx >= OPT_MAX)
-					fprintf(stderr, "Skipped invalid option: %s\n", value);
-				else
-					fprintf(stderr, "Skipped invalid value %s for option %s\n",
-							value, token[idx]);
-			}
-		}
+// Longest delegated prefix below the rule prefix, first interface wins
+static void match_rule(struct prefix_item *item, void *priv)
+{
+	struct map_rule *r = container_of(item, struct map_rule, item);
+	struct pd_match *m = priv;
 
-		if (offset < 0)
-			offset = (lw4o6) ? 0 : (legacy) ? 4 : 6;
+	if (r->iface && r->iface != m->iface)
+		return;
 
-		// LW4over6 doesn't have an EALEN and has no psid-autodetect
-		if (lw4o6) {
-			if (psidlen < 0)
-				psidlen = 0;
+	if (r->pdlen < m->mask) {
+		bmemcpy(&r->pd, &m->prefix, m->mask);
+		r->pdlen = m->mask;
+		r->iface = m->iface;
+	}
+}
 
-			ealen = psidlen;
-		}
+static void match_index(struct prefix_node *index, const char *iface, struct blob_attr *cur)
+{
+	struct blob_attr *d;
+	unsigned drem;
 
-		// Find PD
-		if (pdlen < 0) {
-			struct blob_attr *c;
-			unsigned rem;
-			blobmsg_for_each_attr(c, dump, rem) {
-				struct blob_attr *tb[IFACE_ATTR_MAX];
-				blobmsg_parse(iface_attrs, IFACE_ATTR_MAX, tb, blobmsg_data(c), blobmsg_data_len(c));
+	if (!cur || blobmsg_type(cur) != BLOBMSG_TYPE_ARRAY || !blobmsg_check_attr(cur, false))
+		return;
 
-				if (!tb[IFACE_ATTR_INTERFACE] || (strcmp(argv[1], "*") && strcmp(argv[1],
-						blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]))))
-					continue;
+	blobmsg_for_each_attr(d, cur, drem) {
+		struct blob_attr *ptb[PREFIX_ATTR_MAX];
+		struct pd_match m = { .iface = iface, .prefix = IN6ADDR_ANY_INIT };
 
-				match_prefix(&pdlen, &pd, tb[IFACE_ATTR_PREFIX], &ipv6prefix, prefix6len, lw4o6);
+		blobmsg_parse(prefix_attrs, PREFIX_ATTR_MAX, ptb,
+				blobmsg_data(d), blobmsg_data_len(d));
 
-				if (lw4o6)
-					match_prefix(&pdlen, &pd, tb[IFACE_ATTR_ADDRESS], &ipv6prefix, prefix6len, lw4o6);
+		if (!ptb[PREFIX_ATTR_ADDRESS] || !ptb[PREFIX_ATTR_MASK])
+			continue;
 
-				if (pdlen >= 0) {
-					iface = blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]);
-					break;
-				}
-			}
-		}
+		m.mask = blobmsg_get_u32(ptb[PREFIX_ATTR_MASK]);
+		if (m.mask < 0 || m.mask > 128)
+			continue;
 
-		if (ealen < 0 && pdlen >= 0)
-			ealen = pdlen - prefix6len;
+		inet_pton(AF_INET6, blobmsg_get_string(ptb[PREFIX_ATTR_ADDRESS]), &m.prefix);
+		prefix_trie_match(index, &m.prefix, m.mask, match_rule, &m);
+	}
+}
 
-		if (psidlen <= 0) {
-			psidlen = ealen - (32 - prefix4len);
-			if (psidlen < 0)
-				psidlen = 0;
+// Assign delegated prefixes to all rules in a single pass over the dump
+static void find_pds(struct map_rule *rules, int nrules, const char *filter)
+{
+	struct prefix_node *index = NULL;
+	struct blob_attr *c;
+	unsigned rem;
+	bool lw4o6 = false;
 
-			psid = -1;
-		}
+	for (int i = 0; i < nrules; ++i) {
+		struct map_rule *r = &rules[i];
 
-		if (prefix4len < 0 || prefix6len < 0 || ealen < 0 || psidlen > 16 || ealen < psidlen) {
-			fprintf(stderr, "Skipping invalid or incomplete rule: %s\n", argv[i]);
-			status = 1;
+		if (r->pdlen >= 0 || r->prefix6len < 0)
 			continue;
-		}
 
-		if (psid < 0 && psidlen >= 0 && pdlen >= 0) {
-			bmemcpys64(&psid16, &pd, prefix6len + ealen - psidlen, psidlen);
-			psid = be16_to_cpu(psid16);
-		}
+		if (r->lw4o6)
+			lw4o6 = true;
+		else if (prefix_trie_add(&index, &r->ipv6prefix, r->prefix6len, &r->item))
+			return;
+	}
 
-		if (psidlen > 0) {
-			psid = psid >> (16 - psidlen);
-			psid16 = cpu_to_be16(psid);
-			psid = psid << (16 - psidlen);
-		}
+	blobmsg_for_each_attr(c, dump, rem) {
+		struct blob_attr *tb[IFACE_ATTR_MAX];
+		blobmsg_parse(iface_attrs, IFACE_ATTR_MAX, tb, blobmsg_data(c), blobmsg_data_len(c));
 
-		if (pdlen >= 0 || ealen == psidlen) {
-			bmemcpys64(&ipv4addr, &pd, prefix6len, ealen - psidlen);
-			ipv4addr.s_addr = htonl(ntohl(ipv4addr.s_addr) >> prefix4len);
-			bmemcpy(&ipv4addr, &ipv4prefix, prefix4len);
+		if (!tb[IFACE_ATTR_INTERFACE] || (strcmp(filter, "*") && strcmp(filter,
+				blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]))))
+			continue;
 
-			if (prefix4len + ealen < 32)
-				addr4len = prefix4len + ealen;
-		}
+		const char *iface = blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]);
 
-		if (pdlen < 0 && !fmr) {
-			fprintf(stderr, "Skipping non-FMR without matching PD: %s\n", argv[i]);
-			status = 1;
+		if (index)
+			match_index(index, iface, tb[IFACE_ATTR_PREFIX]);
+
+		if (!lw4o6)
 			continue;
-		} else if (pdlen >= 0) {
-			size_t v4offset = (legacy) ? 9 : 10;
-			memcpy(&ipv6addr.s6_addr[v4offset], &ipv4addr, 4);
-			memcpy(&ipv6addr.s6_addr[v4offset + 4], &psid16, 2);
-			bmemcpy(&ipv6addr, &pd, pdlen);
-		}
 
-		++rulecnt;
-		char ipv4addrbuf[INET_ADDRSTRLEN];
-		char ipv4prefixbuf[INET_ADDRSTRLEN];
-		char ipv6prefixbuf[INET6_ADDRSTRLEN];
-		char ipv6addrbuf[INET6_ADDRSTRLEN];
-		char pdbuf[INET6_ADDRSTRLEN];
-
-		inet_ntop(AF_INET, &ipv4addr, ipv4addrbuf, sizeof(ipv4addrbuf));
-		inet_ntop(AF_INET, &ipv4prefix, ipv4prefixbuf, sizeof(ipv4prefixbuf));
-		inet_ntop(AF_INET6, &ipv6prefix, ipv6prefixbuf, sizeof(ipv6prefixbuf));
-		inet_ntop(AF_INET6, &ipv6addr, ipv6addrbuf, sizeof(ipv6addrbuf));
-		inet_ntop(AF_INET6, &pd, pdbuf, sizeof(pdbuf));
-
-		printf("RULE_%d_FMR=%d\n", rulecnt, fmr);
-		printf("RULE_%d_EALEN=%d\n", rulecnt, ealen);
-		printf("RULE_%d_PSIDLEN=%d\n", rulecnt, psidlen);
-		printf("RULE_%d_OFFSET=%d\n", rulecnt, offset);
-		printf("RULE_%d_PREFIX4LEN=%d\n", rulecnt, prefix4len);
-		printf("RULE_%d_PREFIX6LEN=%d\n", rulecnt, prefix6len);
-		printf("RULE_%d_IPV4PREFIX=%s\n", rulecnt, ipv4prefixbuf);
-		printf("RULE_%d_IPV6PREFIX=%s\n", rulecnt, ipv6prefixbuf);
-
-		if (pdlen >= 0) {
-			printf("RULE_%d_IPV6PD=%s\n", rulecnt, pdbuf);
-			printf("RULE_%d_PD6LEN=%d\n", rulecnt, pdlen);
-			printf("RULE_%d_PD6IFACE=%s\n", rulecnt, iface);
-			printf("RULE_%d_IPV6ADDR=%s\n", rulecnt, ipv6addrbuf);
-			printf("RULE_BMR=%d\n", rulecnt);
+		for (int i = 0; i < nrules; ++i) {
+			struct map_rule *r = &rules[i];
+
+			if (!r->lw4o6 || r->iface || r->prefix6len < 0)
+				continue;
+
+			match_prefix(&r->pdlen, &r->pd, tb[IFACE_ATTR_PREFIX], &r->ipv6prefix, r->prefix6len, true);
+			match_prefix(&r->pdlen, &r->pd, tb[IFACE_ATTR_ADDRESS], &r->ipv6prefix, r->prefix6len, true);
+
+			if (r->pdlen >= 0)
+				r->iface = iface;
 		}
+	}
+
+	prefix_trie_free(index);
+}
+
+static bool calc_rule(struct map_rule *r)
+{
+	if (r->ealen < 0 && r->pdlen >= 0)
+		r->ealen = r->pdlen - r->prefix6len;
+
+	if (r->psidlen <= 0) {
+		r->psidlen = r->ealen - (32 - r->prefix4len);
+		if (r->psidlen < 0)
+			r->psidlen = 0;
+
+		r->psid = -1;
+	}
 
-		if (ipv4addr.s_addr) {
-			printf("RULE_%d_IPV4ADDR=%s\n", rulecnt, ipv4addrbuf);
-			printf("RULE_%d_ADDR4LEN=%d\n", rulecnt, addr4len);
+	if (r->prefix4len < 0 || r->prefix6len < 0 || r->ealen < 0 || r->psidlen > 16 || r->ealen < r->psidlen) {
+		fprintf(stderr, "Skipping invalid or incomplete rule: %s\n", r->str);
+		return false;
+	}
+
+	if (r->psid < 0 && r->psidlen >= 0 && r->pdlen >= 0) {
+		bmemcpys64(&r->psid16, &r->pd, r->prefix6len + r->ealen - r->psidlen, r->psidlen);
+		r->psid = be16_to_cpu(r->psid16);
+	}
+
+	if (r->psidlen > 0) {
+		r->psid = r->psid >> (16 - r->psidlen);
+		r->psid16 = cpu_to_be16(r->psid);
+		r->psid = r->psid << (16 - r->psidlen);
+	}
+
+	if (r->pdlen >= 0 || r->ealen == r->psidlen) {
+		bmemcpys64(&r->ipv4addr, &r->pd, r->prefix6len, r->ealen - r->psidlen);
+		r->ipv4addr.s_addr = htonl(ntohl(r->ipv4addr.s_addr) >> r->prefix4len);
+		bmemcpy(&r->ipv4addr, &r->ipv4prefix, r->prefix4len);
+
+		if (r->prefix4len + r->ealen < 32)
+			r->addr4len = r->prefix4len + r->ealen;
+	}
+
+	if (r->pdlen < 0 && !r->fmr) {
+		fprintf(stderr, "Skipping non-FMR without matching PD: %s\n", r->str);
+		return false;
+	} else if (r->pdlen >= 0) {
+		size_t v4offset = (legacy_mode) ? 9 : 10;
+		memcpy(&r->ipv6addr.s6_addr[v4offset], &r->ipv4addr, 4);
+		memcpy(&r->ipv6addr.s6_addr[v4offset + 4], &r->psid16, 2);
+		bmemcpy(&r->ipv6addr, &r->pd, r->pdlen);
+	}
+
+	return true;
+}
+
+// Calls cb for every port range of the rule's port set
+static void for_each_portset(struct map_rule *r, void (*cb)(int start, int end, void *priv), void *priv)
+{
+	if (r->psidlen <= 0 || r->psid < 0)
+		return;
+
+	for (int k = (r->offset) ? 1 : 0; k < (1 << r->offset); ++k) {
+		int start = (k << (16 - r->offset)) | (r->psid >> r->offset);
+		int end = start + (1 << (16 - r->offset - r->psidlen)) - 1;
+
+		if (start == 0)
+			start = 1;
+
+		if (start <= end)
+			cb(start, end, priv);
+	}
+}
+
+static void print_portset_env(int start, int end, void *priv __attribute__((unused)))
+{
+	printf("%d-%d ", start, end);
+}
+
+static void print_portset_json(int start, int end, void *priv)
+{
+	bool *first = priv;
+
+	printf("%s{ \"start\": %d, \"end\": %d }", *first ? "" : ", ", start, end);
+	*first = false;
+}
+
+static void print_rule_env(struct map_rule *r, int rulecnt)
+{
+	char ipv4addrbuf[INET_ADDRSTRLEN];
+	char ipv4prefixbuf[INET_ADDRSTRLEN];
+	char ipv6prefixbuf[INET6_ADDRSTRLEN];
+	char ipv6addrbuf[INET6_ADDRSTRLEN];
+	char pdbuf[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, &r->ipv4addr, ipv4addrbuf, sizeof(ipv4addrbuf));
+	inet_ntop(AF_INET, &r->ipv4prefix, ipv4prefixbuf, sizeof(ipv4prefixbuf));
+	inet_ntop(AF_INET6, &r->ipv6prefix, ipv6prefixbuf, sizeof(ipv6prefixbuf));
+	inet_ntop(AF_INET6, &r->ipv6addr, ipv6addrbuf, sizeof(ipv6addrbuf));
+	inet_ntop(AF_INET6, &r->pd, pdbuf, sizeof(pdbuf));
+
+	printf("RULE_%d_FMR=%d\n", rulecnt, r->fmr);
+	printf("RULE_%d_EALEN=%d\n", rulecnt, r->ealen);
+	printf("RULE_%d_PSIDLEN=%d\n", rulecnt, r->psidlen);
+	printf("RULE_%d_OFFSET=%d\n", rulecnt, r->offset);
+	printf("RULE_%d_PREFIX4LEN=%d\n", rulecnt, r->prefix4len);
+	printf("RULE_%d_PREFIX6LEN=%d\n", rulecnt, r->prefix6len);
+	printf("RULE_%d_IPV4PREFIX=%s\n", rulecnt, ipv4prefixbuf);
+	printf("RULE_%d_IPV6PREFIX=%s\n", rulecnt, ipv6prefixbuf);
+
+	if (r->pdlen >= 0) {
+		printf("RULE_%d_IPV6PD=%s\n", rulecnt, pdbuf);
+		printf("RULE_%d_PD6LEN=%d\n", rulecnt, r->pdlen);
+		printf("RULE_%d_PD6IFACE=%s\n", rulecnt, r->iface);
+		printf("RULE_%d_IPV6ADDR=%s\n", rulecnt, ipv6addrbuf);
+		printf("RULE_BMR=%d\n", rulecnt);
+	}
+
+	if (r->ipv4addr.s_addr) {
+		printf("RULE_%d_IPV4ADDR=%s\n", rulecnt, ipv4addrbuf);
+		printf("RULE_%d_ADDR4LEN=%d\n", rulecnt, r->addr4len);
+	}
+
+	if (r->psidlen > 0 && r->psid >= 0) {
+		printf("RULE_%d_PORTSETS='", rulecnt);
+		for_each_portset(r, print_portset_env, NULL);
+		printf("'\n");
+	}
+
+	if (r->dmr)
+		printf("RULE_%d_DMR=%s\n", rulecnt, r->dmr);
+
+	if (r->br)
+		printf("RULE_%d_BR=%s\n", rulecnt, r->br);
+}
+
+static void print_rule_json(struct map_rule *r, int rulecnt)
+{
+	char buf[INET6_ADDRSTRLEN];
+	bool first = true;
+
+	printf("%s\t\t{\n", (rulecnt > 1) ? ",\n" : "");
+	printf("\t\t\t\"fmr\": %s,\n", r->fmr ? "true" : "false");
+	printf("\t\t\t\"ealen\": %d,\n", r->ealen);
+	printf("\t\t\t\"psidlen\": %d,\n", r->psidlen);
+	printf("\t\t\t\"offset\": %d,\n", r->offset);
+	printf("\t\t\t\"prefix4len\": %d,\n", r->prefix4len);
+	printf("\t\t\t\"prefix6len\": %d,\n", r->prefix6len);
+	printf("\t\t\t\"ipv4prefix\": \"%s\",\n", inet_ntop(AF_INET, &r->ipv4prefix, buf, sizeof(buf)));
+	printf("\t\t\t\"ipv6prefix\": \"%s\"", inet_ntop(AF_INET6, &r->ipv6prefix, buf, sizeof(buf)));
+
+	if (r->pdlen >= 0) {
+		printf(",\n\t\t\t\"ipv6pd\": \"%s\"", inet_ntop(AF_INET6, &r->pd, buf, sizeof(buf)));
+		printf(",\n\t\t\t\"pd6len\": %d", r->pdlen);
+		printf(",\n\t\t\t\"pd6iface\": \"%s\"", r->iface);
+		printf(",\n\t\t\t\"ipv6addr\": \"%s\"", inet_ntop(AF_INET6, &r->ipv6addr, buf, sizeof(buf)));
+	}
+
+	if (r->ipv4addr.s_addr) {
+		printf(",\n\t\t\t\"ipv4addr\": \"%s\"", inet_ntop(AF_INET, &r->ipv4addr, buf, sizeof(buf)));
+		printf(",\n\t\t\t\"addr4len\": %d", r->addr4len);
+	}
+
+	if (r->psidlen > 0 && r->psid >= 0) {
+		printf(",\n\t\t\t\"psid\": %d", r->psid >> (16 - r->psidlen));
+		printf(",\n\t\t\t\"portsets\": [ ");
+		for_each_portset(r, print_portset_json, &first);
+		printf(" ]");
+	}
+
+	if (r->dmr)
+		printf(",\n\t\t\t\"dmr\": \"%s\"", r->dmr);
+
+	if (r->br)
+		printf(",\n\t\t\t\"br\": \"%s\"", r->br);
+
+	printf("\n\t\t}");
+}
+
+int main(int argc, char *argv[])
+{
+	int status = 0;
+	bool json = false;
+
+	const char *legacy_env = getenv("LEGACY");
+	legacy_mode = legacy_env && atoi(legacy_env);
+
+	if (argc > 1 && !strcmp(argv[1], "-j")) {
+		json = true;
+		argv++;
+		argc--;
+	}
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s [-j] <interface|*> <rule1> [rule2] [...]\n", argv[0]);
+		return 1;
+	}
+
+	int nrules = argc - 2;
+	struct map_rule *rules = calloc(nrules, sizeof(*rules));
+	bool need_pd = false;
+
+	if (!rules)
+		return 1;
+
+	for (int i = 0; i < nrules; ++i) {
+		parse_rule(&rules[i], argv[i + 2]);
+
+		if (rules[i].pdlen < 0)
+			need_pd = true;
+	}
+
+	if (need_pd) {
+		uint32_t network_interface;
+		struct ubus_context *ubus = ubus_connect(NULL);
+		if (ubus) {
+			ubus_lookup_id(ubus, "network.interface", &network_interface);
+			ubus_invoke(ubus, network_interface, "dump", NULL, handle_dump, NULL, 5000);
 		}
 
+		if (dump)
+			find_pds(rules, nrules, argv[1]);
+	}
 
-		if (psidlen > 0 && psid >= 0) {
-			printf("RULE_%d_PORTSETS='", rulecnt);
-			for (int k = (offset) ? 1 : 0; k < (1 << offset); ++k) {
-				int start = (k << (16 - offset)) | (psid >> offset);
-				int end = start + (1 << (16 - offset - psidlen)) - 1;
+	if (json)
+		printf("{\n\t\"rules\": [\n");
 
-				if (start == 0)
-					start = 1;
+	int rulecnt = 0, bmr = 0;
+	for (int i = 0; i < nrules; ++i) {
+		struct map_rule *r = &rules[i];
 
-				if (start <= end)
-					printf("%d-%d ", start, end);
-			}
-			printf("'\n");
+		if (!r->iface)
+			r->iface = argv[1];
+
+		if (!calc_rule(r)) {
+			status = 1;
+			continue;
 		}
 
-		if (dmr)
-			printf("RULE_%d_DMR=%s\n", rulecnt, dmr);
+		++rulecnt;
+		if (r->pdlen >= 0)
+			bmr = rulecnt;
+
+		if (json)
+			print_rule_json(r, rulecnt);
+		else
+			print_rule_env(r, rulecnt);
+	}
 
-		if (br)
-			printf("RULE_%d_BR=%s\n", rulecnt, br);
+	if (json) {
+		printf("%s\t],\n", rulecnt ? "\n" : "");
+		if (bmr)
+			printf("\t\"bmr\": %d,\n", bmr);
+		printf("\t\"count\": %d\n}\n", rulecnt);
+	} else {
+		printf("RULE_COUNT=%d\n", rulecnt);
 	}
 
-	printf("RULE_COUNT=%d\n", rulecnt);
 	return status;
 }
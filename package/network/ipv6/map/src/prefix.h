@@ -0,0 +1,206 @@
+/*
+ * prefix.h - bit level address prefix helpers
+ *
+ * Shared by mapcalc, 6rdcalc and 464xlatcfg.
+ *
+ * Copyright (c) 2014-2015 cisco Systems, Inc.
+ * Copyright (c) 2015 Steven Barth <cyrus@openwrt.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __PREFIX_H
+#define __PREFIX_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+/* compare the first bits of two addresses */
+static inline int bmemcmp(const void *av, const void *bv, size_t bits)
+{
+	const uint8_t *a = av, *b = bv;
+	size_t bytes = bits / 8;
+	bits %= 8;
+
+	int res = memcmp(a, b, bytes);
+	if (res == 0 && bits > 0)
+		res = (a[bytes] >> (8 - bits)) - (b[bytes] >> (8 - bits));
+
+	return res;
+}
+
+/* copy the first bits of b over a, keeping the remaining bits of a */
+static inline void bmemcpy(void *av, const void *bv, size_t bits)
+{
+	uint8_t *a = av;
+	const uint8_t *b = bv;
+
+	size_t bytes = bits / 8;
+	bits %= 8;
+	memcpy(a, b, bytes);
+
+	if (bits > 0) {
+		uint8_t mask = (1 << (8 - bits)) - 1;
+		a[bytes] = (a[bytes] & mask) | ((~mask) & b[bytes]);
+	}
+}
+
+/* copy up to 56 bits starting at bit frombits of b to the start of a */
+static inline void bmemcpys64(void *av, const void *bv, size_t frombits, size_t nbits)
+{
+	uint64_t buf = 0;
+	const uint8_t *b = bv;
+	size_t frombyte = frombits / 8, tobyte = (frombits + nbits) / 8;
+
+	memcpy(&buf, &b[frombyte], tobyte - frombyte + 1);
+	buf = htobe64(be64toh(buf) << (frombits % 8));
+
+	bmemcpy(av, &buf, nbits);
+}
+
+static inline int bget(const void *av, size_t bit)
+{
+	const uint8_t *a = av;
+
+	return (a[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static inline void bset(void *av, size_t bit, int val)
+{
+	uint8_t *a = av;
+	uint8_t mask = 0x80 >> (bit % 8);
+
+	if (val)
+		a[bit / 8] |= mask;
+	else
+		a[bit / 8] &= ~mask;
+}
+
+/* copy nbits from bit offset from of b to bit offset to of a */
+static inline void bmemcpybits(void *av, size_t to, const void *bv, size_t from, size_t nbits)
+{
+	while (nbits--)
+		bset(av, to++, bget(bv, from++));
+}
+
+/* clear all bits of a from bit offset from up to bit offset to */
+static inline void bmemclr(void *av, size_t from, size_t to)
+{
+	uint8_t *a = av;
+
+	for (; from < to && (from % 8); from++)
+		bset(a, from, 0);
+
+	for (; from + 8 <= to; from += 8)
+		a[from / 8] = 0;
+
+	for (; from < to; from++)
+		bset(a, from, 0);
+}
+
+/* parse "address/length", length defaults to the full address */
+static inline int prefix_parse(int af, const char *str, void *addr, int *len)
+{
+	char buf[INET6_ADDRSTRLEN + 5], *slash, *end;
+	unsigned long max = (af == AF_INET) ? 32 : 128, l;
+
+	if (strlen(str) >= sizeof(buf))
+		return -1;
+
+	strcpy(buf, str);
+	*len = max;
+
+	if ((slash = strchr(buf, '/')) != NULL) {
+		*slash++ = 0;
+
+		/* strtoul() would take "-1" or " 8" */
+		if (!isdigit((unsigned char)*slash))
+			return -1;
+
+		l = strtoul(slash, &end, 10);
+		if (*end || l > max)
+			return -1;
+
+		*len = l;
+	}
+
+	return (inet_pton(af, buf, addr) == 1) ? 0 : -1;
+}
+
+
+/*
+ * Binary trie of prefixes. Every node stands for the prefix spelled by
+ * the path to it and carries the items registered for that prefix, so
+ * all items whose prefix covers a given address are found by following
+ * its bits once.
+ */
+
+struct prefix_item {
+	struct prefix_item *next;
+};
+
+struct prefix_node {
+	struct prefix_node *child[2];
+	struct prefix_item *items;
+};
+
+static inline int prefix_trie_add(struct prefix_node **root, const void *addr,
+		size_t len, struct prefix_item *item)
+{
+	struct prefix_node **np = root;
+	size_t bit = 0;
+
+	for (;;) {
+		if (!*np && !(*np = calloc(1, sizeof(**np))))
+			return -1;
+
+		if (bit == len)
+			break;
+
+		np = &(*np)->child[bget(addr, bit++)];
+	}
+
+	item->next = (*np)->items;
+	(*np)->items = item;
+
+	return 0;
+}
+
+/* call cb for every item whose prefix covers addr/len, shortest first */
+static inline void prefix_trie_match(struct prefix_node *n, const void *addr, size_t len,
+		void (*cb)(struct prefix_item *item, void *priv), void *priv)
+{
+	struct prefix_item *item;
+	size_t bit = 0;
+
+	for (; n; n = n->child[bget(addr, bit++)]) {
+		for (item = n->items; item; item = item->next)
+			cb(item, priv);
+
+		if (bit == len)
+			break;
+	}
+}
+
+static inline void prefix_trie_free(struct prefix_node *n)
+{
+	if (n) {
+		prefix_trie_free(n->child[0]);
+		prefix_trie_free(n->child[1]);
+		free(n);
+	}
+}
+
+#endif
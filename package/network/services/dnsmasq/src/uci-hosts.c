@@ -0,0 +1,468 @@
+/*
+ * uci-hosts - generate dnsmasq host data from /etc/config/dhcp
+ *
+ * Reads the host and domain sections of a dnsmasq instance in one pass
+ * and writes them as a dhcp-hostsfile and an addn-hosts file, which
+ * dnsmasq rereads on SIGHUP. Per-host dhcp-option lines are printed on
+ * stdout for the init script to add to the main config.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <uci.h>
+
+struct buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static struct uci_context *ctx;
+static const char *instance;
+static const char *domain;
+static int dhcp_ver = 4;
+
+static void
+buf_add(struct buf *b, const char *s, size_t len)
+{
+	if (b->len + len + 1 > b->size) {
+		b->size = (b->len + len + 1) * 2;
+		if (b->size < 4096)
+			b->size = 4096;
+
+		b->data = realloc(b->data, b->size);
+		if (!b->data) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	memcpy(b->data + b->len, s, len);
+	b->len += len;
+	b->data[b->len] = 0;
+}
+
+static void
+buf_puts(struct buf *b, const char *s)
+{
+	buf_add(b, s, strlen(s));
+}
+
+/* Append prefix and s, unless s is empty */
+static void
+buf_opt(struct buf *b, const char *prefix, const char *s)
+{
+	if (!s || !*s)
+		return;
+
+	buf_puts(b, prefix);
+	buf_puts(b, s);
+}
+
+/* Option value as config_get would return it, lists joined by spaces */
+static const char *
+opt_get(struct uci_section *s, const char *name)
+{
+	static struct buf val;
+	struct uci_option *o;
+	struct uci_element *e;
+
+	o = uci_lookup_option(ctx, s, name);
+	if (!o)
+		return NULL;
+
+	if (o->type == UCI_TYPE_STRING)
+		return o->v.string;
+
+	val.len = 0;
+	buf_puts(&val, "");
+	uci_foreach_element(&o->v.list, e) {
+		if (val.len)
+			buf_puts(&val, " ");
+		buf_puts(&val, e->name);
+	}
+
+	return val.data;
+}
+
+static char *
+opt_dup(struct uci_section *s, const char *name)
+{
+	const char *val = opt_get(s, name);
+
+	return val ? strdup(val) : NULL;
+}
+
+static int
+opt_bool(struct uci_section *s, const char *name, int def)
+{
+	const char *val = opt_get(s, name);
+
+	if (!val)
+		return def;
+
+	if (!strcmp(val, "1") || !strcmp(val, "on") || !strcmp(val, "true") ||
+	    !strcmp(val, "yes") || !strcmp(val, "enabled"))
+		return 1;
+
+	if (!strcmp(val, "0") || !strcmp(val, "off") || !strcmp(val, "false") ||
+	    !strcmp(val, "no") || !strcmp(val, "disabled"))
+		return 0;
+
+	return def;
+}
+
+/* Append the words of a space separated list, each preceded by sep */
+static void
+buf_words(struct buf *b, const char *list, const char *sep, int first_sep)
+{
+	const char *p = list;
+	int n = 0;
+
+	while (p && *p) {
+		size_t len;
+
+		p += strspn(p, " \t");
+		len = strcspn(p, " \t");
+		if (!len)
+			break;
+
+		if (n++ || first_sep)
+			buf_puts(b, sep);
+		buf_add(b, p, len);
+		p += len;
+	}
+}
+
+static int
+instance_match(struct uci_section *s)
+{
+	const char *val = opt_get(s, "instance");
+
+	return !val || !*val || !strcmp(val, instance);
+}
+
+static void
+dhcp_option_add(struct buf *opts, struct uci_section *s,
+		const char *networkid, int force)
+{
+	struct uci_option *o;
+	struct uci_element *e;
+	const char *val;
+
+	o = uci_lookup_option(ctx, s, "dhcp_option");
+	if (!o)
+		return;
+
+	if (o->type == UCI_TYPE_LIST) {
+		uci_foreach_element(&o->v.list, e) {
+			buf_puts(opts, force ? "--dhcp-option-force=" : "--dhcp-option=");
+			buf_opt(opts, "", networkid);
+			buf_puts(opts, ",");
+			buf_puts(opts, e->name);
+			buf_puts(opts, "\n");
+		}
+		return;
+	}
+
+	fprintf(stderr, "Warning: the 'option dhcp_option' syntax is deprecated, use 'list dhcp_option'\n");
+
+	for (val = o->v.string; *val; ) {
+		size_t len;
+
+		val += strspn(val, " \t");
+		len = strcspn(val, " \t");
+		if (!len)
+			break;
+
+		buf_puts(opts, force ? "--dhcp-option-force=" : "--dhcp-option=");
+		buf_opt(opts, "", networkid);
+		buf_puts(opts, ",");
+		buf_add(opts, val, len);
+		buf_puts(opts, "\n");
+		val += len;
+	}
+}
+
+static void
+hostid_add(struct buf *b, const char *hostid)
+{
+	char tmp[16];
+	unsigned long id;
+	const char *hex = hostid;
+	const char *p;
+
+	if (!strncmp(hex, "0x", 2))
+		hex += 2;
+
+	for (p = hex; *p; p++)
+		if (!isxdigit((unsigned char) *p))
+			break;
+
+	/* invalid hex is passed through unchanged, like the shell version */
+	if (*p) {
+		buf_opt(b, ",[::", hostid);
+		buf_puts(b, "]");
+		return;
+	}
+
+	id = strtoul(hex, NULL, 16);
+	snprintf(tmp, sizeof(tmp), "%lx:%lx", (id >> 16) % 65536, id % 65536);
+	buf_opt(b, ",[::", tmp);
+	buf_puts(b, "]");
+}
+
+static void
+host_add(struct uci_section *s, struct buf *hosts, struct buf *dhcp,
+	 struct buf *opts)
+{
+	char *name, *ip, *hostid, *mac, *duid, *tag, *networkid, *leasetime;
+	struct buf line = {};
+
+	networkid = opt_dup(s, "networkid");
+	if (networkid && *networkid)
+		dhcp_option_add(opts, s, networkid, opt_bool(s, "force", 0));
+
+	if (!opt_bool(s, "enable", 1))
+		goto out_networkid;
+
+	name = opt_dup(s, "name");
+	ip = opt_dup(s, "ip");
+	hostid = opt_dup(s, "hostid");
+	mac = opt_dup(s, "mac");
+	duid = opt_dup(s, "duid");
+	tag = opt_dup(s, "tag");
+	leasetime = opt_dup(s, "leasetime");
+
+	if (!(name && *name) && !(ip && *ip) && !(hostid && *hostid))
+		goto out;
+
+	if (opt_bool(s, "dns", 0) && ip && *ip && name && *name) {
+		buf_puts(hosts, ip);
+		buf_puts(hosts, " ");
+		buf_puts(hosts, name);
+		buf_opt(hosts, ".", domain);
+		buf_puts(hosts, "\n");
+	}
+
+	/* many MACs are possible to track a laptop on/off dock */
+	buf_puts(&line, "");
+	buf_words(&line, mac, ",", 0);
+
+	if (dhcp_ver == 6 && duid && *duid) {
+		size_t len = strcspn(duid, " ");
+
+		if (line.len)
+			buf_puts(&line, ",");
+		buf_puts(&line, "id:");
+		buf_add(&line, duid, len);
+	}
+
+	if (!line.len) {
+		/* --dhcp-host=lap,192.168.0.199,[::beef] */
+		if (!name || !*name)
+			goto out;
+
+		buf_puts(&line, name);
+		free(name);
+		name = NULL;
+	}
+
+	if (networkid && *networkid)
+		buf_opt(&line, ",set:", networkid);
+	if (tag && *tag)
+		buf_words(&line, tag, ",set:", 1);
+	if (opt_bool(s, "broadcast", 0))
+		buf_puts(&line, ",set:needs-broadcast");
+
+	buf_opt(&line, ",", ip);
+	if (dhcp_ver == 6 && hostid && *hostid)
+		hostid_add(&line, hostid);
+
+	buf_opt(&line, ",", name);
+	buf_opt(&line, ",", leasetime);
+
+	buf_add(dhcp, line.data, line.len);
+	buf_puts(dhcp, "\n");
+
+out:
+	free(line.data);
+	free(name);
+	free(ip);
+	free(hostid);
+	free(mac);
+	free(duid);
+	free(tag);
+	free(leasetime);
+out_networkid:
+	free(networkid);
+}
+
+static void
+domain_add(struct uci_section *s, struct buf *hosts)
+{
+	const char *names, *ip;
+	struct buf line = {};
+
+	names = opt_get(s, "name");
+	if (!names || !*names)
+		return;
+
+	buf_puts(&line, "");
+	buf_words(&line, names, " ", 0);
+
+	ip = opt_get(s, "ip");
+	if (!ip || !*ip) {
+		free(line.data);
+		return;
+	}
+
+	buf_puts(hosts, ip);
+	buf_puts(hosts, " ");
+	buf_add(hosts, line.data, line.len);
+	buf_puts(hosts, "\n");
+
+	free(line.data);
+}
+
+/* Replace the file contents in place, only when they differ */
+static int
+update_file(const char *path, struct buf *b)
+{
+	char *old = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f) {
+		old = malloc(b->len + 1);
+		if (old)
+			len = fread(old, 1, b->len + 1, f);
+		fclose(f);
+	}
+
+	if (old && len == b->len && !memcmp(old, b->data, len)) {
+		free(old);
+		return 0;
+	}
+	free(old);
+
+	/* rewritten in place so bind mounts of the file see the update */
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	fwrite(b->data, 1, b->len, f);
+	fclose(f);
+
+	return 1;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -c <instance> [options]\n"
+		"Options:\n"
+		"	-d <domain>	Local domain appended to host names\n"
+		"	-v <4|6>	DHCP version handled by dnsmasq\n"
+		"	-H <file>	Append DNS host entries to file\n"
+		"	-D <file>	Write dhcp-hostsfile, untouched when unchanged\n"
+		"\n", prog);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct buf hosts = {}, dhcp = {}, opts = {};
+	const char *hostfile = NULL, *dhcpfile = NULL;
+	struct uci_package *p = NULL;
+	struct uci_element *e;
+	int ch, ret = 0;
+
+	while ((ch = getopt(argc, argv, "c:d:v:H:D:")) != -1) {
+		switch (ch) {
+		case 'c':
+			instance = optarg;
+			break;
+		case 'd':
+			domain = optarg;
+			break;
+		case 'v':
+			dhcp_ver = atoi(optarg);
+			break;
+		case 'H':
+			hostfile = optarg;
+			break;
+		case 'D':
+			dhcpfile = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (!instance)
+		return usage(argv[0]);
+
+	ctx = uci_alloc_context();
+	if (!ctx || uci_load(ctx, "dhcp", &p)) {
+		fprintf(stderr, "Failed to load dhcp config\n");
+		return 1;
+	}
+
+	buf_puts(&hosts, "");
+	buf_puts(&dhcp, "# auto-generated from /etc/config/dhcp\n");
+	buf_puts(&opts, "");
+
+	uci_foreach_element(&p->sections, e) {
+		struct uci_section *s = uci_to_section(e);
+
+		if (!instance_match(s))
+			continue;
+
+		if (!strcmp(s->type, "host"))
+			host_add(s, &hosts, &dhcp, &opts);
+		else if (!strcmp(s->type, "domain"))
+			domain_add(s, &hosts);
+	}
+
+	if (hostfile) {
+		FILE *f = fopen(hostfile, "a");
+
+		if (f) {
+			fwrite(hosts.data, 1, hosts.len, f);
+			fclose(f);
+		} else {
+			perror(hostfile);
+			ret = 1;
+		}
+	}
+
+	if (dhcpfile && update_file(dhcpfile, &dhcp) < 0)
+		ret = 1;
+
+	fwrite(opts.data, 1, opts.len, stdout);
+
+	uci_free_context(ctx);
+	free(hosts.data);
+	free(dhcp.data);
+	free(opts.data);
+
+	return ret;
+}
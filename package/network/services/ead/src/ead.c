@@ -13,6 +13,7 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/select.h>
 #include <stdio.h>
@@ -97,6 +98,20 @@ static const char *dev_name = DEFAULT_DEVNAME;
 static bool nonfork = false;
 static struct ead_instance *instance = NULL;
 
+/* verifier of the last user, valid while the passwd file is unchanged */
+static struct {
+	bool valid;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int index;
+	char username[32];
+	unsigned char salt[MAXSALTLEN];
+	unsigned char verifier[MAXPARAMLEN];
+	int len;
+} pwcache;
+
 static struct t_pwent tpe = {
 	.name = username,
 	.index = 1,
@@ -175,6 +190,8 @@ prepare_password(void)
 	BigInteger x, v, n, g;
 	SHA1_CTX ctxt;
 	int ulen = strlen(username);
+	struct stat st;
+	bool cacheable;
 	FILE *f;
 
 	lbuf[sizeof(lbuf) - 1] = 0;
@@ -183,6 +200,23 @@ prepare_password(void)
 	if (!f)
 		return false;
 
+	cacheable = (fstat(fileno(f), &st) == 0);
+	if (cacheable && pwcache.valid &&
+	    pwcache.dev == st.st_dev && pwcache.ino == st.st_ino &&
+	    pwcache.size == st.st_size &&
+	    pwcache.mtime.tv_sec == st.st_mtim.tv_sec &&
+	    pwcache.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+	    pwcache.index == tpe.index &&
+	    !strcmp(pwcache.username, username)) {
+		fclose(f);
+		tce = gettcid(tpe.index);
+		memcpy(pw_saltbuf, pwcache.salt, MAXSALTLEN);
+		memcpy(pwbuf, pwcache.verifier, pwcache.len);
+		tpe.password.len = pwcache.len;
+		return true;
+	}
+	pwcache.valid = false;
+
 	while (fgets(lbuf, sizeof(lbuf) - 1, f) != NULL) {
 		char *str, *s2;
 
@@ -253,6 +287,19 @@ hash_password:
 	BigIntegerModExp(v, g, x, n);
 	tpe.password.len = BigIntegerToBytes(v, (unsigned char *)pwbuf);
 
+	if (cacheable && tpe.password.len <= sizeof(pwcache.verifier)) {
+		pwcache.dev = st.st_dev;
+		pwcache.ino = st.st_ino;
+		pwcache.size = st.st_size;
+		pwcache.mtime = st.st_mtim;
+		pwcache.index = tpe.index;
+		strcpy(pwcache.username, username);
+		memcpy(pwcache.salt, pw_saltbuf, MAXSALTLEN);
+		memcpy(pwcache.verifier, pwbuf, tpe.password.len);
+		pwcache.len = tpe.password.len;
+		pwcache.valid = true;
+	}
+
 	BigIntegerFree(v);
 	BigIntegerFree(x);
 	BigIntegerFree(g);
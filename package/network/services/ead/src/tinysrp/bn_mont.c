@@ -0,0 +1,218 @@
+/* bn_mont.c - constant time Montgomery modular exponentiation
+ *
+ * Fixed window exponentiation for odd moduli. Every window does the
+ * same number of squarings and one multiplication, table entries are
+ * selected by masking instead of indexing and the final subtraction is
+ * done unconditionally, so neither the timing nor the memory access
+ * pattern depends on the bits of the exponent.
+ *
+ * The Montgomery constants only depend on the modulus; SRP uses the
+ * same prime for the whole session, so they are kept around and only
+ * recomputed when a different modulus shows up.
+ *
+ * Distributed under the same terms as the rest of this library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bn_lcl.h"
+
+struct mont_cache
+	{
+	int valid;
+	int num;        /* words in the modulus */
+	BIGNUM N;
+	BIGNUM RR;      /* R^2 mod N, R = 2^(num*BN_BITS2) */
+	BN_ULONG n0;    /* -N^-1 mod 2^BN_BITS2 */
+	};
+
+static struct mont_cache mont;
+
+static int mont_setup(const BIGNUM *m, BN_CTX *ctx)
+	{
+	BN_ULONG x;
+	int i;
+
+	if (mont.valid && BN_cmp(&mont.N, m) == 0)
+		return(1);
+
+	if (!mont.valid)
+		{
+		BN_init(&mont.N);
+		BN_init(&mont.RR);
+		}
+	mont.valid=0;
+
+	if (BN_copy(&mont.N,m) == NULL) return(0);
+	mont.num=m->top;
+
+	/* Newton iteration, every step doubles the number of valid bits */
+	x=m->d[0];
+	for (i=0; i < 6; i++)
+		x=(x*(2-m->d[0]*x))&BN_MASK2;
+	mont.n0=(0-x)&BN_MASK2;
+
+	if (!BN_one(&mont.RR)) return(0);
+	if (!BN_lshift(&mont.RR,&mont.RR,2*mont.num*BN_BITS2)) return(0);
+	if (!BN_mod(&mont.RR,&mont.RR,m,ctx)) return(0);
+
+	mont.valid=1;
+	return(1);
+	}
+
+/* r = a * b / R mod n, all operands num words and below n.
+ * t is scratch space of 2*num words, r may alias a or b. */
+static void mont_mul(BN_ULONG *r, BN_ULONG *a, BN_ULONG *b, BN_ULONG *n,
+		     BN_ULONG n0, int num, BN_ULONG *t)
+	{
+	BN_ULONG carry,borrow,mask,v,d;
+	int i;
+
+	memset(t,0,2*num*sizeof(BN_ULONG));
+	for (i=0; i < num; i++)
+		t[i+num]=bn_mul_add_words(&t[i],a,num,b[i]);
+
+	for (carry=0, i=0; i < num; i++)
+		{
+		v=bn_mul_add_words(&t[i],n,num,(t[i]*n0)&BN_MASK2);
+		v=(v+carry+t[i+num])&BN_MASK2;
+		carry|=(v != t[i+num]);
+		carry&=(v <= t[i+num]);
+		t[i+num]=v;
+		}
+
+	/* t+num < 2n here; keep t+num - n unless that borrowed */
+	for (borrow=0, i=0; i < num; i++)
+		{
+		v=t[num+i];
+		d=(v-n[i]-borrow)&BN_MASK2;
+		borrow=(v < n[i]) | ((v == n[i]) & borrow);
+		r[i]=d;
+		}
+	mask=(0-(borrow-carry))&BN_MASK2;
+	for (i=0; i < num; i++)
+		r[i]=(t[num+i]&mask)|(r[i]&~mask);
+	}
+
+/* r = table[idx], touching every entry */
+static void mont_select(BN_ULONG *r, BN_ULONG *table, int entries,
+			int idx, int num)
+	{
+	BN_ULONG mask;
+	int i,j;
+
+	memset(r,0,num*sizeof(BN_ULONG));
+	for (i=0; i < entries; i++)
+		{
+		mask=(0-(BN_ULONG)((unsigned)(i^idx) == 0))&BN_MASK2;
+		for (j=0; j < num; j++)
+			r[j]|=table[i*num+j]&mask;
+		}
+	}
+
+static int exp_window(const BIGNUM *p, int bit, int w)
+	{
+	int i,ret=0;
+
+	for (i=w-1; i >= 0; i--)
+		{
+		int b=bit+i;
+		int word=b/BN_BITS2;
+
+		ret<<=1;
+		if (word < p->top)
+			ret|=(int)((p->d[word]>>(b%BN_BITS2))&1);
+		}
+	return(ret);
+	}
+
+static void words_from_bn(BN_ULONG *r, const BIGNUM *a, int num)
+	{
+	memset(r,0,num*sizeof(BN_ULONG));
+	memcpy(r,a->d,a->top*sizeof(BN_ULONG));
+	}
+
+int BN_mod_exp_mont_consttime(BIGNUM *rr, const BIGNUM *a, const BIGNUM *p,
+			      const BIGNUM *m, BN_CTX *ctx)
+	{
+	BN_ULONG *buf,*table,*acc,*tmp,*base,*t,*n;
+	BIGNUM *aa;
+	int bits,w,entries,num,i,j,ret=0;
+
+	bn_check_top(a);
+	bn_check_top(p);
+	bn_check_top(m);
+
+	if (!BN_is_odd(m))
+		return(0);
+
+	bits=BN_num_bits(p);
+	if (bits == 0)
+		return(BN_one(rr));
+
+	BN_CTX_start(ctx);
+	if ((aa=BN_CTX_get(ctx)) == NULL) goto err;
+	if (!mont_setup(m,ctx)) goto err;
+	num=mont.num;
+	n=mont.N.d;
+
+	if (a->neg || BN_ucmp(a,m) >= 0)
+		{
+		if (!BN_mod(aa,a,m,ctx)) goto err;
+		if (aa->neg && !BN_add(aa,aa,m)) goto err;
+		}
+	else if (BN_copy(aa,a) == NULL)
+		goto err;
+
+	w=(bits > 256) ? 5 : 4;
+	entries=1<<w;
+
+	buf=(BN_ULONG *)malloc((entries+5)*num*sizeof(BN_ULONG));
+	if (buf == NULL) goto err;
+	table=buf;
+	acc=&table[entries*num];
+	tmp=&acc[num];
+	base=&tmp[num];
+	t=&base[num];
+
+	/* table[0] = R mod n (one), table[1] = a*R mod n */
+	words_from_bn(base,&mont.RR,num);
+	memset(tmp,0,num*sizeof(BN_ULONG));
+	tmp[0]=1;
+	mont_mul(&table[0],tmp,base,n,mont.n0,num,t);
+	words_from_bn(tmp,aa,num);
+	mont_mul(&table[num],tmp,base,n,mont.n0,num,t);
+	for (i=2; i < entries; i++)
+		mont_mul(&table[i*num],&table[(i-1)*num],&table[num],
+			 n,mont.n0,num,t);
+
+	memcpy(acc,table,num*sizeof(BN_ULONG));
+	for (i=(bits+w-1)/w-1; i >= 0; i--)
+		{
+		for (j=0; j < w; j++)
+			mont_mul(acc,acc,acc,n,mont.n0,num,t);
+		mont_select(tmp,table,entries,exp_window(p,i*w,w),num);
+		mont_mul(acc,acc,tmp,n,mont.n0,num,t);
+		}
+
+	/* leave Montgomery form */
+	memset(tmp,0,num*sizeof(BN_ULONG));
+	tmp[0]=1;
+	mont_mul(acc,acc,tmp,n,mont.n0,num,t);
+
+	if (bn_wexpand(rr,num) != NULL)
+		{
+		memcpy(rr->d,acc,num*sizeof(BN_ULONG));
+		rr->top=num;
+		rr->neg=0;
+		bn_fix_top(rr);
+		ret=1;
+		}
+
+	memset(buf,0,(entries+5)*num*sizeof(BN_ULONG));
+	free(buf);
+err:
+	BN_CTX_end(ctx);
+	return(ret);
+	}
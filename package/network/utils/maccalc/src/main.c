@@ -10,13 +10,17 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #define MAC_ADDRESS_LEN		6
+#define MAC_STRING_LEN		17
 
 #define ERR_INVALID		1
 #define ERR_IO			2
@@ -44,10 +48,20 @@ static void print_mac(unsigned char *buf)
 	       buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
 }
 
+static void mac_add(unsigned char *mac, int i)
+{
+	uint32_t t;
+
+	t = (mac[3] << 16) | (mac[4] << 8) | mac[5];
+	t += i;
+	mac[3] = (t >> 16) & 0xff;
+	mac[4] = (t >> 8) & 0xff;
+	mac[5] = t & 0xff;
+}
+
 static int maccalc_do_add(int argc, const char *argv[])
 {
 	unsigned char mac[MAC_ADDRESS_LEN];
-	uint32_t t;
 	int err;
 	int i;
 
@@ -61,12 +75,7 @@ static int maccalc_do_add(int argc, const char *argv[])
 		return err;
 
 	i = atoi(argv[1]);
-
-	t = (mac[3] << 16) | (mac[4] << 8) | mac[5];
-	t += i;
-	mac[3] = (t >> 16) & 0xff;
-	mac[4] = (t >> 8) & 0xff;
-	mac[5] = t & 0xff;
+	mac_add(mac, i);
 
 	print_mac(mac);
 	return 0;
@@ -203,6 +212,221 @@ static int maccalc_do_xor(int argc, const char *argv[])
 	return maccalc_do_logical(argc, argv, op_xor);
 }
 
+static int read_mac_file(const char *path, off_t offset, unsigned char *buf)
+{
+	ssize_t c;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return ERR_IO;
+	}
+
+	c = pread(fd, buf, MAC_ADDRESS_LEN, offset);
+	close(fd);
+
+	if (c != MAC_ADDRESS_LEN) {
+		fprintf(stderr, "failed to read from %s\n", path);
+		return ERR_IO;
+	}
+
+	return 0;
+}
+
+static void cache_file_name(char *name, size_t len, const char *cache,
+			    const char *path, off_t offset)
+{
+	char *p;
+	int n;
+
+	n = snprintf(name, len, "%s/", cache);
+	snprintf(name + n, len - n, "%s@%lld", path, (long long) offset);
+
+	for (p = name + n; *p; p++)
+		if (*p == '/')
+			*p = '_';
+}
+
+static int cache_read(const char *name, unsigned char *buf)
+{
+	char mac_str[MAC_STRING_LEN + 1];
+	ssize_t c;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return ERR_IO;
+
+	c = read_safe(fd, mac_str, MAC_STRING_LEN);
+	close(fd);
+
+	if (c != MAC_STRING_LEN)
+		return ERR_IO;
+
+	mac_str[MAC_STRING_LEN] = 0;
+	return parse_mac(mac_str, buf);
+}
+
+static void cache_write(const char *cache, const char *name, unsigned char *buf)
+{
+	char tmp[PATH_MAX + 16];
+	FILE *f;
+
+	if (mkdir(cache, 0755) && errno != EEXIST)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, (int) getpid());
+	f = fopen(tmp, "w");
+	if (!f)
+		return;
+
+	fprintf(f, "%02x:%02x:%02x:%02x:%02x:%02x\n",
+		buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+
+	if (fclose(f) || rename(tmp, name))
+		unlink(tmp);
+}
+
+/* <mac> or <file>@<offset>, the latter is looked up in the cache first */
+static int parse_base(const char *base, const char *cache, unsigned char *buf)
+{
+	char name[PATH_MAX];
+	char path[PATH_MAX];
+	const char *sep;
+	off_t offset;
+	char *end;
+	int err;
+
+	sep = strrchr(base, '@');
+	if (!sep)
+		return parse_mac(base, buf);
+
+	if (sep - base >= (int) sizeof(path))
+		return ERR_INVALID;
+
+	memcpy(path, base, sep - base);
+	path[sep - base] = 0;
+
+	offset = strtoll(sep + 1, &end, 0);
+	if (!sep[1] || *end || offset < 0) {
+		fprintf(stderr, "invalid offset '%s'\n", sep + 1);
+		return ERR_INVALID;
+	}
+
+	if (cache) {
+		cache_file_name(name, sizeof(name), cache, path, offset);
+		if (!cache_read(name, buf))
+			return 0;
+	}
+
+	err = read_mac_file(path, offset, buf);
+	if (err)
+		return err;
+
+	if (cache)
+		cache_write(cache, name, buf);
+
+	return 0;
+}
+
+/* apply a comma separated list of add=<n>, and=<mac>, or=<mac>, xor=<mac> */
+static int apply_ops(const char *ops, unsigned char *buf)
+{
+	unsigned char (*op)(unsigned char n1, unsigned char n2);
+	unsigned char mac[MAC_ADDRESS_LEN];
+	const char *arg;
+	char *end;
+	long n;
+	int err;
+	int i;
+
+	while (*ops) {
+		arg = strchr(ops, '=');
+		if (!arg)
+			goto invalid;
+		arg++;
+
+		if (!strncmp(ops, "add=", 4)) {
+			n = strtol(arg, &end, 0);
+			if (end == arg || (*end && *end != ','))
+				goto invalid;
+			mac_add(buf, n);
+			ops = end;
+		} else {
+			if (!strncmp(ops, "and=", 4))
+				op = op_and;
+			else if (!strncmp(ops, "or=", 3))
+				op = op_or;
+			else if (!strncmp(ops, "xor=", 4))
+				op = op_xor;
+			else
+				goto invalid;
+
+			/* parse_mac() also takes short forms like 2:0:0:0:0:0 */
+			if (strcspn(arg, ",") != MAC_STRING_LEN)
+				goto invalid;
+
+			err = parse_mac(arg, mac);
+			if (err)
+				goto invalid;
+
+			for (i = 0; i < MAC_ADDRESS_LEN; i++)
+				buf[i] = op(buf[i], mac[i]);
+			ops = arg + MAC_STRING_LEN;
+		}
+
+		if (*ops == ',')
+			ops++;
+	}
+
+	return 0;
+
+invalid:
+	fprintf(stderr, "invalid operation '%s'\n", ops);
+	return ERR_INVALID;
+}
+
+static int maccalc_do_batch(int argc, const char *argv[])
+{
+	unsigned char base[MAC_ADDRESS_LEN];
+	unsigned char mac[MAC_ADDRESS_LEN];
+	const char *cache = NULL;
+	int err;
+	int i;
+
+	if (argc >= 2 && !strcmp(argv[0], "-c")) {
+		cache = argv[1];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 1) {
+		usage();
+		return ERR_INVALID;
+	}
+
+	err = parse_base(argv[0], cache, base);
+	if (err)
+		return err;
+
+	if (argc == 1) {
+		print_mac(base);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		memcpy(mac, base, sizeof(mac));
+		err = apply_ops(argv[i], mac);
+		if (err)
+			return err;
+
+		print_mac(mac);
+	}
+
+	return 0;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
@@ -211,7 +435,11 @@ static void usage(void)
 		"  add <mac> <number>\n"
 		"  and|or|xor <mac1> <mac2>\n"
 		"  mac2bin <mac>\n"
-		"  bin2mac\n",
+		"  bin2mac\n"
+		"  batch [-c <cache dir>] <mac>|<file>@<offset> [<op>[,<op>...] ...]\n"
+		"valid batch operations:\n"
+		"  add=<number>\n"
+		"  and|or|xor=<mac>\n",
 		maccalc_name);
 }
 
@@ -239,6 +467,8 @@ int main(int argc, const char *argv[])
 		op = maccalc_do_mac2bin;
 	} else if (strcmp(argv[1], "bin2mac") == 0) {
 		op = maccalc_do_bin2mac;
+	} else if (strcmp(argv[1], "batch") == 0) {
+		op = maccalc_do_batch;
 	} else {
 		fprintf(stderr, "unknown command '%s'\n", argv[1]);
 		usage();
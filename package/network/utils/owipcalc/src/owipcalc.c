@@ -694,6 +694,265 @@ static bool cidr_quiet(struct cidr *a)
 }
 
 
+/*
+ * Path compressed binary trie over struct cidr, one per address family.
+ * Inner nodes are created only where two prefixes diverge, so a list of
+ * n prefixes needs at most 2n nodes and every lookup touches at most
+ * one node per differing bit.
+ */
+
+struct node {
+	struct cidr key;
+	bool set;
+	struct node *child[2];
+};
+
+static struct node *trie4 = NULL;
+static struct node *trie6 = NULL;
+
+static uint8_t * cidr_bytes(struct cidr *a)
+{
+	return (a->family == AF_INET) ? (uint8_t *)&a->addr.v4
+	                              : a->addr.v6.s6_addr;
+}
+
+static int cidr_bit(struct cidr *a, uint32_t bit)
+{
+	return (cidr_bytes(a)[bit / 8] >> (7 - (bit % 8))) & 1;
+}
+
+static void cidr_mask(struct cidr *a)
+{
+	uint8_t *p = cidr_bytes(a);
+	uint32_t len = (a->family == AF_INET) ? 4 : 16;
+	uint32_t i;
+
+	for (i = a->prefix / 8; i < len; i++)
+	{
+		if (i == a->prefix / 8 && (a->prefix % 8))
+			p[i] &= ~(0xFF >> (a->prefix % 8));
+		else
+			p[i] = 0;
+	}
+}
+
+/* number of leading bits a and b have in common, at most max */
+static uint32_t cidr_common(struct cidr *a, struct cidr *b, uint32_t max)
+{
+	uint8_t *x = cidr_bytes(a), *y = cidr_bytes(b);
+	uint32_t i;
+	uint8_t d;
+
+	for (i = 0; i < max; i += 8)
+	{
+		d = x[i / 8] ^ y[i / 8];
+
+		if (d)
+		{
+			while (!(d & 0x80))
+			{
+				d <<= 1;
+				i++;
+			}
+
+			return (i < max) ? i : max;
+		}
+	}
+
+	return max;
+}
+
+static struct node ** trie_root(struct cidr *a)
+{
+	return (a->family == AF_INET) ? &trie4 : &trie6;
+}
+
+static struct node * trie_node(struct cidr *a, uint32_t prefix, bool set)
+{
+	struct node *n = calloc(1, sizeof(*n));
+
+	if (!n)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(255);
+	}
+
+	memcpy(&n->key, a, sizeof(n->key));
+	n->key.prefix = prefix;
+	n->key.next = NULL;
+	n->set = set;
+	cidr_mask(&n->key);
+
+	return n;
+}
+
+static void trie_free(struct node *n)
+{
+	if (n)
+	{
+		trie_free(n->child[0]);
+		trie_free(n->child[1]);
+		free(n);
+	}
+}
+
+static void trie_insert(struct cidr *a)
+{
+	struct node **np = trie_root(a);
+	struct node *n, *g;
+	uint32_t l;
+
+	while ((n = *np) != NULL)
+	{
+		l = cidr_common(&n->key, a,
+		                (n->key.prefix < a->prefix) ? n->key.prefix : a->prefix);
+
+		if (l == n->key.prefix)
+		{
+			if (a->prefix == n->key.prefix)
+			{
+				n->set = true;
+				return;
+			}
+
+			np = &n->child[cidr_bit(a, l)];
+			continue;
+		}
+
+		if (l == a->prefix)
+		{
+			/* a is a supernet of n */
+			g = trie_node(a, a->prefix, true);
+		}
+		else
+		{
+			/* a and n diverge at bit l */
+			g = trie_node(a, l, false);
+			g->child[cidr_bit(a, l)] = trie_node(a, a->prefix, true);
+		}
+
+		g->child[cidr_bit(&n->key, l)] = n;
+		*np = g;
+		return;
+	}
+
+	*np = trie_node(a, a->prefix, true);
+}
+
+/* drop everything covered by a set node and merge adjacent siblings */
+static bool trie_collapse(struct node *n)
+{
+	if (!n)
+		return false;
+
+	if (n->set)
+	{
+		trie_free(n->child[0]);
+		trie_free(n->child[1]);
+		n->child[0] = n->child[1] = NULL;
+		return true;
+	}
+
+	if (trie_collapse(n->child[0]) & trie_collapse(n->child[1]) &&
+	    n->child[0]->key.prefix == n->key.prefix + 1 &&
+	    n->child[1]->key.prefix == n->key.prefix + 1)
+	{
+		n->set = true;
+		return trie_collapse(n);
+	}
+
+	return false;
+}
+
+/* remove a from the set, splitting covering prefixes around it */
+static void trie_subtract(struct cidr *a)
+{
+	struct node **np = trie_root(a);
+	struct node *n;
+	struct cidr c;
+	int64_t split = -1;
+	uint32_t l;
+
+	while ((n = *np) != NULL)
+	{
+		if (n->key.prefix >= a->prefix)
+		{
+			if (cidr_common(&n->key, a, a->prefix) == a->prefix)
+			{
+				trie_free(n);
+				*np = NULL;
+			}
+
+			break;
+		}
+
+		if (cidr_common(&n->key, a, n->key.prefix) < n->key.prefix)
+			break;
+
+		if (n->set)
+		{
+			if (split < 0)
+				split = n->key.prefix;
+
+			n->set = false;
+		}
+
+		np = &n->child[cidr_bit(a, n->key.prefix)];
+	}
+
+	/* re-add the halves next to the path from the covering prefix to a */
+	for (l = (split < 0) ? a->prefix : split; l < a->prefix; l++)
+	{
+		memcpy(&c, a, sizeof(c));
+		cidr_bytes(&c)[l / 8] ^= 0x80 >> (l % 8);
+		c.prefix = l + 1;
+		cidr_mask(&c);
+		trie_insert(&c);
+	}
+}
+
+/* most specific set node containing a */
+static struct node * trie_lookup(struct cidr *a)
+{
+	struct node *n = *trie_root(a), *match = NULL;
+
+	while (n && n->key.prefix <= a->prefix &&
+	       cidr_common(&n->key, a, n->key.prefix) == n->key.prefix)
+	{
+		if (n->set)
+			match = n;
+
+		if (n->key.prefix == a->prefix)
+			break;
+
+		n = n->child[cidr_bit(a, n->key.prefix)];
+	}
+
+	return match;
+}
+
+static void trie_print(struct node *n)
+{
+	if (!n)
+		return;
+
+	if (n->set)
+	{
+		if (n->key.family == AF_INET)
+			cidr_print4(cidr_clone(&n->key));
+		else
+			cidr_print6(cidr_clone(&n->key));
+
+		qprintf("\n");
+		printed = false;
+		return;
+	}
+
+	trie_print(n->child[0]);
+	trie_print(n->child[1]);
+}
+
+
 struct op ops[] = {
 	{ .name = "add",
 	  .desc = "Add argument to base address",
@@ -790,9 +1049,23 @@ static void usage(const char *prog)
 	        "\n"
 	        "Usage:\n\n"
 	        "  %s {base address} operation [argument] "
-	        "[operation [argument] ...]\n\n"
+	        "[operation [argument] ...]\n"
+	        "  %s -f {file} [operation [argument] ...]\n"
+	        "  %s -a [file]\n"
+	        "  %s -x {exclude file} [file]\n"
+	        "  %s -m {table file} [file]\n\n"
+	        "Modes:\n\n"
+	        "  -f  Read base addresses, optionally followed by operations,\n"
+	        "      from file and print one result line for each.\n"
+	        "  -a  Aggregate the prefixes read from file into the smallest\n"
+	        "      equivalent list.\n"
+	        "  -x  Print the prefixes read from file minus those in the\n"
+	        "      exclude file, aggregated.\n"
+	        "  -m  Print the longest matching prefix of the table file for\n"
+	        "      every address read from file or '-' if there is none.\n\n"
+	        "  A file of '-' or no file at all reads from stdin.\n\n"
 	        "Operations:\n\n",
-	        prog);
+	        prog, prog, prog, prog, prog);
 
 	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
 	{
@@ -826,8 +1099,11 @@ static void usage(const char *prog)
 			"  192.168.1.250\n\n"
 			" Count number of prefixes:\n\n"
 			"  $ %s 2001:0DB8:FDEF::/48 howmany ::/64\n"
-			"  65536\n\n",
-	        prog, prog);
+			"  65536\n\n"
+			" Merge address lists:\n\n"
+			"  $ printf '10.0.0.0/25 10.0.0.128/25\\n10.0.1.0/24\\n' | %s -a\n"
+			"  10.0.0.0/23\n\n",
+	        prog, prog, prog);
 
 	exit(1);
 }
@@ -879,12 +1155,14 @@ static bool runop(char ***arg, int *status)
 							(a->family == AF_INET) ? "ipv4" : "ipv6");
 
 					*status = 5;
+					free(b);
 					return false;
 				}
 
 				*status = !((a->family == AF_INET) ? ops[i].f4.a2(a, b)
 				                                   : ops[i].f6.a2(a, b));
 
+				free(b);
 				return true;
 			}
 			else
@@ -913,19 +1191,21 @@ static bool runop(char ***arg, int *status)
 	return false;
 }
 
-int main(int argc, char **argv)
+static struct cidr * cidr_parse_base(const char *s)
 {
-	int status = 0;
-	char **arg = argv+2;
-	struct cidr *a;
-
-	if (argc < 3)
-		usage(argv[0]);
+	return strchr(s, ':') ? cidr_parse6(s) : cidr_parse4(s);
+}
 
-	a = strchr(argv[1], ':') ? cidr_parse6(argv[1]) : cidr_parse4(argv[1]);
+static int calc(char **arg)
+{
+	int status = 0;
+	struct cidr *a = cidr_parse_base(*arg++);
 
 	if (!a)
-		usage(argv[0]);
+		return -1;
+
+	quiet = false;
+	printed = false;
 
 	cidr_push(a);
 
@@ -947,5 +1227,222 @@ int main(int argc, char **argv)
 
 	qprintf("\n");
 
+	while (cidr_pop(stack));
+
+	return status;
+}
+
+/* split the next line of f into whitespace separated words */
+static int read_words(FILE *f, char *line, size_t len, char **words, int max)
+{
+	char *p;
+	int n;
+
+	while (fgets(line, len, f))
+	{
+		if ((p = strchr(line, '#')) != NULL)
+			*p = 0;
+
+		for (n = 0, p = strtok(line, " \t\r\n");
+		     p && (n < max - 1);
+		     p = strtok(NULL, " \t\r\n"))
+			words[n++] = p;
+
+		words[n] = NULL;
+
+		if (n > 0)
+			return n;
+	}
+
+	return -1;
+}
+
+static FILE * open_list(const char *file)
+{
+	FILE *f;
+
+	if (!file || !strcmp(file, "-"))
+		return stdin;
+
+	if (!(f = fopen(file, "r")))
+	{
+		perror(file);
+		exit(7);
+	}
+
+	return f;
+}
+
+static void close_list(FILE *f)
+{
+	if (f != stdin)
+		fclose(f);
+}
+
+/* Run the operations given on the command line once for every base
+ * address read from file, a line may also carry its own operations. */
+static int run_batch(const char *file, char **ops, int nops)
+{
+	char line[1024], *words[128];
+	FILE *f = open_list(file);
+	int n, i, status, ret = 0;
+
+	while ((n = read_words(f, line, sizeof(line), words,
+	                       sizeof(words) / sizeof(words[0]) - nops)) > 0)
+	{
+		for (i = 0; i <= nops; i++)
+			words[n + i] = ops[i];
+
+		status = calc(words);
+
+		if (status < 0)
+		{
+			fprintf(stderr, "invalid address '%s'\n", words[0]);
+			qprintf("\n");
+			status = 3;
+		}
+
+		if (status > ret)
+			ret = status;
+	}
+
+	close_list(f);
+
+	return ret;
+}
+
+static int load_list(const char *file, void (*fn)(struct cidr *))
+{
+	char line[1024], *words[128];
+	FILE *f = open_list(file);
+	struct cidr *a;
+	int n, i, ret = 0;
+
+	while ((n = read_words(f, line, sizeof(line), words,
+	                       sizeof(words) / sizeof(words[0]))) > 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (!(a = cidr_parse_base(words[i])))
+			{
+				fprintf(stderr, "invalid address '%s'\n", words[i]);
+				ret = 3;
+				continue;
+			}
+
+			cidr_mask(a);
+			fn(a);
+			free(a);
+		}
+	}
+
+	close_list(f);
+
+	return ret;
+}
+
+static void print_set(void)
+{
+	trie_collapse(trie4);
+	trie_collapse(trie6);
+
+	trie_print(trie4);
+	trie_print(trie6);
+}
+
+static int run_lookup(const char *table, const char *file)
+{
+	char line[1024], *words[2];
+	FILE *f;
+	struct cidr *a;
+	struct node *n;
+	int ret = load_list(table, trie_insert);
+
+	f = open_list(file);
+
+	while (read_words(f, line, sizeof(line), words, 2) > 0)
+	{
+		if (!(a = cidr_parse_base(words[0])))
+		{
+			fprintf(stderr, "invalid address '%s'\n", words[0]);
+			qprintf("\n");
+			ret = 3;
+			continue;
+		}
+
+		if ((n = trie_lookup(a)) != NULL)
+		{
+			if (n->key.family == AF_INET)
+				cidr_print4(cidr_clone(&n->key));
+			else
+				cidr_print6(cidr_clone(&n->key));
+		}
+		else
+		{
+			qprintf("-");
+
+			if (!ret)
+				ret = 1;
+		}
+
+		qprintf("\n");
+		printed = false;
+		free(a);
+	}
+
+	close_list(f);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int status;
+
+	if ((argc >= 2) && (argv[1][0] == '-') && argv[1][1] && !argv[1][2])
+	{
+		switch (argv[1][1])
+		{
+		case 'f':
+			if (argc < 3)
+				usage(argv[0]);
+
+			exit(run_batch(argv[2], argv + 3, argc - 3));
+
+		case 'a':
+			status = load_list(argc > 2 ? argv[2] : NULL, trie_insert);
+			print_set();
+			exit(status);
+
+		case 'x':
+			if (argc < 3)
+				usage(argv[0]);
+
+			status = load_list(argc > 3 ? argv[3] : NULL, trie_insert);
+			trie_collapse(trie4);
+			trie_collapse(trie6);
+			status |= load_list(argv[2], trie_subtract);
+			print_set();
+			exit(status);
+
+		case 'm':
+			if (argc < 3)
+				usage(argv[0]);
+
+			exit(run_lookup(argv[2], argc > 3 ? argv[3] : NULL));
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc < 3)
+		usage(argv[0]);
+
+	status = calc(argv + 1);
+
+	if (status < 0)
+		usage(argv[0]);
+
 	exit(status);
 }
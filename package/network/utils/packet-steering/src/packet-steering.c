@@ -0,0 +1,1032 @@
+/*
+ * packet-steering - place NIC IRQs, RPS, XPS and RFS according to the
+ * CPU topology and rebalance them when a core saturates
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define MAX_CPUS	64
+#define MAX_DEVS	32
+#define MAX_IRQS	64
+#define MAX_QUEUES	32
+
+#define SYS_NET		"/sys/class/net"
+#define SYS_CPU		"/sys/devices/system/cpu"
+
+typedef uint64_t cpumask_t;
+
+struct cpu {
+	int id;
+	int pkg;
+	int core;
+	int thread;
+
+	unsigned long long busy;
+	unsigned long long total;
+	unsigned long long net_rx;
+
+	int load;		/* percent of the last interval */
+	unsigned long rx_rate;	/* NET_RX softirqs in the last interval */
+	int over;		/* consecutive intervals above threshold */
+	int hot;
+};
+
+struct nic_irq {
+	int irq;
+	int cpu;
+	int fixed;		/* affinity can not be changed */
+	int placed;
+	unsigned long long count;
+	unsigned long long delta;
+};
+
+struct netdev {
+	char ifname[IF_NAMESIZE];
+	char devname[64];
+	int dsa;
+	int n_rx;
+	int n_tx;
+	int irqs[MAX_IRQS];
+	int n_irqs;
+
+	cpumask_t rps;
+	cpumask_t xps[MAX_QUEUES];
+	int flow_cnt;
+};
+
+static struct cpu cpus[MAX_CPUS];
+static int n_cpus;
+static int cpu_order[MAX_CPUS];
+static cpumask_t online;
+
+static struct nic_irq irqs[MAX_IRQS];
+static int n_irqs;
+
+static struct netdev devs[MAX_DEVS];
+static int n_devs;
+
+static int interval = 2000;
+static int threshold = 90;
+static int rfs_flows;
+static int place_irqs = 1;
+static int debug;
+
+static int cooldown;
+static volatile sig_atomic_t do_rescan = 1;
+static volatile sig_atomic_t do_exit;
+
+static void
+log_msg(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (prio == LOG_DEBUG && !debug)
+		return;
+
+	va_start(ap, fmt);
+	if (debug) {
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+	} else {
+		vsyslog(prio, fmt, ap);
+	}
+	va_end(ap);
+}
+
+static int64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+read_file(const char *path, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+
+	buf[n] = 0;
+	return n;
+}
+
+static int
+read_int(const char *path, int def)
+{
+	char buf[32];
+
+	if (read_file(path, buf, sizeof(buf)) < 0)
+		return def;
+
+	return atoi(buf);
+}
+
+static int
+write_file(const char *path, const char *val)
+{
+	int fd, ret = 0;
+
+	log_msg(LOG_DEBUG, "%s = %s", path, val);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -1;
+
+	close(fd);
+	return ret;
+}
+
+static int
+write_mask(const char *path, cpumask_t mask)
+{
+	char buf[32];
+
+	if (mask >> 32)
+		snprintf(buf, sizeof(buf), "%x,%08x",
+			 (unsigned int) (mask >> 32), (unsigned int) mask);
+	else
+		snprintf(buf, sizeof(buf), "%x", (unsigned int) mask);
+
+	return write_file(path, buf);
+}
+
+static struct cpu *
+cpu_get(int id)
+{
+	int i;
+
+	for (i = 0; i < n_cpus; i++)
+		if (cpus[i].id == id)
+			return &cpus[i];
+
+	return NULL;
+}
+
+static int
+cpu_cmp(const void *a, const void *b)
+{
+	const struct cpu *ca = &cpus[*(const int *) a];
+	const struct cpu *cb = &cpus[*(const int *) b];
+
+	if (ca->thread != cb->thread)
+		return ca->thread - cb->thread;
+	if (ca->pkg != cb->pkg)
+		return ca->pkg - cb->pkg;
+	if (ca->core != cb->core)
+		return ca->core - cb->core;
+
+	return ca->id - cb->id;
+}
+
+/*
+ * Read the online CPUs and their topology. cpu_order lists one thread of
+ * every physical core before any SMT sibling, so that handing out CPUs in
+ * that order spreads work across cores first.
+ */
+static void
+scan_cpus(void)
+{
+	char buf[256], path[128], *p = buf;
+	int i, j, start, end;
+
+	n_cpus = 0;
+	online = 0;
+
+	if (read_file(SYS_CPU "/online", buf, sizeof(buf)) < 0)
+		strcpy(buf, "0");
+
+	while (*p && n_cpus < MAX_CPUS) {
+		start = end = strtol(p, &p, 10);
+		if (*p == '-')
+			end = strtol(p + 1, &p, 10);
+
+		for (i = start; i <= end && i < MAX_CPUS; i++) {
+			struct cpu *c = &cpus[n_cpus];
+
+			memset(c, 0, sizeof(*c));
+			c->id = i;
+
+			snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/physical_package_id", i);
+			c->pkg = read_int(path, 0);
+			snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/core_id", i);
+			c->core = read_int(path, i);
+
+			for (j = 0; j < n_cpus; j++)
+				if (cpus[j].pkg == c->pkg && cpus[j].core == c->core)
+					c->thread++;
+
+			online |= 1ULL << i;
+			n_cpus++;
+		}
+
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	for (i = 0; i < n_cpus; i++)
+		cpu_order[i] = i;
+
+	qsort(cpu_order, n_cpus, sizeof(cpu_order[0]), cpu_cmp);
+}
+
+/*
+ * Sample per-CPU busy time from /proc/stat and NET_RX softirqs from
+ * /proc/softirqs, updating load and rx_rate with the deltas.
+ */
+static void
+sample_cpus(void)
+{
+	unsigned long long v[8], busy, total;
+	int cols[MAX_CPUS], n_cols = 0;
+	char line[1024], *p;
+	struct cpu *c;
+	FILE *f;
+	int id, i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "cpu", 3) || !isdigit(line[3]))
+			continue;
+
+		memset(v, 0, sizeof(v));
+		if (sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &id, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+			   &v[6], &v[7]) < 5)
+			continue;
+
+		c = cpu_get(id);
+		if (!c)
+			continue;
+
+		/* user nice system irq softirq steal */
+		busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+		total = busy + v[3] + v[4];
+
+		if (c->total && total > c->total)
+			c->load = (busy - c->busy) * 100 / (total - c->total);
+
+		c->busy = busy;
+		c->total = total;
+	}
+	fclose(f);
+
+	f = fopen("/proc/softirqs", "r");
+	if (!f)
+		return;
+
+	/* header lists the CPU columns */
+	if (!fgets(line, sizeof(line), f))
+		goto out;
+
+	for (p = strtok(line, " \t\n"); p && n_cols < MAX_CPUS; p = strtok(NULL, " \t\n"))
+		if (!strncmp(p, "CPU", 3))
+			cols[n_cols++] = atoi(p + 3);
+
+	while (fgets(line, sizeof(line), f)) {
+		p = line + strspn(line, " ");
+		if (strncmp(p, "NET_RX:", 7))
+			continue;
+
+		p += 7;
+		for (i = 0; i < n_cols; i++) {
+			unsigned long long n = strtoull(p, &p, 10);
+
+			c = cpu_get(cols[i]);
+			if (!c)
+				continue;
+
+			if (c->net_rx)
+				c->rx_rate = n - c->net_rx;
+			c->net_rx = n;
+		}
+		break;
+	}
+
+out:
+	fclose(f);
+}
+
+static int
+readlink_base(const char *path, char *buf, size_t len)
+{
+	char link[PATH_MAX], *p;
+	ssize_t n;
+
+	n = readlink(path, link, sizeof(link) - 1);
+	if (n < 0)
+		return -1;
+
+	link[n] = 0;
+	p = strrchr(link, '/');
+	n = snprintf(buf, len, "%s", p ? p + 1 : link);
+	if (n < 0 || (size_t) n >= len)
+		return -1;
+
+	return 0;
+}
+
+static struct nic_irq *
+irq_get(int irq, int create)
+{
+	int i;
+
+	for (i = 0; i < n_irqs; i++)
+		if (irqs[i].irq == irq)
+			return &irqs[i];
+
+	if (!create || n_irqs >= MAX_IRQS)
+		return NULL;
+
+	memset(&irqs[n_irqs], 0, sizeof(irqs[0]));
+	irqs[n_irqs].irq = irq;
+	irqs[n_irqs].cpu = -1;
+
+	return &irqs[n_irqs++];
+}
+
+static int
+name_matches(const char *name, const char *prefix)
+{
+	size_t len = strlen(prefix);
+
+	return !strncmp(name, prefix, len) &&
+	       (!name[len] || name[len] == '-' || name[len] == '_');
+}
+
+static int
+irq_matches(const struct netdev *dev, const char *name)
+{
+	return name_matches(name, dev->ifname) || name_matches(name, dev->devname);
+}
+
+/*
+ * Walk /proc/interrupts once. With match set, IRQs whose action names
+ * belong to a known device are attached to it. Counters of all tracked
+ * IRQs are updated and the CPU an unmovable IRQ fires on is derived from
+ * where its count grew.
+ */
+static void
+scan_irqs(int match)
+{
+	char line[1024], *p, *tok;
+	int cols[MAX_CPUS], n_cols = 0;
+	unsigned long long counts[MAX_CPUS];
+	struct nic_irq *irq;
+	FILE *f;
+	int i, j, nr;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return;
+
+	if (!fgets(line, sizeof(line), f))
+		goto out;
+
+	for (p = strtok(line, " \t\n"); p && n_cols < MAX_CPUS; p = strtok(NULL, " \t\n"))
+		if (!strncmp(p, "CPU", 3))
+			cols[n_cols++] = atoi(p + 3);
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long sum = 0, max = 0;
+		int max_cpu = -1;
+
+		nr = strtol(line, &p, 10);
+		if (p == line || *p != ':')
+			continue;
+
+		p++;
+		for (i = 0; i < n_cols; i++) {
+			counts[i] = strtoull(p, &p, 10);
+			sum += counts[i];
+		}
+
+		irq = irq_get(nr, 0);
+		if (!irq && match) {
+			for (tok = strtok(p, " ,\t\n"); tok && !irq; tok = strtok(NULL, " ,\t\n")) {
+				for (j = 0; j < n_devs; j++) {
+					struct netdev *dev = &devs[j];
+
+					if (!irq_matches(dev, tok) || dev->n_irqs >= MAX_IRQS)
+						continue;
+
+					irq = irq_get(nr, 1);
+					if (!irq)
+						break;
+
+					dev->irqs[dev->n_irqs++] = nr;
+					break;
+				}
+			}
+		}
+
+		if (!irq)
+			continue;
+
+		irq->delta = irq->count ? sum - irq->count : 0;
+
+		for (i = 0; i < n_cols; i++) {
+			if (counts[i] > max) {
+				max = counts[i];
+				max_cpu = cols[i];
+			}
+		}
+
+		if (irq->cpu < 0 || irq->fixed)
+			irq->cpu = max_cpu < 0 ? cpus[0].id : max_cpu;
+
+		irq->count = sum;
+	}
+
+out:
+	fclose(f);
+}
+
+static int
+count_queues(const char *ifname, const char *prefix)
+{
+	char path[128];
+	struct dirent *e;
+	DIR *d;
+	int n = 0;
+
+	snprintf(path, sizeof(path), SYS_NET "/%s/queues", ifname);
+	d = opendir(path);
+	if (!d)
+		return 0;
+
+	while ((e = readdir(d)) != NULL)
+		if (!strncmp(e->d_name, prefix, strlen(prefix)))
+			n++;
+
+	closedir(d);
+	return n;
+}
+
+static int
+is_stacked(const char *ifname)
+{
+	char path[128];
+	struct dirent *e;
+	DIR *d;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), SYS_NET "/%s", ifname);
+	d = opendir(path);
+	if (!d)
+		return 1;
+
+	while ((e = readdir(d)) != NULL) {
+		if (!strncmp(e->d_name, "lower_", 6)) {
+			ret = 1;
+			break;
+		}
+	}
+
+	closedir(d);
+	return ret;
+}
+
+/* Collect the hardware backed network devices and their IRQs */
+static void
+scan_devs(void)
+{
+	char path[PATH_MAX], subsys[32];
+	struct dirent *e;
+	DIR *d;
+
+	n_devs = 0;
+	n_irqs = 0;
+
+	d = opendir(SYS_NET);
+	if (!d)
+		return;
+
+	while ((e = readdir(d)) != NULL && n_devs < MAX_DEVS) {
+		struct netdev *dev = &devs[n_devs];
+
+		if (e->d_name[0] == '.' || strlen(e->d_name) >= IF_NAMESIZE)
+			continue;
+
+		memset(dev, 0, sizeof(*dev));
+		strcpy(dev->ifname, e->d_name);
+
+		snprintf(path, sizeof(path), SYS_NET "/%s/device", dev->ifname);
+		if (readlink_base(path, dev->devname, sizeof(dev->devname)))
+			continue;
+
+		if (is_stacked(dev->ifname))
+			continue;
+
+		/* dsa slave ports are fed by the cpu port, no RPS for them */
+		snprintf(path, sizeof(path), SYS_NET "/%s/device/subsystem", dev->ifname);
+		if (!readlink_base(path, subsys, sizeof(subsys)))
+			dev->dsa = !strcmp(subsys, "mdio_bus");
+
+		dev->n_rx = count_queues(dev->ifname, "rx-");
+		dev->n_tx = count_queues(dev->ifname, "tx-");
+		if (dev->n_rx > MAX_QUEUES)
+			dev->n_rx = MAX_QUEUES;
+		if (dev->n_tx > MAX_QUEUES)
+			dev->n_tx = MAX_QUEUES;
+
+		n_devs++;
+	}
+	closedir(d);
+
+	scan_irqs(1);
+}
+
+static cpumask_t
+dev_irq_mask(const struct netdev *dev)
+{
+	cpumask_t mask = 0;
+	int i;
+
+	for (i = 0; i < dev->n_irqs; i++) {
+		struct nic_irq *irq = irq_get(dev->irqs[i], 0);
+
+		if (irq && irq->cpu >= 0)
+			mask |= 1ULL << irq->cpu;
+	}
+
+	return mask;
+}
+
+static cpumask_t
+hot_mask(void)
+{
+	cpumask_t mask = 0;
+	int i;
+
+	for (i = 0; i < n_cpus; i++)
+		if (cpus[i].hot)
+			mask |= 1ULL << cpus[i].id;
+
+	return mask;
+}
+
+static int
+irq_set_cpu(struct nic_irq *irq, int cpu)
+{
+	char path[64];
+
+	if (irq->fixed || (irq->placed && irq->cpu == cpu))
+		return 0;
+
+	snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity", irq->irq);
+	if (write_mask(path, 1ULL << cpu)) {
+		irq->fixed = 1;
+		return -1;
+	}
+
+	irq->cpu = cpu;
+	irq->placed = 1;
+	return 0;
+}
+
+static int
+irq_cmp(const void *a, const void *b)
+{
+	const struct nic_irq *ia = a, *ib = b;
+
+	if (ia->count != ib->count)
+		return ia->count < ib->count ? 1 : -1;
+
+	return ia->irq - ib->irq;
+}
+
+/* Spread the NIC IRQs over the physical cores, busiest IRQ first */
+static void
+place_all_irqs(void)
+{
+	int i, next = 0;
+
+	if (!place_irqs)
+		return;
+
+	qsort(irqs, n_irqs, sizeof(irqs[0]), irq_cmp);
+
+	for (i = 0; i < n_irqs; i++) {
+		struct nic_irq *irq = &irqs[i];
+
+		if (irq->fixed)
+			continue;
+
+		irq_set_cpu(irq, cpus[cpu_order[next++ % n_cpus]].id);
+	}
+}
+
+static int
+round_pow2(int val)
+{
+	int ret = 1;
+
+	while (ret * 2 <= val)
+		ret *= 2;
+
+	return ret;
+}
+
+static int
+queue_path(char *path, size_t len, struct netdev *dev, const char *dir,
+	   int q, const char *attr)
+{
+	int n;
+
+	n = snprintf(path, len, SYS_NET "/%s/queues/%s-%d/%s",
+		     dev->ifname, dir, q, attr);
+	if (n < 0 || (size_t) n >= len)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Program RPS, XPS and RFS for every device. Only values that differ from
+ * the last write go to sysfs.
+ */
+static void
+apply_steering(int force)
+{
+	char path[128], buf[16];
+	cpumask_t hot = hot_mask();
+	int i, q, flows;
+
+	if (force && rfs_flows) {
+		snprintf(buf, sizeof(buf), "%d", rfs_flows);
+		write_file("/proc/sys/net/core/rps_sock_flow_entries", buf);
+	}
+
+	for (i = 0; i < n_devs; i++) {
+		struct netdev *dev = &devs[i];
+		cpumask_t irq_mask = dev_irq_mask(dev);
+		cpumask_t rps;
+
+		for (q = 0; q < dev->n_tx; q++) {
+			cpumask_t xps = 0;
+			int j;
+
+			/* every core serves one tx queue, single queue needs no XPS */
+			if (dev->n_tx > 1)
+				for (j = 0; j < n_cpus; j++)
+					if (j % dev->n_tx == q)
+						xps |= 1ULL << cpus[cpu_order[j]].id;
+
+			if (!force && dev->xps[q] == xps)
+				continue;
+
+			if (queue_path(path, sizeof(path), dev, "tx", q, "xps_cpus"))
+				continue;
+
+			write_mask(path, xps);
+			dev->xps[q] = xps;
+		}
+
+		if (dev->dsa)
+			continue;
+
+		/*
+		 * Keep RPS off the CPUs taking the device interrupts and off
+		 * saturated CPUs. A device with interrupts on every CPU
+		 * already spreads in hardware.
+		 */
+		rps = online & ~irq_mask;
+		if (rps & ~hot)
+			rps &= ~hot;
+		flows = 0;
+		if (rps && rfs_flows && dev->n_rx)
+			flows = round_pow2(rfs_flows / dev->n_rx);
+
+		if (!force && dev->rps == rps && dev->flow_cnt == flows)
+			continue;
+
+		for (q = 0; q < dev->n_rx; q++) {
+			if (queue_path(path, sizeof(path), dev, "rx", q, "rps_cpus"))
+				continue;
+
+			write_mask(path, rps);
+
+			if (!rfs_flows ||
+			    queue_path(path, sizeof(path), dev, "rx", q, "rps_flow_cnt"))
+				continue;
+
+			snprintf(buf, sizeof(buf), "%d", flows);
+			write_file(path, buf);
+		}
+
+		dev->rps = rps;
+		dev->flow_cnt = flows;
+	}
+}
+
+static struct cpu *
+coolest_cpu(cpumask_t avoid)
+{
+	struct cpu *best = NULL;
+	int i;
+
+	for (i = 0; i < n_cpus; i++) {
+		struct cpu *c = &cpus[cpu_order[i]];
+
+		if (c->hot || (avoid & (1ULL << c->id)))
+			continue;
+
+		if (!best || c->load < best->load ||
+		    (c->load == best->load && c->rx_rate < best->rx_rate))
+			best = c;
+	}
+
+	return best;
+}
+
+/*
+ * A hot CPU serving more than one NIC IRQ hands its quieter IRQ to the
+ * coolest CPU, preferring one that does not take NIC interrupts yet.
+ */
+static int
+rebalance_irqs(void)
+{
+	cpumask_t irq_cpus = 0;
+	int i, j;
+
+	if (!place_irqs || cooldown)
+		return 0;
+
+	for (i = 0; i < n_irqs; i++)
+		irq_cpus |= 1ULL << irqs[i].cpu;
+
+	for (i = 0; i < n_cpus; i++) {
+		struct nic_irq *busy = NULL, *move = NULL;
+		struct cpu *c = &cpus[i], *dst;
+
+		if (!c->hot)
+			continue;
+
+		for (j = 0; j < n_irqs; j++) {
+			struct nic_irq *irq = &irqs[j];
+
+			if (irq->cpu != c->id || !irq->delta)
+				continue;
+
+			if (!busy || irq->delta > busy->delta) {
+				if (busy && !busy->fixed)
+					move = busy;
+				busy = irq;
+			} else if (!irq->fixed && (!move || irq->delta > move->delta)) {
+				move = irq;
+			}
+		}
+
+		if (!move)
+			continue;
+
+		dst = coolest_cpu(irq_cpus);
+		if (!dst)
+			dst = coolest_cpu(1ULL << c->id);
+		if (!dst || dst->load >= threshold / 2)
+			continue;
+
+		log_msg(LOG_INFO, "moving irq %d from cpu %d (%d%%) to cpu %d (%d%%)",
+			move->irq, c->id, c->load, dst->id, dst->load);
+
+		if (irq_set_cpu(move, dst->id))
+			continue;
+
+		cooldown = 5;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Returns nonzero when the set of saturated CPUs changed */
+static int
+update_hot(void)
+{
+	int i, changed = 0;
+
+	for (i = 0; i < n_cpus; i++) {
+		struct cpu *c = &cpus[i];
+
+		if (c->load >= threshold)
+			c->over++;
+		else
+			c->over = 0;
+
+		if (!c->hot && c->over >= 2) {
+			c->hot = 1;
+			changed = 1;
+		} else if (c->hot && c->load < threshold - 10) {
+			c->hot = 0;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+static int
+netlink_open(void)
+{
+	struct sockaddr_nl nl = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *) &nl, sizeof(nl))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Drain pending link messages, flag a rescan for new or removed links */
+static void
+netlink_recv(int fd)
+{
+	char buf[8192];
+	struct nlmsghdr *h;
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+			if (h->nlmsg_type == RTM_DELLINK)
+				do_rescan = 1;
+			else if (h->nlmsg_type == RTM_NEWLINK && ifi->ifi_change == ~0U)
+				do_rescan = 1;
+		}
+	}
+
+	if (len < 0 && errno == ENOBUFS)
+		do_rescan = 1;
+}
+
+static void
+handle_signal(int sig)
+{
+	if (sig == SIGHUP)
+		do_rescan = 1;
+	else
+		do_exit = 1;
+}
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-i <msecs>	Sampling interval (default: %d)\n"
+		"	-t <percent>	CPU load considered saturated (default: %d)\n"
+		"	-f <flows>	RFS flow table entries, 0 disables RFS (default: %d)\n"
+		"	-n		Do not change IRQ affinity\n"
+		"	-o		Apply once and exit\n"
+		"	-d		Debug output to stderr\n"
+		"\n", prog, interval, threshold, rfs_flows);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa = { .sa_handler = handle_signal };
+	struct pollfd pfd = { .events = POLLIN };
+	int64_t deadline, left;
+	int once = 0, ch;
+
+	while ((ch = getopt(argc, argv, "i:t:f:nod")) != -1) {
+		switch (ch) {
+		case 'i':
+			interval = atoi(optarg);
+			if (interval < 100)
+				interval = 100;
+			break;
+		case 't':
+			threshold = atoi(optarg);
+			if (threshold < 20 || threshold > 100)
+				threshold = 90;
+			break;
+		case 'f':
+			rfs_flows = atoi(optarg);
+			if (rfs_flows < 0)
+				rfs_flows = 0;
+			break;
+		case 'n':
+			place_irqs = 0;
+			break;
+		case 'o':
+			once = 1;
+			break;
+		case 'd':
+			debug = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	openlog("packet-steering", 0, LOG_DAEMON);
+
+	scan_cpus();
+	if (n_cpus < 2) {
+		log_msg(LOG_INFO, "single CPU system, nothing to do");
+		return 0;
+	}
+
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	pfd.fd = once ? -1 : netlink_open();
+
+	while (!do_exit) {
+		if (do_rescan) {
+			do_rescan = 0;
+			scan_devs();
+			place_all_irqs();
+			sample_cpus();
+			apply_steering(1);
+
+			if (once)
+				break;
+		}
+
+		/*
+		 * Collect link events until the next sample is due, a steady
+		 * stream of them must not hold sampling off.
+		 */
+		deadline = now_ms() + interval;
+		while ((left = deadline - now_ms()) > 0 &&
+		       poll(&pfd, 1, left) > 0)
+			netlink_recv(pfd.fd);
+
+		if (do_rescan || do_exit)
+			continue;
+
+		sample_cpus();
+		scan_irqs(0);
+
+		if (cooldown)
+			cooldown--;
+
+		if (update_hot() | rebalance_irqs())
+			apply_steering(0);
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	return 0;
+}
@@ -34,24 +34,47 @@
 #include "zlib.h"
 
 #define CHUNK 1024
+#define MAX_OFFSETS 8
+
+struct buffer {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
 
 static inline size_t special_min(size_t a, size_t b)
 {
 	return a == 0 ? b : (a < b ? a : b);
 }
 
-/* Decompress from file source to file dest until stream ends or EOF.
-   inf() returns Z_OK on success, Z_MEM_ERROR if memory could not be
-   allocated for processing, Z_DATA_ERROR if the deflate data is
-   invalid or incomplete, Z_VERSION_ERROR if the version of zlib.h and
-   the version of the library linked do not match, or Z_ERRNO if there
-   is an error reading or writing the files. */
-static int inf(FILE *source, FILE *dest, size_t limit, size_t skip)
+static int buffer_append(struct buffer *buf, const void *data, size_t len)
+{
+	unsigned char *tmp;
+
+	if (buf->len + len > buf->size) {
+		tmp = realloc(buf->data, buf->len + len + CHUNK);
+		if (!tmp)
+			return -1;
+		buf->data = tmp;
+		buf->size = buf->len + len + CHUNK;
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+/* Decompress from the source buffer into dest until stream ends or the
+   data is used up. inf() returns Z_OK on success, Z_MEM_ERROR if memory
+   could not be allocated for processing, Z_DATA_ERROR if the deflate
+   data is invalid or incomplete, Z_VERSION_ERROR if the version of
+   zlib.h and the version of the library linked do not match. */
+static int inf(const unsigned char *source, size_t len, struct buffer *dest,
+	       size_t limit, size_t skip)
 {
     int ret;
     size_t have;
     z_stream strm;
-    unsigned char in[CHUNK];
     unsigned char out[CHUNK];
 
     /* allocate inflate state */
@@ -64,16 +87,14 @@ static int inf(FILE *source, FILE *dest, size_t limit, size_t skip)
     if (ret != Z_OK)
         return ret;
 
-    /* decompress until deflate stream ends or end of file */
+    /* decompress until deflate stream ends or end of data */
     do {
-        strm.avail_in = fread(in, 1, CHUNK, source);
-        if (ferror(source)) {
-            (void)inflateEnd(&strm);
-            return Z_ERRNO;
-        }
+        strm.avail_in = len < CHUNK ? len : CHUNK;
         if (strm.avail_in == 0)
             break;
-        strm.next_in = in;
+        strm.next_in = (unsigned char *)source;
+        source += strm.avail_in;
+        len -= strm.avail_in;
 
         /* run inflate() on input until output buffer not full */
         do {
@@ -90,9 +111,9 @@ static int inf(FILE *source, FILE *dest, size_t limit, size_t skip)
                 return ret;
             }
             have = special_min(limit, CHUNK - strm.avail_out) - skip;
-            if (fwrite(&out[skip], have, 1, dest) != 1 || ferror(dest)) {
+            if (buffer_append(dest, &out[skip], have)) {
                 (void)inflateEnd(&strm);
-                return Z_ERRNO;
+                return Z_MEM_ERROR;
             }
 	    skip = 0;
 	    limit -= have;
@@ -140,8 +161,9 @@ static unsigned int get_num(char *str)
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: fritz_cal_extract [-s seek offset] [-i skip] [-o output file] [-l limit] [infile] -e entry_id\n"
-			"Finds and extracts zlib compressed calibration data in the EVA loader\n");
+	fprintf(stderr, "Usage: fritz_cal_extract [-s seek offset]... [-i skip] [-o output file] [-l limit] [infile...] -e entry_id\n"
+			"Finds and extracts zlib compressed calibration data in the EVA loader\n"
+			"Every seek offset of every infile is tried in turn, until one contains the entry\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -150,22 +172,85 @@ struct cal_entry {
 	uint16_t len;
 } __attribute__((packed));
 
-/* compress or decompress from stdin to stdout */
+/* read the whole input at once, flash partitions are small */
+static int read_input(FILE *in, struct buffer *buf)
+{
+	unsigned char chunk[16 * CHUNK];
+	size_t len;
+
+	while ((len = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+		if (buffer_append(buf, chunk, len))
+			return Z_MEM_ERROR;
+	}
+
+	return ferror(in) ? Z_ERRNO : Z_OK;
+}
+
+/* walk the calibration table starting at offset, looking for entry */
+static const unsigned char *find_entry(const struct buffer *buf, size_t offset,
+				       uint16_t entry)
+{
+	struct cal_entry cal;
+	size_t pos = offset;
+
+	while (pos + sizeof(cal) <= buf->len) {
+		memcpy(&cal, buf->data + pos, sizeof(cal));
+		if (cal.id == 0xffff)
+			return NULL;
+
+		pos += sizeof(cal);
+		if (cal.id == entry)
+			return buf->data + pos;
+
+		pos += be16toh(cal.len);
+	}
+
+	return NULL;
+}
+
+static int extract(const struct buffer *buf, const size_t *offsets,
+		   int num_offsets, uint16_t entry, struct buffer *out,
+		   size_t limit, size_t skip)
+{
+	const unsigned char *data;
+	int ret = Z_DATA_ERROR;
+	int i;
+
+	for (i = 0; i < num_offsets; i++) {
+		data = find_entry(buf, offsets[i], entry);
+		if (!data)
+			continue;
+
+		out->len = 0;
+		ret = inf(data, buf->data + buf->len - data, out, limit, skip);
+		if (ret == Z_OK)
+			break;
+	}
+
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
-	struct cal_entry cal = { .len = 0 };
+	struct buffer buf = { .len = 0 }, cal = { .len = 0 };
+	size_t offsets[MAX_OFFSETS] = { 0 };
 	FILE *in = stdin;
 	FILE *out = stdout;
 	size_t limit = 0, skip = 0;
-	int initial_offset = 0;
+	int num_offsets = 0;
 	int entry = -1;
+	int found = 0;
 	int ret;
 	int opt;
 
 	while ((opt = getopt(argc, argv, "s:e:o:l:i:")) != -1) {
 		switch (opt) {
 		case 's':
-			initial_offset = (int)get_num(optarg);
+			if (num_offsets == MAX_OFFSETS) {
+				fprintf(stderr, "Too many seek offsets\n");
+				goto out_bad;
+			}
+			offsets[num_offsets++] = get_num(optarg);
 			if (errno) {
 				perror("Failed to parse seek offset");
 				goto out_bad;
@@ -207,53 +292,56 @@ int main(int argc, char **argv)
 	if (entry == -1)
 		usage();
 
-	if (argc > 1 && optind <= argc) {
-		in = fopen(argv[optind], "r");
-		if (!in) {
-			perror("Failed to create output file");
-			goto out_bad;
-		}
-	}
+	if (!num_offsets)
+		num_offsets = 1;
 
-	if (initial_offset) {
-		ret = fseek(in, initial_offset, SEEK_CUR);
-		if (ret) {
-			perror("Failed to seek to calibration table");
-			goto out_bad;
+	do {
+		if (optind < argc) {
+			in = fopen(argv[optind], "r");
+			if (!in) {
+				perror("Failed to open input file");
+				goto out_bad;
+			}
 		}
-	}
 
-	do {
-		ret = fseek(in, be16toh(cal.len), SEEK_CUR);
-		if (feof(in)) {
-			fprintf(stderr, "Reached end of file, but didn't find the matching entry\n");
-			goto out_bad;
-		} else if (ferror(in)) {
-			perror("Failure during seek");
+		buf.len = 0;
+		ret = read_input(in, &buf);
+		if (in != stdin)
+			fclose(in);
+		if (ret != Z_OK) {
+			zerr(ret);
 			goto out_bad;
 		}
 
-		ret = fread(&cal, 1, sizeof cal, in);
-		if (ret != sizeof cal)
-			goto out_bad;
-	} while (entry != cal.id || cal.id == 0xffff);
+		ret = extract(&buf, offsets, num_offsets, entry, &cal, limit, skip);
+		if (ret == Z_OK) {
+			found = 1;
+			break;
+		}
+	} while (++optind < argc);
 
-	if (cal.id == 0xffff) {
-		fprintf(stderr, "Reached end of filesystem, but didn't find the matching entry\n");
+	if (!found) {
+		if (ret == Z_DATA_ERROR)
+			fprintf(stderr, "No valid calibration data found for the entry\n");
+		else
+			zerr(ret);
 		goto out_bad;
 	}
 
-	ret = inf(in, out, limit, skip);
-	if (ret == Z_OK)
-		goto out;
+	if (fwrite(cal.data, 1, cal.len, out) != cal.len || fflush(out)) {
+		zerr(Z_ERRNO);
+		goto out_bad;
+	}
 
-	zerr(ret);
+	ret = EXIT_SUCCESS;
+	goto out;
 
 out_bad:
 	ret = EXIT_FAILURE;
 
 out:
-	fclose(in);
+	free(buf.data);
+	free(cal.data);
 	fclose(out);
 	return ret;
 }
@@ -39,10 +39,13 @@
 #define TFFS_ID_END		0xffff
 #define TFFS_ID_TABLE_NAME	0x01ff
 
+#define MAX_NAME_FILTERS	16
+
 static char *progname;
 static char *input_file;
 static unsigned long tffs_size;
-static char *name_filter = NULL;
+static char *name_filter[MAX_NAME_FILTERS];
+static int num_name_filters = 0;
 static bool show_all = false;
 static bool print_all_key_names = false;
 static bool swap_bytes = false;
@@ -68,6 +71,18 @@ struct tffs_key_name_table {
 	struct tffs_name_table_entry *entries;
 };
 
+struct tffs_index_entry {
+	uint16_t id;
+	uint32_t pos;
+};
+
+struct tffs_index {
+	uint32_t size;
+	struct tffs_index_entry *entries;
+};
+
+static struct tffs_index tffs_index;
+
 static inline uint16_t get_header_len(const struct tffs_entry_header *header)
 {
 	if (swap_bytes)
@@ -113,21 +128,69 @@ static void parse_entry(uint8_t *buffer, uint32_t pos,
 	entry->val = &buffer[pos + sizeof(struct tffs_entry_header)];
 }
 
-static int find_entry(uint8_t *buffer, uint16_t id, struct tffs_entry *entry)
+static int compare_index_entries(const void *a, const void *b)
+{
+	const struct tffs_index_entry *e1 = a, *e2 = b;
+
+	if (e1->id != e2->id)
+		return e1->id < e2->id ? -1 : 1;
+
+	return e1->pos < e2->pos ? -1 : e1->pos > e2->pos;
+}
+
+/*
+ * Walk the TFFS once and remember where each entry is, so the lookups
+ * do not have to scan the whole buffer again.
+ */
+static int build_index(uint8_t *buffer)
 {
-	uint32_t pos = 0;
+	struct tffs_entry entry;
+	struct tffs_index_entry *tmp;
+	uint32_t pos = 0, size = 0;
 
 	do {
-		parse_entry(buffer, pos, entry);
+		parse_entry(buffer, pos, &entry);
+
+		if (tffs_index.size == size) {
+			size = size ? size * 2 : 64;
+			tmp = realloc(tffs_index.entries, sizeof(*tmp) * size);
+			if (!tmp)
+				return 0;
+			tffs_index.entries = tmp;
+		}
 
-		if (get_header_id(entry->header) == id)
-			return 1;
+		tffs_index.entries[tffs_index.size].id =
+			get_header_id(entry.header);
+		tffs_index.entries[tffs_index.size++].pos = pos;
 
 		pos += sizeof(struct tffs_entry_header);
-		pos += get_walk_size(get_header_len(entry->header));
-	} while (pos < tffs_size && entry->header->id != TFFS_ID_END);
+		pos += get_walk_size(get_header_len(entry.header));
+	} while (pos < tffs_size && entry.header->id != TFFS_ID_END);
+
+	qsort(tffs_index.entries, tffs_index.size, sizeof(*tffs_index.entries),
+	      compare_index_entries);
 
-	return 0;
+	return 1;
+}
+
+static int find_entry(uint8_t *buffer, uint16_t id, struct tffs_entry *entry)
+{
+	uint32_t lo = 0, hi = tffs_index.size, mid;
+
+	/* the first entry with this id, like a linear walk would find it */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tffs_index.entries[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == tffs_index.size || tffs_index.entries[lo].id != id)
+		return 0;
+
+	parse_entry(buffer, tffs_index.entries[lo].pos, entry);
+	return 1;
 }
 
 static void parse_key_names(struct tffs_entry *names_entry,
@@ -194,7 +257,8 @@ static int show_all_key_value_pairs(uint8_t *buffer,
 }
 
 static int show_matching_key_value(uint8_t *buffer,
-				   struct tffs_key_name_table *key_names)
+				   struct tffs_key_name_table *key_names,
+				   const char *filter)
 {
 	int i;
 	uint16_t id;
@@ -204,7 +268,7 @@ static int show_matching_key_value(uint8_t *buffer,
 	for (i = 0; i < key_names->size; i++) {
 		name = key_names->entries[i].val;
 
-		if (strncmp(name, name_filter, strlen(name)) == 0) {
+		if (strncmp(name, filter, strlen(name)) == 0) {
 			id = to_entry_header_id(*key_names->entries[i].id);
 
 			if (find_entry(buffer, id, &tmp)) {
@@ -220,7 +284,7 @@ static int show_matching_key_value(uint8_t *buffer,
 		}
 	}
 
-	fprintf(stderr, "ERROR: Unknown key name %s!\n", name_filter);
+	fprintf(stderr, "ERROR: Unknown key name %s!\n", filter);
 	return EXIT_FAILURE;
 }
 
@@ -237,7 +301,8 @@ static void usage(int status)
 	"  -h              show this screen\n"
 	"  -i <file>       inspect the given TFFS file/device <file>\n"
 	"  -l              list all supported keys\n"
-	"  -n <key name>   display the value of the given key\n"
+	"  -n <key name>   display the value of the given key, can be given\n"
+	"                  several times to display one value per line\n"
 	"  -s <size>       the (max) size of the TFFS file/device <size>\n"
 	);
 
@@ -264,7 +329,7 @@ static void parse_options(int argc, char *argv[])
 		switch (c) {
 			case 'a':
 				show_all = true;
-				name_filter = NULL;
+				num_name_filters = 0;
 				print_all_key_names = false;
 				break;
 			case 'b':
@@ -279,10 +344,15 @@ static void parse_options(int argc, char *argv[])
 			case 'l':
 				print_all_key_names = true;
 				show_all = false;
-				name_filter = NULL;
+				num_name_filters = 0;
 				break;
 			case 'n':
-				name_filter = optarg;
+				if (num_name_filters == MAX_NAME_FILTERS) {
+					fprintf(stderr,
+						"ERROR: too many key names!\n");
+					exit(EXIT_FAILURE);
+				}
+				name_filter[num_name_filters++] = optarg;
 				show_all = false;
 				print_all_key_names = false;
 				break;
@@ -305,7 +375,7 @@ static void parse_options(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if (!show_all && !name_filter && !print_all_key_names) {
+	if (!show_all && !num_name_filters && !print_all_key_names) {
 		fprintf(stderr,
 			"ERROR: either -l, -a or -n <key name> is required!\n");
 		exit(EXIT_FAILURE);
@@ -319,6 +389,7 @@ int main(int argc, char *argv[])
 	FILE *fp;
 	struct tffs_entry name_table;
 	struct tffs_key_name_table key_names;
+	int i;
 
 	progname = basename(argv[0]);
 
@@ -346,6 +417,11 @@ int main(int argc, char *argv[])
 		goto out_free;
 	}
 
+	if (!build_index(buffer)) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		goto out_free;
+	}
+
 	if (!find_entry(buffer, TFFS_ID_TABLE_NAME, &name_table)) {
 		fprintf(stderr,"ERROR: No name table found in tffs file %s\n",
 			input_file);
@@ -366,7 +442,12 @@ int main(int argc, char *argv[])
 	} else if (show_all) {
 		ret = show_all_key_value_pairs(buffer, &key_names);
 	} else {
-		ret = show_matching_key_value(buffer, &key_names);
+		for (i = 0; i < num_name_filters; i++) {
+			ret = show_matching_key_value(buffer, &key_names,
+						      name_filter[i]);
+			if (ret != EXIT_SUCCESS)
+				break;
+		}
 	}
 
 out_free_names:
@@ -374,6 +455,7 @@ out_free_names:
 out_free:
 	fclose(fp);
 	free(buffer);
+	free(tffs_index.entries);
 out:
 	return ret;
 }
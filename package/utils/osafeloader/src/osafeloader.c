@@ -131,28 +131,88 @@ out:
  * Extract
  **************************************************/
 
-static void osafeloader_extract_parse_options(int argc, char **argv) {
+#define MAX_PARTITIONS		8
+
+struct partition {
+	char *name;
+	char *out_path;
+	FILE *out;
+	int base;
+	int size;
+};
+
+static struct partition partitions[MAX_PARTITIONS];
+static int num_partitions;
+
+static int osafeloader_extract_parse_options(int argc, char **argv) {
 	int c;
 
 	while ((c = getopt(argc, argv, "p:o:")) != -1) {
 		switch (c) {
 		case 'p':
-			partition_name = optarg;
+			if (num_partitions == MAX_PARTITIONS) {
+				fprintf(stderr, "Too many partitions, up to %d can be extracted at once\n", MAX_PARTITIONS);
+				return -EINVAL;
+			}
+			partitions[num_partitions++].name = optarg;
 			break;
 		case 'o':
-			out_path = optarg;
+			if (!num_partitions || partitions[num_partitions - 1].out_path) {
+				fprintf(stderr, "Output file %s doesn't follow a partition name\n", optarg);
+				return -EINVAL;
+			}
+			partitions[num_partitions - 1].out_path = optarg;
 			break;
 		}
 	}
+
+	return 0;
 }
 
+/* Partition table starts right after the vendor info, in the first block */
+static int osafeloader_extract_table(uint8_t *buf, size_t bytes) {
+	char *table, *line;
+	char name[32];
+	int base, size, i;
+
+	if (bytes <= 0x1000)
+		return -EIO;
+
+	table = strndup((char *)buf + 0x1000, bytes - 0x1000);
+	if (!table)
+		return -ENOMEM;
+
+	for (line = table; line && *line; line = strchr(line, '\n')) {
+		line += strspn(line, " \t\r\n");
+		if (sscanf(line, "fwup-ptn %31s base 0x%x size 0x%x", name, &base, &size) != 3)
+			break;
+
+		for (i = 0; i < num_partitions; i++) {
+			if (strcmp(partitions[i].name, name))
+				continue;
+			partitions[i].base = 0x1000 + base;
+			partitions[i].size = size;
+		}
+	}
+
+	free(table);
+
+	return 0;
+}
+
+/*
+ * Everything is done in one pass over the image: partitions are written
+ * as their data goes by while the MD5 of the whole image is computed.
+ * Output files are removed again if the MD5 turns out to be wrong.
+ */
 static int osafeloader_extract(int argc, char **argv) {
+	static uint8_t buf[65536];
 	FILE *safeloader;
-	FILE *out;
 	struct safeloader_header hdr;
-	size_t bytes;
-	char name[32];
-	int base, size;
+	MD5_CTX ctx;
+	size_t bytes, payload, offset = 0, end = 0;
+	uint8_t md5[16];
+	int i;
 	int err = 0;
 
 	if (argc < 3) {
@@ -163,73 +223,129 @@ static int osafeloader_extract(int argc, char **argv) {
 	safeloader_path = argv[2];
 
 	optind = 3;
-	osafeloader_extract_parse_options(argc, argv);
-	if (!partition_name) {
-		fprintf(stderr, "No partition name specified\n");
-		err = -EINVAL;
+	err = osafeloader_extract_parse_options(argc, argv);
+	if (err)
 		goto out;
-	} else if (!out_path) {
-		fprintf(stderr, "No output file specified\n");
+	if (!num_partitions) {
+		fprintf(stderr, "No partition name specified\n");
 		err = -EINVAL;
 		goto out;
 	}
+	for (i = 0; i < num_partitions; i++) {
+		if (!partitions[i].out_path) {
+			fprintf(stderr, "No output file specified for %s\n", partitions[i].name);
+			err = -EINVAL;
+			goto out;
+		}
+	}
 
-	safeloader = fopen(safeloader_path, "r");
+	if (!strcmp(safeloader_path, "-"))
+		safeloader = stdin;
+	else
+		safeloader = fopen(safeloader_path, "r");
 	if (!safeloader) {
 		fprintf(stderr, "Couldn't open %s\n", safeloader_path);
 		err = -EACCES;
 		goto out;
 	}
 
-	out = fopen(out_path, "w");
-	if (!out) {
-		fprintf(stderr, "Couldn't open %s\n", out_path);
-		err = -EACCES;
-		goto err_close_safeloader;
-	}
-
 	bytes = fread(&hdr, 1, sizeof(hdr), safeloader);
 	if (bytes != sizeof(hdr)) {
 		fprintf(stderr, "Couldn't read %s header\n", safeloader_path);
 		err =  -EIO;
-		goto err_close_out;
+		goto err_close_safeloader;
 	}
 
-	/* Skip vendor info */
-	fseek(safeloader, 0x1000, SEEK_CUR);
+	/* imagesize counts the header, offsets below are relative to its end */
+	payload = be32_to_cpu(hdr.imagesize);
+	if (payload < sizeof(hdr)) {
+		fprintf(stderr, "Invalid %s image size %zu\n", safeloader_path, payload);
+		err = -EIO;
+		goto err_close_safeloader;
+	}
+	payload -= sizeof(hdr);
 
-	err = -ENOENT;
-	while (fscanf(safeloader, "fwup-ptn %s base 0x%x size 0x%x\t\r\n", name, &base, &size) == 3) {
-		uint8_t buf[1024];
+	bytes = fread(buf, 1, sizeof(buf), safeloader);
+	err = osafeloader_extract_table(buf, bytes);
+	if (err) {
+		fprintf(stderr, "Couldn't read %s partition table\n", safeloader_path);
+		goto err_close_safeloader;
+	}
 
-		if (strcmp(name, partition_name))
-			continue;
+	for (i = 0; i < num_partitions; i++) {
+		struct partition *p = &partitions[i];
 
-		err = 0;
+		if (!p->size) {
+			fprintf(stderr, "Couldn't find partition %s in %s\n", p->name, safeloader_path);
+			err = -ENOENT;
+			goto err_close_out;
+		}
 
-		fseek(safeloader, sizeof(hdr) + 0x1000 + base, SEEK_SET);
+		p->out = fopen(p->out_path, "w");
+		if (!p->out) {
+			fprintf(stderr, "Couldn't open %s\n", p->out_path);
+			err = -EACCES;
+			goto err_close_out;
+		}
 
-		while ((bytes = fread(buf, 1, osafeloader_min(sizeof(buf), size), safeloader)) > 0) {
-			if (fwrite(buf, 1, bytes, out) != bytes) {
-				fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, out_path);
+		if (p->base + p->size > end)
+			end = p->base + p->size;
+	}
+	if (payload > end)
+		end = payload;
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, md5_salt, sizeof(md5_salt));
+	while (bytes > 0) {
+		if (offset < payload)
+			MD5_Update(&ctx, buf, osafeloader_min(bytes, payload - offset));
+
+		for (i = 0; i < num_partitions; i++) {
+			struct partition *p = &partitions[i];
+			size_t from, to;
+
+			from = p->base > offset ? p->base : offset;
+			to = osafeloader_min(p->base + p->size, offset + bytes);
+			if (from >= to)
+				continue;
+
+			if (fwrite(buf + from - offset, 1, to - from, p->out) != to - from) {
+				fprintf(stderr, "Couldn't write %zu B to %s\n", to - from, p->out_path);
 				err = -EIO;
-				break;
+				goto err_close_out;
 			}
-			size -= bytes;
 		}
 
-		if (size) {
-			fprintf(stderr, "Couldn't extract whole partition %s from %s (%d B left)\n", partition_name, safeloader_path, size);
-			err = -EIO;
-		}
+		offset += bytes;
+		if (offset >= end)
+			break;
+		bytes = fread(buf, 1, osafeloader_min(sizeof(buf), end - offset), safeloader);
+	}
 
-		break;
+	if (offset < end) {
+		fprintf(stderr, "Couldn't read last %zu B of %s\n", end - offset, safeloader_path);
+		err = -EIO;
+		goto err_close_out;
+	}
+
+	MD5_Final(md5, &ctx);
+	if (memcmp(md5, hdr.md5, 16)) {
+		fprintf(stderr, "Broken SafeLoader file with invalid MD5\n");
+		err =  -EIO;
+		goto err_close_out;
 	}
 
 err_close_out:
-	fclose(out);
+	for (i = 0; i < num_partitions; i++) {
+		if (!partitions[i].out)
+			continue;
+		fclose(partitions[i].out);
+		if (err)
+			unlink(partitions[i].out_path);
+	}
 err_close_safeloader:
-	fclose(safeloader);
+	if (safeloader != stdin)
+		fclose(safeloader);
 out:
 	return err;
 }
@@ -245,9 +361,10 @@ static void usage() {
 	printf("\tosafeloader info <file>\n");
 	printf("\n");
 	printf("Extract from SafeLoader:\n");
-	printf("\tosafeloader extract <file> [options]\n");
+	printf("\tosafeloader extract <file> [options]\t(\"-\" for stdin)\n");
 	printf("\t-p name\t\t\t\tname of partition to extract\n");
-	printf("\t-o file\t\t\t\toutput file\n");
+	printf("\t-o file\t\t\t\toutput file for the partition named before\n");
+	printf("\t\t\t\t\t(-p and -o may be repeated)\n");
 }
 
 int main(int argc, char **argv) {
@@ -75,6 +75,16 @@
 	(*(MD5_u32plus *)&ptr[(n) * 4])
 #define GET(n) \
 	SET(n)
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+	__SIZEOF_INT__ == 4
+/*
+ * Other little-endian CPUs (ARM, MIPSEL): memcpy compiles to a plain or
+ * unaligned-safe word load instead of four byte loads and shifts.
+ */
+#define SET(n) \
+	(memcpy(&ctx->block[(n)], &ptr[(n) * 4], 4), ctx->block[(n)])
+#define GET(n) \
+	(ctx->block[(n)])
 #else
 #define SET(n) \
 	(ctx->block[(n)] = \
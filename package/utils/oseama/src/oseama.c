@@ -217,23 +217,64 @@ out:
 	return err;
 }
 
+/**************************************************
+ * Helpers
+ **************************************************/
+
+static uint8_t buf[65536];
+
+static FILE *oseama_open(const char *path, const char *mode) {
+	if (!strcmp(path, "-"))
+		return *mode == 'r' ? stdin : stdout;
+
+	return fopen(path, mode);
+}
+
+static void oseama_close(FILE *f) {
+	if (f != stdin && f != stdout)
+		fclose(f);
+	else
+		fflush(f);
+}
+
+/* Skip forward, also on pipes where fseek doesn't work */
+static int oseama_skip(FILE *f, size_t length) {
+	size_t bytes;
+
+	if (!fseek(f, length, SEEK_CUR))
+		return 0;
+
+	while (length) {
+		bytes = fread(buf, 1, oseama_min(sizeof(buf), length), f);
+		if (!bytes)
+			return -EIO;
+		length -= bytes;
+	}
+
+	return 0;
+}
+
 /**************************************************
  * Create
  **************************************************/
 
-static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path) {
+/*
+ * Data is hashed as it's written, so the entity is never read back.
+ * Only the header gets rewritten once the MD5 is known.
+ */
+static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path, MD5_CTX *ctx) {
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[128];
 
-	in = fopen(in_path, "r");
+	in = oseama_open(in_path, "r");
 	if (!in) {
 		fprintf(stderr, "Couldn't open %s\n", in_path);
 		return -EACCES;
 	}
 
 	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
+		MD5_Update(ctx, buf, bytes);
 		if (fwrite(buf, 1, bytes, seama) != bytes) {
 			fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, seama_path);
 			length = -EIO;
@@ -242,22 +283,25 @@ static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path) {
 		length += bytes;
 	}
 
-	fclose(in);
+	oseama_close(in);
 
 	return length;
 }
 
-static ssize_t oseama_entity_append_zeros(FILE *seama, size_t length) {
-	uint8_t *buf;
-
-	buf = malloc(length);
-	if (!buf)
-		return -ENOMEM;
-	memset(buf, 0, length);
+static ssize_t oseama_entity_append_zeros(FILE *seama, size_t length, MD5_CTX *ctx) {
+	static const uint8_t zeros[4096];
+	size_t left = length;
+	size_t bytes;
 
-	if (fwrite(buf, 1, length, seama) != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, seama_path);
-		return -EIO;
+	while (left) {
+		bytes = oseama_min(sizeof(zeros), left);
+		if (ctx)
+			MD5_Update(ctx, zeros, bytes);
+		if (fwrite(zeros, 1, bytes, seama) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, seama_path);
+			return -EIO;
+		}
+		left -= bytes;
 	}
 
 	return length;
@@ -267,26 +311,17 @@ static ssize_t oseama_entity_align(FILE *seama, size_t curr_offset, size_t align
 	if (curr_offset & (alignment - 1)) {
 		size_t length = alignment - (curr_offset % alignment);
 
-		return oseama_entity_append_zeros(seama, length);
+		return oseama_entity_append_zeros(seama, length, NULL);
 	}
 
 	return 0;
 }
 
-static int oseama_entity_write_hdr(FILE *seama, size_t metasize, size_t imagesize) {
+static int oseama_entity_write_hdr(FILE *seama, size_t metasize, size_t imagesize, MD5_CTX *ctx) {
 	struct seama_entity_header hdr = {};
-	uint8_t buf[128];
-	size_t length = imagesize;
 	size_t bytes;
-	MD5_CTX ctx;
 
-	fseek(seama, sizeof(hdr) + metasize, SEEK_SET);
-	MD5_Init(&ctx);
-	while ((bytes = fread(buf, 1, oseama_min(sizeof(buf), length), seama)) > 0) {
-		MD5_Update(&ctx, buf, bytes);
-		length -= bytes;
-	}
-	MD5_Final(hdr.md5, &ctx);
+	MD5_Final(hdr.md5, ctx);
 
 	hdr.magic = cpu_to_be32(SEAMA_MAGIC);
 	hdr.metasize = cpu_to_be16(metasize);
@@ -307,6 +342,7 @@ static int oseama_entity(int argc, char **argv) {
 	ssize_t sbytes;
 	size_t curr_offset = sizeof(struct seama_entity_header);
 	size_t metasize = 0, imagesize = 0;
+	MD5_CTX ctx;
 	int c;
 	int err = 0;
 
@@ -317,7 +353,7 @@ static int oseama_entity(int argc, char **argv) {
 	}
 	seama_path = argv[2];
 
-	seama = fopen(seama_path, "w+");
+	seama = fopen(seama_path, "w");
 	if (!seama) {
 		fprintf(stderr, "Couldn't open %s\n", seama_path);
 		err = -EACCES;
@@ -352,13 +388,15 @@ static int oseama_entity(int argc, char **argv) {
 		}
 	}
 
+	MD5_Init(&ctx);
+
 	optind = 3;
 	while ((c = getopt(argc, argv, "m:f:b:")) != -1) {
 		switch (c) {
 		case 'm':
 			break;
 		case 'f':
-			sbytes = oseama_entity_append_file(seama, optarg);
+			sbytes = oseama_entity_append_file(seama, optarg, &ctx);
 			if (sbytes < 0) {
 				fprintf(stderr, "Failed to append file %s\n", optarg);
 			} else {
@@ -371,7 +409,7 @@ static int oseama_entity(int argc, char **argv) {
 			if (sbytes < 0) {
 				fprintf(stderr, "Current Seama entity length is 0x%zx, can't pad it with zeros to 0x%lx\n", curr_offset, strtol(optarg, NULL, 0));
 			} else {
-				sbytes = oseama_entity_append_zeros(seama, sbytes);
+				sbytes = oseama_entity_append_zeros(seama, sbytes, &ctx);
 				if (sbytes < 0) {
 					fprintf(stderr, "Failed to append zeros\n");
 				} else {
@@ -385,7 +423,7 @@ static int oseama_entity(int argc, char **argv) {
 			break;
 	}
 
-	oseama_entity_write_hdr(seama, metasize, imagesize);
+	oseama_entity_write_hdr(seama, metasize, imagesize, &ctx);
 
 	fclose(seama);
 out:
@@ -411,12 +449,14 @@ static void oseama_extract_parse_options(int argc, char **argv) {
 	}
 }
 
+/* Copy the entity and check its MD5 on the way, without a second read */
 static int oseama_extract_entity(FILE *seama, FILE *out) {
 	struct seama_entity_header hdr;
 	size_t bytes, metasize, imagesize, length;
-	uint8_t buf[1024];
+	uint8_t md5[16];
+	MD5_CTX ctx;
 	int i = 0;
-	int err = 0;
+	int err = -ENOENT;
 
 	while ((bytes = fread(&hdr, 1, sizeof(hdr), seama)) == sizeof(hdr)) {
 		if (be32_to_cpu(hdr.magic) != SEAMA_MAGIC) {
@@ -428,15 +468,29 @@ static int oseama_extract_entity(FILE *seama, FILE *out) {
 		imagesize = be32_to_cpu(hdr.imagesize);
 
 		if (i != entity_idx) {
-			fseek(seama, metasize + imagesize, SEEK_CUR);
+			if (oseama_skip(seama, metasize + imagesize)) {
+				fprintf(stderr, "Couldn't find entity %d in %s\n", entity_idx, seama_path);
+				err = -EIO;
+				break;
+			}
 			i++;
 			continue;
 		}
 
-		fseek(seama, -sizeof(hdr), SEEK_CUR);
+		err = 0;
+		if (fwrite(&hdr, 1, sizeof(hdr), out) != sizeof(hdr)) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", sizeof(hdr), out_path);
+			err = -EIO;
+			break;
+		}
 
-		length = sizeof(hdr) + metasize + imagesize;
+		MD5_Init(&ctx);
+		length = metasize + imagesize;
 		while ((bytes = fread(buf, 1, oseama_min(sizeof(buf), length), seama)) > 0) {
+			size_t meta = length > imagesize ? oseama_min(bytes, length - imagesize) : 0;
+
+			if (meta < bytes)
+				MD5_Update(&ctx, buf + meta, bytes - meta);
 			if (fwrite(buf, 1, bytes, out) != bytes) {
 				fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, out_path);
 				err = -EIO;
@@ -444,6 +498,7 @@ static int oseama_extract_entity(FILE *seama, FILE *out) {
 			}
 			length -= bytes;
 		}
+		MD5_Final(md5, &ctx);
 
 		if (length) {
 			fprintf(stderr, "Couldn't extract whole entity %d from %s (%zu B left)\n", entity_idx, seama_path, length);
@@ -451,9 +506,17 @@ static int oseama_extract_entity(FILE *seama, FILE *out) {
 			break;
 		}
 
+		if (memcmp(md5, hdr.md5, sizeof(md5))) {
+			fprintf(stderr, "Entity %d of %s has invalid MD5\n", entity_idx, seama_path);
+			err = -EINVAL;
+		}
+
 		break;
 	}
 
+	if (err == -ENOENT)
+		fprintf(stderr, "Couldn't find entity %d in %s\n", entity_idx, seama_path);
+
 	return err;
 }
 
@@ -484,14 +547,14 @@ static int oseama_extract(int argc, char **argv) {
 		goto out;
 	}
 
-	seama = fopen(seama_path, "r");
+	seama = oseama_open(seama_path, "r");
 	if (!seama) {
 		fprintf(stderr, "Couldn't open %s\n", seama_path);
 		err = -EACCES;
 		goto out;
 	}
 
-	out = fopen(out_path, "w");
+	out = oseama_open(out_path, "w");
 	if (!out) {
 		fprintf(stderr, "Couldn't open %s\n", out_path);
 		err = -EACCES;
@@ -506,14 +569,16 @@ static int oseama_extract(int argc, char **argv) {
 	}
 	metasize = be16_to_cpu(hdr.metasize);
 
-	fseek(seama, metasize, SEEK_CUR);
-
-	oseama_extract_entity(seama, out);
+	err = oseama_skip(seama, metasize);
+	if (!err)
+		err = oseama_extract_entity(seama, out);
 
 err_close_out:
-	fclose(out);
+	oseama_close(out);
+	if (err && out != stdout)
+		unlink(out_path);
 err_close_seama:
-	fclose(seama);
+	oseama_close(seama);
 out:
 	return err;
 }
@@ -532,13 +597,13 @@ static void usage() {
 	printf("Create Seama entity:\n");
 	printf("\toseama entity <file> [options]\n");
 	printf("\t-m meta\t\t\t\tmeta into to put in header\n");
-	printf("\t-f file\t\t\t\tappend content from file\n");
+	printf("\t-f file\t\t\t\tappend content from file (\"-\" for stdin)\n");
 	printf("\t-b offset\t\t\tappend zeros till reaching absolute offset\n");
 	printf("\n");
 	printf("Extract from Seama seal (container):\n");
-	printf("\toseama extract <file> [options]\n");
+	printf("\toseama extract <file> [options]\t(\"-\" for stdin)\n");
 	printf("\t-e\t\t\t\tindex of entity to extract\n");
-	printf("\t-o file\t\t\t\toutput file\n");
+	printf("\t-o file\t\t\t\toutput file (\"-\" for stdout)\n");
 }
 
 int main(int argc, char **argv) {
@@ -9,9 +9,12 @@
  * any later version.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <byteswap.h>
 #include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -124,7 +127,53 @@ static const uint32_t crc32_tbl[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
 };
 
+/* crc32_tbl8[k][i] is the CRC of byte i followed by k zero bytes */
+static uint32_t crc32_tbl8[8][256];
+
+static void otrx_crc32_init(void) {
+	uint32_t crc;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32_tbl[i];
+		crc32_tbl8[0][i] = crc;
+		for (k = 1; k < 8; k++) {
+			crc = crc32_tbl[crc & 0xff] ^ (crc >> 8);
+			crc32_tbl8[k][i] = crc;
+		}
+	}
+}
+
+/* Slicing-by-8, eight table lookups per 64 bits instead of per byte */
 uint32_t otrx_crc32(uint32_t crc, uint8_t *buf, size_t len) {
+	uint32_t lo, hi;
+
+	if (!crc32_tbl8[1][1])
+		otrx_crc32_init();
+
+	while (len && ((uintptr_t)buf & 3)) {
+		crc = crc32_tbl[(crc ^ *buf) & 0xff] ^ (crc >> 8);
+		buf++;
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&lo, buf, 4);
+		memcpy(&hi, buf + 4, 4);
+		lo = le32_to_cpu(lo) ^ crc;
+		hi = le32_to_cpu(hi);
+		crc = crc32_tbl8[7][lo & 0xff] ^
+		      crc32_tbl8[6][(lo >> 8) & 0xff] ^
+		      crc32_tbl8[5][(lo >> 16) & 0xff] ^
+		      crc32_tbl8[4][lo >> 24] ^
+		      crc32_tbl8[3][hi & 0xff] ^
+		      crc32_tbl8[2][(hi >> 8) & 0xff] ^
+		      crc32_tbl8[1][(hi >> 16) & 0xff] ^
+		      crc32_tbl8[0][hi >> 24];
+		buf += 8;
+		len -= 8;
+	}
+
 	while (len) {
 		crc = crc32_tbl[(crc ^ *buf) & 0xff] ^ (crc >> 8);
 		buf++;
@@ -134,6 +183,127 @@ uint32_t otrx_crc32(uint32_t crc, uint8_t *buf, size_t len) {
 	return crc;
 }
 
+/**************************************************
+ * Image access
+ **************************************************/
+
+struct otrx_img {
+	uint8_t *data;
+	size_t size;
+	int mapped;
+};
+
+/*
+ * Map the image read-only. Files that can't be mapped (pipes, some
+ * character devices) are read into memory instead.
+ */
+static int otrx_img_open(struct otrx_img *img, const char *path) {
+	struct stat st;
+	size_t size = 0;
+	ssize_t bytes;
+	uint8_t *data;
+	int fd;
+
+	memset(img, 0, sizeof(*img));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Couldn't open %s\n", path);
+		return -EACCES;
+	}
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			img->data = data;
+			img->size = st.st_size;
+			img->mapped = 1;
+			close(fd);
+			return 0;
+		}
+	}
+
+	do {
+		if (img->size == size) {
+			size = size ? size * 2 : 1024 * 1024;
+			data = realloc(img->data, size);
+			if (!data) {
+				fprintf(stderr, "Couldn't alloc %zu B buffer\n", size);
+				free(img->data);
+				close(fd);
+				return -ENOMEM;
+			}
+			img->data = data;
+		}
+
+		bytes = read(fd, img->data + img->size, size - img->size);
+		if (bytes > 0)
+			img->size += bytes;
+	} while (bytes > 0 || (bytes < 0 && errno == EINTR));
+
+	close(fd);
+
+	if (bytes < 0) {
+		fprintf(stderr, "Couldn't read %s\n", path);
+		free(img->data);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void otrx_img_close(struct otrx_img *img) {
+	if (img->mapped)
+		munmap(img->data, img->size);
+	else
+		free(img->data);
+}
+
+/* Copy the header at trx_offset and make sure the TRX fits in the file */
+static int otrx_img_hdr(struct otrx_img *img, struct trx_header *hdr) {
+	size_t length;
+
+	if (trx_offset > img->size || img->size - trx_offset < sizeof(*hdr)) {
+		fprintf(stderr, "Couldn't read %s header\n", trx_path);
+		return -EIO;
+	}
+	memcpy(hdr, img->data + trx_offset, sizeof(*hdr));
+
+	if (le32_to_cpu(hdr->magic) != TRX_MAGIC) {
+		fprintf(stderr, "Invalid TRX magic: 0x%08x\n", le32_to_cpu(hdr->magic));
+		return -EINVAL;
+	}
+
+	length = le32_to_cpu(hdr->length);
+	if (length < sizeof(*hdr)) {
+		fprintf(stderr, "Length read from TRX too low (%zu B)\n", length);
+		return -EINVAL;
+	}
+
+	if (length > img->size - trx_offset) {
+		fprintf(stderr, "Couldn't read last %zd B of data from %s\n",
+			length - (img->size - trx_offset), trx_path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int otrx_img_verify(struct otrx_img *img, struct trx_header *hdr) {
+	uint32_t crc32;
+
+	crc32 = otrx_crc32(0xffffffff, img->data + trx_offset + TRX_FLAGS_OFFSET,
+			   le32_to_cpu(hdr->length) - TRX_FLAGS_OFFSET);
+
+	if (crc32 != le32_to_cpu(hdr->crc32)) {
+		fprintf(stderr, "Invalid data crc32: 0x%08x instead of 0x%08x\n", crc32, le32_to_cpu(hdr->crc32));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 /**************************************************
  * Check
  **************************************************/
@@ -151,11 +321,8 @@ static void otrx_check_parse_options(int argc, char **argv) {
 }
 
 static int otrx_check(int argc, char **argv) {
-	FILE *trx;
+	struct otrx_img img;
 	struct trx_header hdr;
-	size_t bytes, length;
-	uint8_t buf[1024];
-	uint32_t crc32;
 	int err = 0;
 
 	if (argc < 3) {
@@ -168,58 +335,22 @@ static int otrx_check(int argc, char **argv) {
 	optind = 3;
 	otrx_check_parse_options(argc, argv);
 
-	trx = fopen(trx_path, "r");
-	if (!trx) {
-		fprintf(stderr, "Couldn't open %s\n", trx_path);
-		err = -EACCES;
+	err = otrx_img_open(&img, trx_path);
+	if (err)
 		goto out;
-	}
-
-	fseek(trx, trx_offset, SEEK_SET);
-	bytes = fread(&hdr, 1, sizeof(hdr), trx);
-	if (bytes != sizeof(hdr)) {
-		fprintf(stderr, "Couldn't read %s header\n", trx_path);
-		err =  -EIO;
-		goto err_close;
-	}
 
-	if (le32_to_cpu(hdr.magic) != TRX_MAGIC) {
-		fprintf(stderr, "Invalid TRX magic: 0x%08x\n", le32_to_cpu(hdr.magic));
-		err =  -EINVAL;
+	err = otrx_img_hdr(&img, &hdr);
+	if (err)
 		goto err_close;
-	}
-
-	length = le32_to_cpu(hdr.length);
-	if (length < sizeof(hdr)) {
-		fprintf(stderr, "Length read from TRX too low (%zu B)\n", length);
-		err = -EINVAL;
-		goto err_close;
-	}
-
-	crc32 = 0xffffffff;
-	fseek(trx, trx_offset + TRX_FLAGS_OFFSET, SEEK_SET);
-	length -= TRX_FLAGS_OFFSET;
-	while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), trx)) > 0) {
-		crc32 = otrx_crc32(crc32, buf, bytes);
-		length -= bytes;
-	}
 
-	if (length) {
-		fprintf(stderr, "Couldn't read last %zd B of data from %s\n", length, trx_path);
-		err = -EIO;
+	err = otrx_img_verify(&img, &hdr);
+	if (err)
 		goto err_close;
-	}
-
-	if (crc32 != le32_to_cpu(hdr.crc32)) {
-		fprintf(stderr, "Invalid data crc32: 0x%08x instead of 0x%08x\n", crc32, le32_to_cpu(hdr.crc32));
-		err =  -EINVAL;
-		goto err_close;
-	}
 
 	printf("Found a valid TRX version %d\n", le32_to_cpu(hdr.version));
 
 err_close:
-	fclose(trx);
+	otrx_img_close(&img);
 out:
 	return err;
 }
@@ -284,7 +415,7 @@ static ssize_t otrx_create_align(FILE *trx, size_t curr_offset, size_t alignment
 
 static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr) {
 	size_t bytes, length;
-	uint8_t buf[1024];
+	static uint8_t buf[65536];
 	uint32_t crc32;
 
 	hdr->magic = cpu_to_le32(TRX_MAGIC);
@@ -423,11 +554,17 @@ out:
  * Extract
  **************************************************/
 
+static int verify_crc;
+static FILE *msg;
+
 static void otrx_extract_parse_options(int argc, char **argv) {
 	int c;
 
-	while ((c = getopt(argc, argv, "c:e:o:1:2:3:")) != -1) {
+	while ((c = getopt(argc, argv, "ce:o:1:2:3:")) != -1) {
 		switch (c) {
+		case 'c':
+			verify_crc = 1;
+			break;
 		case 'o':
 			trx_offset = atoi(optarg);
 			break;
@@ -444,55 +581,49 @@ static void otrx_extract_parse_options(int argc, char **argv) {
 	}
 }
 
-static int otrx_extract_copy(FILE *trx, size_t offset, size_t length, char *out_path) {
-	FILE *out;
-	size_t bytes;
-	uint8_t *buf;
+/* Write straight from the image, out_path may be "-", a pipe or a device */
+static int otrx_extract_copy(uint8_t *data, size_t length, char *out_path) {
+	size_t left = length;
+	ssize_t bytes;
+	int out;
 	int err = 0;
 
-	out = fopen(out_path, "w");
-	if (!out) {
+	if (!strcmp(out_path, "-"))
+		out = STDOUT_FILENO;
+	else
+		out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
 		fprintf(stderr, "Couldn't open %s\n", out_path);
 		err = -EACCES;
 		goto out;
 	}
 
-	buf = malloc(length);
-	if (!buf) {
-		fprintf(stderr, "Couldn't alloc %zu B buffer\n", length);
-		err =  -ENOMEM;
-		goto err_close;
-	}
-
-	fseek(trx, offset, SEEK_SET);
-	bytes = fread(buf, 1, length, trx);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
-	};
-
-	bytes = fwrite(buf, 1, length, out);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
+	while (left) {
+		bytes = write(out, data, left);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes <= 0) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
+			err = -EIO;
+			goto err_close;
+		}
+		data += bytes;
+		left -= bytes;
 	}
 
-	printf("Extracted 0x%zx bytes into %s\n", length, out_path);
+	fprintf(msg, "Extracted 0x%zx bytes into %s\n", length, out_path);
 
-err_free_buf:
-	free(buf);
 err_close:
-	fclose(out);
+	if (out != STDOUT_FILENO)
+		close(out);
 out:
 	return err;
 }
 
 static int otrx_extract(int argc, char **argv) {
-	FILE *trx;
+	struct otrx_img img;
 	struct trx_header hdr;
-	size_t bytes;
+	size_t length, offset;
 	int i;
 	int err = 0;
 
@@ -506,47 +637,54 @@ static int otrx_extract(int argc, char **argv) {
 	optind = 3;
 	otrx_extract_parse_options(argc, argv);
 
-	trx = fopen(trx_path, "r");
-	if (!trx) {
-		fprintf(stderr, "Couldn't open %s\n", trx_path);
-		err = -EACCES;
+	/* Keep stdout clean when a partition is written to it */
+	msg = stdout;
+	for (i = 0; i < TRX_MAX_PARTS; i++)
+		if (partition[i] && !strcmp(partition[i], "-"))
+			msg = stderr;
+
+	err = otrx_img_open(&img, trx_path);
+	if (err)
 		goto out;
-	}
 
-	fseek(trx, trx_offset, SEEK_SET);
-	bytes = fread(&hdr, 1, sizeof(hdr), trx);
-	if (bytes != sizeof(hdr)) {
-		fprintf(stderr, "Couldn't read %s header\n", trx_path);
-		err =  -EIO;
+	err = otrx_img_hdr(&img, &hdr);
+	if (err)
 		goto err_close;
-	}
 
-	if (le32_to_cpu(hdr.magic) != TRX_MAGIC) {
-		fprintf(stderr, "Invalid TRX magic: 0x%08x\n", le32_to_cpu(hdr.magic));
-		err =  -EINVAL;
-		goto err_close;
+	/* Nothing gets written unless the whole image is intact */
+	if (verify_crc) {
+		err = otrx_img_verify(&img, &hdr);
+		if (err)
+			goto err_close;
 	}
 
 	for (i = 0; i < TRX_MAX_PARTS; i++) {
-		size_t length;
-
 		if (!partition[i])
 			continue;
 		if (!hdr.offset[i]) {
-			printf("TRX doesn't contain partition %d, can't extract %s\n", i + 1, partition[i]);
+			fprintf(msg, "TRX doesn't contain partition %d, can't extract %s\n", i + 1, partition[i]);
 			continue;
 		}
 
+		offset = le32_to_cpu(hdr.offset[i]);
 		if (i + 1 >= TRX_MAX_PARTS || !hdr.offset[i + 1])
-			length = le32_to_cpu(hdr.length) - le32_to_cpu(hdr.offset[i]);
+			length = le32_to_cpu(hdr.length) - offset;
 		else
-			length = le32_to_cpu(hdr.offset[i + 1]) - le32_to_cpu(hdr.offset[i]);
+			length = le32_to_cpu(hdr.offset[i + 1]) - offset;
 
-		otrx_extract_copy(trx, trx_offset + le32_to_cpu(hdr.offset[i]), length, partition[i]);
+		if (offset > le32_to_cpu(hdr.length) || length > le32_to_cpu(hdr.length) - offset) {
+			fprintf(stderr, "Partition %d exceeds TRX length\n", i + 1);
+			err = -EINVAL;
+			goto err_close;
+		}
+
+		err = otrx_extract_copy(img.data + trx_offset + offset, length, partition[i]);
+		if (err)
+			goto err_close;
 	}
 
 err_close:
-	fclose(trx);
+	otrx_img_close(&img);
 out:
 	return err;
 }
@@ -572,9 +710,11 @@ static void usage() {
 	printf("Extracting from TRX file:\n");
 	printf("\totrx extract <file> [options]\textract partitions from TRX file\n");
 	printf("\t-o offset\t\t\toffset of TRX data in file (default: 0)\n");
+	printf("\t-c\t\t\t\tverify data crc32 before extracting anything\n");
 	printf("\t-1 file\t\t\t\tfile to extract 1st partition to (optional)\n");
 	printf("\t-2 file\t\t\t\tfile to extract 2nd partition to (optional)\n");
 	printf("\t-3 file\t\t\t\tfile to extract 3rd partition to (optional)\n");
+	printf("\t\t\t\t\t(\"-\" writes the partition to stdout)\n");
 }
 
 int main(int argc, char **argv) {
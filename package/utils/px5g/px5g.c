@@ -19,7 +19,10 @@
  *  MA  02110-1301  USA
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
+#include <arpa/inet.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +38,9 @@
 #include <mbedtls/ecp.h>
 #include <mbedtls/rsa.h>
 #include <mbedtls/pk.h>
+#include <mbedtls/asn1write.h>
+#include <mbedtls/oid.h>
+#include <mbedtls/md.h>
 
 #define PX5G_VERSION "0.2"
 #define PX5G_COPY "Copyright (c) 2009 Steven Barth <steven@midlink.org>"
@@ -53,6 +59,7 @@ static void write_file(const char *path, int len, bool pem)
 {
 	FILE *f = stdout;
 	const char *buf_start = buf;
+	char tmp[PATH_MAX];
 
 	if (!pem)
 		buf_start += sizeof(buf) - len;
@@ -62,16 +69,29 @@ static void write_file(const char *path, int len, bool pem)
 		exit(1);
 	}
 
+	/* replace files atomically, a reader never sees a partial key */
+	if (path) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		f = fopen(tmp, "w");
+	}
+
 	if (!f) {
 		fprintf(stderr, "error: I/O error\n");
 		exit(1);
 	}
 
-	if (path)
-		f = fopen(path, "w");
-
-	fwrite(buf_start, 1, len, f);
+	if (fwrite(buf_start, 1, len, f) != len || fflush(f) ||
+	    (path && fsync(fileno(f)))) {
+		fprintf(stderr, "error: I/O error\n");
+		exit(1);
+	}
 	fclose(f);
+
+	if (path && rename(tmp, path)) {
+		fprintf(stderr, "error: I/O error\n");
+		unlink(tmp);
+		exit(1);
+	}
 }
 
 static mbedtls_ecp_group_id ecp_curve(const char *name)
@@ -126,6 +146,230 @@ static void gen_key(mbedtls_pk_context *key, bool rsa, int ksize, int exp,
 	exit(1);
 }
 
+/*
+ * Existing key to be reused instead of generating one. Unless any is set,
+ * it has to be of the requested type.
+ */
+static bool load_key(mbedtls_pk_context *key, const char *path, bool rsa,
+		     int ksize, mbedtls_ecp_group_id curve, bool any)
+{
+	mbedtls_pk_init(key);
+
+	if (!path || mbedtls_pk_parse_keyfile(key, path, NULL))
+		goto out;
+
+	if (any)
+		return true;
+
+	if (rsa && mbedtls_pk_get_type(key) == MBEDTLS_PK_RSA &&
+	    mbedtls_pk_get_bitlen(key) == ksize)
+		return true;
+
+	if (!rsa && mbedtls_pk_get_type(key) == MBEDTLS_PK_ECKEY &&
+	    mbedtls_pk_ec(*key)->grp.id == curve)
+		return true;
+
+out:
+	mbedtls_pk_free(key);
+	return false;
+}
+
+/* DER encoded GeneralNames from "DNS:name,IP:address,..." */
+static int san_der(const char *list, unsigned char *der, size_t size,
+		   unsigned char **start)
+{
+	char *names[32], *copy, *name;
+	unsigned char *p = der + size;
+	unsigned char addr[16];
+	int n = 0, len = 0, ret, alen;
+
+	copy = strdup(list);
+	for (name = strtok(copy, ","); name && n < 32; name = strtok(NULL, ","))
+		names[n++] = name;
+
+	while (n-- > 0) {
+		name = names[n];
+		if (!strncmp(name, "DNS:", 4)) {
+			name += 4;
+			ret = mbedtls_asn1_write_raw_buffer(&p, der,
+				(unsigned char *) name, strlen(name));
+			ret = (ret < 0) ? ret : ret + mbedtls_asn1_write_len(&p, der, ret);
+			ret = (ret < 0) ? ret : ret + mbedtls_asn1_write_tag(&p, der,
+				MBEDTLS_ASN1_CONTEXT_SPECIFIC | 2);
+		} else if (!strncmp(name, "IP:", 3)) {
+			name += 3;
+			if (inet_pton(AF_INET, name, addr) == 1)
+				alen = 4;
+			else if (inet_pton(AF_INET6, name, addr) == 1)
+				alen = 16;
+			else
+				goto err;
+
+			ret = mbedtls_asn1_write_raw_buffer(&p, der, addr, alen);
+			ret = (ret < 0) ? ret : ret + mbedtls_asn1_write_len(&p, der, ret);
+			ret = (ret < 0) ? ret : ret + mbedtls_asn1_write_tag(&p, der,
+				MBEDTLS_ASN1_CONTEXT_SPECIFIC | 7);
+		} else {
+			goto err;
+		}
+
+		if (ret < 0)
+			goto err;
+		len += ret;
+	}
+
+	ret = mbedtls_asn1_write_len(&p, der, len);
+	if (ret < 0)
+		goto err;
+	len += ret;
+
+	ret = mbedtls_asn1_write_tag(&p, der,
+		MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE);
+	if (ret < 0)
+		goto err;
+	len += ret;
+
+	free(copy);
+	*start = p;
+	return len;
+
+err:
+	fprintf(stderr, "error: invalid subjectAltName: %s\n", name);
+	free(copy);
+	return -1;
+}
+
+static time_t x509_time(const mbedtls_x509_time *t)
+{
+	struct tm tm = {
+		.tm_year = t->year - 1900,
+		.tm_mon = t->mon - 1,
+		.tm_mday = t->day,
+		.tm_hour = t->hour,
+		.tm_min = t->min,
+		.tm_sec = t->sec,
+	};
+
+	return timegm(&tm);
+}
+
+/*
+ * px5g stores the SHA-256 of each certificate it writes in <cert>.px5g.
+ * Only a certificate matching it is known to be ours, anything else was
+ * installed by the user and is left alone together with its key.
+ */
+static int cert_digest(const char *path, char *hex)
+{
+	unsigned char md[32];
+	int i;
+
+	if (mbedtls_md_file(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), path, md))
+		return -1;
+
+	for (i = 0; i < sizeof(md); i++)
+		sprintf(hex + 2 * i, "%02x", md[i]);
+
+	return 0;
+}
+
+static bool cert_owned(const char *path)
+{
+	char hex[65], stamp[65] = "", spath[PATH_MAX];
+	FILE *f;
+
+	snprintf(spath, sizeof(spath), "%s.px5g", path);
+	f = fopen(spath, "r");
+	if (!f)
+		return false;
+
+	if (!fgets(stamp, sizeof(stamp), f))
+		stamp[0] = 0;
+	fclose(f);
+
+	return !cert_digest(path, hex) && !strcmp(hex, stamp);
+}
+
+static void write_stamp(const char *path)
+{
+	char spath[PATH_MAX];
+
+	if (cert_digest(path, buf)) {
+		fprintf(stderr, "error: I/O error\n");
+		exit(1);
+	}
+
+	strcat(buf, "\n");
+	snprintf(spath, sizeof(spath), "%s.px5g", path);
+	write_file(spath, strlen(buf), true);
+}
+
+/*
+ * Check whether the certificate at path was issued for key with the same
+ * common name and subjectAltName and is valid for at least another month.
+ */
+static bool cert_current(const char *path, mbedtls_pk_context *key,
+			 const char *subject, const unsigned char *san, int san_len)
+{
+	static unsigned char pk1[1024], pk2[1024];
+	const mbedtls_x509_name *name;
+	const char *cn = NULL, *cn_end = NULL;
+	mbedtls_x509_crt crt;
+	bool ret = false;
+	int len1, len2;
+
+	mbedtls_x509_crt_init(&crt);
+	if (!path || mbedtls_x509_crt_parse_file(&crt, path))
+		goto out;
+
+	len1 = mbedtls_pk_write_pubkey_der(key, pk1, sizeof(pk1));
+	len2 = mbedtls_pk_write_pubkey_der(&crt.pk, pk2, sizeof(pk2));
+	if (len1 <= 0 || len1 != len2 ||
+	    memcmp(pk1 + sizeof(pk1) - len1, pk2 + sizeof(pk2) - len2, len1))
+		goto out;
+
+	if (x509_time(&crt.valid_to) < time(NULL) + 30 * 24 * 60 * 60)
+		goto out;
+
+	/* subject is in "C=..,CN=..," form here */
+	for (cn = subject; cn; cn = strchr(cn, ',')) {
+		if (*cn == ',')
+			cn++;
+		if (!strncmp(cn, "CN=", 3))
+			break;
+	}
+	if (cn) {
+		cn += 3;
+		cn_end = strchr(cn, ',');
+		if (!cn_end)
+			cn_end = cn + strlen(cn);
+	}
+
+	for (name = &crt.subject; name; name = name->next) {
+		if (MBEDTLS_OID_CMP(MBEDTLS_OID_AT_CN, &name->oid))
+			continue;
+
+		if (!cn || name->val.len != cn_end - cn ||
+		    memcmp(name->val.p, cn, cn_end - cn))
+			goto out;
+
+		cn = NULL;
+	}
+	if (cn)
+		goto out;
+
+	if (!(crt.ext_types & MBEDTLS_X509_EXT_SUBJECT_ALT_NAME) != !san_len)
+		goto out;
+
+	if (san_len && !memmem(crt.v3_ext.p, crt.v3_ext.len, san, san_len))
+		goto out;
+
+	ret = true;
+
+out:
+	mbedtls_x509_crt_free(&crt);
+	return ret;
+}
+
 int dokey(bool rsa, char **arg)
 {
 	mbedtls_pk_context key;
@@ -180,12 +424,26 @@ int selfsigned(char **arg)
 	time_t from = time(NULL), to;
 	char fstr[20], tstr[20], sstr[17];
 	int len;
-	bool rsa = true;
+	bool rsa = false;
+	bool cache = false, owned;
+	unsigned char san_buf[1024], *san = NULL;
+	int san_len = 0;
 	mbedtls_ecp_group_id curve = MBEDTLS_ECP_DP_SECP256R1;
 
 	while (*arg && **arg == '-') {
 		if (!strcmp(*arg, "-der")) {
 			pem = false;
+		} else if (!strcmp(*arg, "-cache")) {
+			cache = true;
+		} else if (!strcmp(*arg, "-addext") && arg[1]) {
+			if (strncmp(arg[1], "subjectAltName=", 15)) {
+				fprintf(stderr, "error: unsupported extension: %s\n", arg[1]);
+				return 1;
+			}
+			san_len = san_der(arg[1] + 15, san_buf, sizeof(san_buf), &san);
+			if (san_len < 0)
+				return 1;
+			arg++;
 		} else if (!strcmp(*arg, "-newkey") && arg[1]) {
 			if (!strncmp(arg[1], "rsa:", 4)) {
 				rsa = true;
@@ -247,10 +505,35 @@ int selfsigned(char **arg)
 		}
 		arg++;
 	}
-	gen_key(&key, rsa, ksize, exp, curve, pem);
+	if (cache && (!certpath || !keypath)) {
+		fprintf(stderr, "error: -cache needs -out and -keyout\n");
+		return 1;
+	}
+
+	owned = cache && cert_owned(certpath);
+	if (cache && !owned && !access(certpath, F_OK)) {
+		fprintf(stderr, "Keeping certificate %s, not issued by px5g\n", certpath);
+		return 0;
+	}
 
-	if (keypath)
-		write_key(&key, keypath, pem);
+	/* without a certificate of ours, a present key is the user's */
+	if (cache && load_key(&key, keypath, rsa, ksize, curve, !owned)) {
+		if (owned && cert_current(certpath, &key, subject, san, san_len)) {
+			fprintf(stderr, "Keeping current certificate %s\n", certpath);
+			mbedtls_pk_free(&key);
+			return 0;
+		}
+
+		fprintf(stderr, "Reusing private key %s\n", keypath);
+	} else if (cache && !owned && !access(keypath, F_OK)) {
+		fprintf(stderr, "error: can not use private key %s\n", keypath);
+		return 1;
+	} else {
+		gen_key(&key, rsa, ksize, exp, curve, pem);
+
+		if (keypath)
+			write_key(&key, keypath, pem);
+	}
 
 	from = (from < 1000000000) ? 1000000000 : from;
 	strftime(fstr, sizeof(fstr), "%Y%m%d%H%M%S", gmtime(&from));
@@ -272,6 +555,9 @@ int selfsigned(char **arg)
 	mbedtls_x509write_crt_set_basic_constraints(&cert, 0, -1);
 	mbedtls_x509write_crt_set_subject_key_identifier(&cert);
 	mbedtls_x509write_crt_set_authority_key_identifier(&cert);
+	if (san_len)
+		mbedtls_x509write_crt_set_extension(&cert, MBEDTLS_OID_SUBJECT_ALT_NAME,
+			MBEDTLS_OID_SIZE(MBEDTLS_OID_SUBJECT_ALT_NAME), 0, san, san_len);
 
 	_urandom(NULL, (void *) buf, 8);
 	for (len = 0; len < 8; len++)
@@ -296,6 +582,8 @@ int selfsigned(char **arg)
 		}
 	}
 	write_file(certpath, len, pem);
+	if (cache)
+		write_stamp(certpath);
 
 	mbedtls_x509write_crt_free(&cert);
 	mbedtls_mpi_free(&serial);
@@ -113,6 +113,7 @@ const char *str_get(struct gstr *gs);
 
 /* symbol.c */
 void sym_clear_all_valid(void);
+void sym_clear_valid(struct symbol *sym);
 struct symbol *sym_choice_default(struct symbol *sym);
 struct property *sym_get_range_prop(struct symbol *sym);
 const char *sym_get_string_default(struct symbol *sym);
@@ -450,6 +450,135 @@ void sym_clear_all_valid(void)
 	sym_calc_value(modules_sym);
 }
 
+static bool sym_dependents_valid;
+
+static void sym_add_dependent(struct symbol *sym, struct symbol *dep)
+{
+	int cnt = sym->dependents_cnt;
+
+	if (sym == dep || sym->flags & SYMBOL_CONST)
+		return;
+	if (cnt && sym->dependents[cnt - 1] == dep)
+		return;
+
+	/* grow the array whenever the count reaches a power of two */
+	if (!(cnt & (cnt - 1)))
+		sym->dependents = xrealloc(sym->dependents,
+					   (cnt ? cnt * 2 : 1) * sizeof(*sym->dependents));
+	sym->dependents[sym->dependents_cnt++] = dep;
+}
+
+static void expr_add_dependents(struct expr *e, struct symbol *dep)
+{
+	if (!e)
+		return;
+
+	switch (e->type) {
+	case E_OR:
+	case E_AND:
+		expr_add_dependents(e->left.expr, dep);
+		expr_add_dependents(e->right.expr, dep);
+		break;
+	case E_NOT:
+		expr_add_dependents(e->left.expr, dep);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_LTH:
+	case E_LEQ:
+	case E_GTH:
+	case E_GEQ:
+	case E_RANGE:
+		sym_add_dependent(e->left.sym, dep);
+		sym_add_dependent(e->right.sym, dep);
+		break;
+	case E_SYMBOL:
+		sym_add_dependent(e->left.sym, dep);
+		break;
+	case E_LIST:
+		sym_add_dependent(e->right.sym, dep);
+		expr_add_dependents(e->left.expr, dep);
+		break;
+	default:
+		;
+	}
+}
+
+/*
+ * Record for every symbol which symbols look at it when their value is
+ * calculated: everything referenced by their properties and their direct,
+ * reverse and implied dependencies. Selects and implies are skipped, the
+ * target symbol has them in its rev_dep and implied expressions.
+ */
+static void sym_calc_dependents(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym) {
+		for (prop = sym->prop; prop; prop = prop->next) {
+			if (prop->type == P_SELECT || prop->type == P_IMPLY)
+				continue;
+			expr_add_dependents(prop->expr, sym);
+			expr_add_dependents(prop->visible.expr, sym);
+		}
+		expr_add_dependents(sym->dir_dep.expr, sym);
+		expr_add_dependents(sym->rev_dep.expr, sym);
+		expr_add_dependents(sym->implied.expr, sym);
+	}
+
+	sym_dependents_valid = true;
+}
+
+/*
+ * Invalidate the value of sym and of all the symbols depending on it,
+ * directly or indirectly. Unlike sym_clear_all_valid() this leaves the
+ * rest of the values alone, so setting many symbols one after the other
+ * does not recalculate the whole configuration every time.
+ */
+void sym_clear_valid(struct symbol *sym)
+{
+	struct symbol **queue, *s;
+	int i, j, cnt = 0, size = 64;
+
+	/* the value of modules limits all tristate symbols */
+	if (sym == modules_sym) {
+		sym_clear_all_valid();
+		return;
+	}
+
+	if (!sym_dependents_valid)
+		sym_calc_dependents();
+
+	queue = xmalloc(size * sizeof(*queue));
+	queue[cnt++] = sym;
+	sym->flags |= SYMBOL_DIRTY;
+
+	for (i = 0; i < cnt; i++) {
+		s = queue[i];
+		s->flags &= ~SYMBOL_VALID;
+
+		for (j = 0; j < s->dependents_cnt; j++) {
+			if (s->dependents[j]->flags & SYMBOL_DIRTY)
+				continue;
+			if (cnt == size) {
+				size *= 2;
+				queue = xrealloc(queue, size * sizeof(*queue));
+			}
+			queue[cnt++] = s->dependents[j];
+			s->dependents[j]->flags |= SYMBOL_DIRTY;
+		}
+	}
+
+	for (i = 0; i < cnt; i++)
+		queue[i]->flags &= ~SYMBOL_DIRTY;
+	free(queue);
+
+	sym_add_change_count(1);
+	sym_calc_value(modules_sym);
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -502,7 +631,7 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_clear_valid(sym);
 
 	return true;
 }
@@ -659,7 +788,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_valid(sym);
 
 	return true;
 }
@@ -0,0 +1,79 @@
+#!/usr/bin/env perl
+#
+# Copyright (C) 2020 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Record how long the steps of the per-device image pipelines take and
+# print a per-device breakdown once all of them are done. The steps of
+# different devices run in parallel, so every step logs its wall clock
+# time to the scratch directory of its own device.
+#
+#   image-time.pl start <device dir> <step>
+#   image-time.pl stop <device dir> <step>
+#   image-time.pl report <tmp dir>
+#
+
+use strict;
+use warnings;
+use Time::HiRes qw(time);
+use File::Glob ':bsd_glob';
+use File::Path qw(make_path);
+
+my $cmd = shift @ARGV // '';
+
+sub stamp_file($$) {
+	my ($dir, $step) = @_;
+	$step =~ s/\//_/g;
+	return "$dir/.time-$step";
+}
+
+if ($cmd eq 'start' and @ARGV == 2) {
+	my ($dir, $step) = @ARGV;
+
+	make_path($dir);
+	open my $fh, '>', stamp_file($dir, $step) or die "Cannot write to $dir: $!\n";
+	printf $fh "%.6f\n", time();
+	close $fh;
+} elsif ($cmd eq 'stop' and @ARGV == 2) {
+	my ($dir, $step) = @ARGV;
+	my $file = stamp_file($dir, $step);
+
+	open my $fh, '<', $file or exit 0;
+	my $start = <$fh>;
+	close $fh;
+	unlink $file;
+
+	open $fh, '>>', "$dir/.times" or die "Cannot write to $dir: $!\n";
+	printf $fh "%s %.2f\n", $step, time() - $start;
+	close $fh;
+} elsif ($cmd eq 'report' and @ARGV == 1) {
+	my ($tmp) = @ARGV;
+	my @report;
+
+	foreach my $log (sort glob("$tmp/*/.times")) {
+		my ($device) = $log =~ m!([^/]+)/\.times$!;
+		my ($total, @steps) = (0);
+
+		open my $fh, '<', $log or next;
+		while (<$fh>) {
+			my ($step, $time) = split or next;
+			$total += $time;
+			push @steps, sprintf "%s %.2fs", $step, $time;
+		}
+		close $fh;
+
+		push @report, [ $device, $total, join(', ', @steps) ];
+	}
+
+	exit 0 unless @report;
+
+	print "Image build times per device:\n";
+	foreach my $line (sort { $b->[1] <=> $a->[1] or $a->[0] cmp $b->[0] } @report) {
+		printf "  %-40s %8.2fs  (%s)\n", @$line;
+	}
+} else {
+	die "Usage: $0 start|stop <device dir> <step>\n" .
+	    "       $0 report <tmp dir>\n";
+}
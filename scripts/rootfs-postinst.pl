@@ -0,0 +1,206 @@
+#!/usr/bin/env perl
+#
+# Copyright (C) 2020 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Run the package postinst scripts of a staged root filesystem and
+# enable or disable its init scripts, with the same result as calling
+# every postinst and "/etc/rc.common <script> enable" one by one.
+#
+# The generated postinst of most packages only calls default_postinst,
+# which offline does nothing but enable the init scripts listed in the
+# package file list. Those are handled here by reading START= and STOP=
+# from the init scripts and creating the rc.d links directly. Scripts
+# that need a shell - packages with their own postinst or required
+# users, init scripts with computed START/STOP values - are still run
+# through bash; the ones with required users share the passwd and group
+# files and run one after another, everything else runs in parallel.
+#
+
+use strict;
+use warnings;
+use Getopt::Std;
+use File::Glob ':bsd_glob';
+
+my %opts;
+getopts('j:', \%opts) && @ARGV >= 1 or die <<EOF;
+Usage: $0 [-j <jobs>] <rootdir> [<disabled service> ...]
+EOF
+
+my $jobs = $opts{j} || 1;
+my ($root, @disabled) = @ARGV;
+my %disabled = map { $_ => 1 } @disabled;
+my $info = "./usr/lib/opkg/info";
+my $shell = "bash";
+
+chdir $root or die "Cannot change to $root: $!\n";
+$ENV{IPKG_INSTROOT} = $root;
+$| = 1;
+
+my @postinst = sort glob("$info/*.postinst");
+my @initscripts = sort glob("./etc/init.d/*");
+my %header;
+
+sub read_file($) {
+	my $file = shift;
+	open my $fh, '<', $file or return undef;
+	local $/;
+	my $data = <$fh>;
+	close $fh;
+	return $data;
+}
+
+# START and STOP of an init script as rc.common would see them after
+# sourcing it, or undef when that is not obvious from the text alone
+sub init_header($) {
+	my $file = shift;
+
+	return $header{$file} if exists $header{$file};
+
+	my $data = read_file($file);
+	my $hdr;
+
+	if (defined $data and $data !~ /^\s*(?:function\s+)?(?:enable|disable)\s*\(\)/m) {
+		$hdr = {};
+		foreach my $var (qw(START STOP)) {
+			my @set = ($data =~ /(?<![\w\$])$var=/g);
+			next unless @set;
+			if (@set == 1 and $data =~ /^$var=(["']?)(\d+)\1[ \t]*(?:#.*)?$/m) {
+				$hdr->{$var} = $2;
+			} else {
+				$hdr = undef;
+				last;
+			}
+		}
+	}
+
+	return $header{$file} = $hdr;
+}
+
+sub rc_common($$) {
+	my ($file, $action) = @_;
+	system($shell, "./etc/rc.common", $file, $action);
+}
+
+sub enable($) {
+	my $file = shift;
+	my $name = $file;
+	$name =~ s/.*\///;
+
+	return unless -e $file;
+
+	my $hdr = init_header($file);
+	return rc_common($file, "enable") unless $hdr;
+
+	my %link = (S => $hdr->{START}, K => $hdr->{STOP});
+	foreach my $type (qw(S K)) {
+		next unless defined $link{$type};
+		(my $base = $name) =~ s/^$type\d\d//;
+		my $dest = "./etc/rc.d/$type$link{$type}$base";
+		unlink $dest;
+		symlink "../init.d/$name", $dest or warn "Cannot create $dest: $!\n";
+	}
+}
+
+sub disable($) {
+	my $name = shift;
+	$name =~ s/.*\///;
+	unlink glob("./etc/rc.d/S??\Q$name\E"), glob("./etc/rc.d/K??\Q$name\E");
+}
+
+# init scripts listed in the file list of a package, like default_postinst
+sub pkg_initscripts($) {
+	my $pkg = shift;
+	my @scripts;
+
+	open my $fh, '<', "$info/$pkg.list" or return ();
+	while (<$fh>) {
+		foreach my $path (split) {
+			push @scripts, ".$path" if $path =~ /^\/etc\/init\.d\//;
+		}
+	}
+	close $fh;
+
+	return @scripts;
+}
+
+sub run_postinst($) {
+	my $script = shift;
+
+	system($shell, $script);
+	my $ret = $? == -1 ? 127 : ($? & 127 ? 128 + ($? & 127) : $? >> 8);
+	if ($ret) {
+		print STDERR "postinst script $script has failed with exit code $ret\n";
+	}
+	return $ret;
+}
+
+my $standard = qr/^#!\/bin\/sh\n
+	\[ "\$\{IPKG_NO_SCRIPT\}" = "1" \] && exit 0\n
+	\[ -x \$\{IPKG_INSTROOT\}\/lib\/functions\.sh \] \|\| exit 0\n
+	\. \$\{IPKG_INSTROOT\}\/lib\/functions\.sh\n
+	default_postinst \$0 \$@\n$/x;
+
+# A rootfs-overlay directory is merged by the first postinst that runs,
+# keep the exact order of things in that case.
+my $native = !-e "./rootfs-overlay" && -f "./etc/rc.common";
+my $functions = -x "./lib/functions.sh";
+my (@users, @other);
+
+foreach my $script (@postinst) {
+	(my $pkg = $script) =~ s/^.*\/(.+)\.postinst$/$1/;
+	my $data = read_file($script);
+	my $control = read_file("$info/$pkg.control") // "";
+
+	if (!$native or $control =~ /^Require-User:/m) {
+		push @users, $script;
+	} elsif (!defined $data or $data !~ $standard or -e "$info/$pkg.postinst-pkg") {
+		push @other, $script;
+	} elsif ($functions) {
+		enable($_) foreach pkg_initscripts($pkg);
+	}
+}
+
+my @queue = ((@users ? [ @users ] : ()), map { [ $_ ] } @other);
+my (%running, $failed);
+
+while (@queue or %running) {
+	while (@queue and keys %running < $jobs and !$failed) {
+		my $chain = shift @queue;
+		my $pid = fork();
+		die "fork: $!\n" unless defined $pid;
+		if (!$pid) {
+			foreach my $script (@$chain) {
+				exit 1 if run_postinst($script);
+			}
+			exit 0;
+		}
+		$running{$pid} = 1;
+	}
+	last unless %running;
+
+	my $pid = wait();
+	last if $pid < 0;
+	$failed = 1 if $?;
+	delete $running{$pid};
+}
+
+exit 1 if $failed;
+
+foreach my $script (@initscripts) {
+	my $data = read_file($script);
+	my $name = $script;
+	$name =~ s/.*\///;
+
+	next unless defined $data and $data =~ /#!\/bin\/sh \/etc\/rc.common/;
+
+	if (!$disabled{$name}) {
+		$native ? enable($script) : rc_common($script, "enable");
+		print "Enabling $name\n";
+	} else {
+		$native ? disable($script) : rc_common($script, "disable");
+		print "Disabling $name\n";
+	}
+}
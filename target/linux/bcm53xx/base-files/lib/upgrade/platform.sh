@@ -331,6 +331,7 @@ platform_do_upgrade_nand_seama() {
 
 	dd if=$dir/seama.entity of=$dir/kernel.seama bs=131072 count=$(($ubi_offset / 131072)) 2>/dev/null
 	dd if=$dir/seama.entity of=$dir/root.ubi bs=131072 skip=$(($ubi_offset / 131072)) count=$(($ubi_length / 131072)) 2>/dev/null
+	rm -f $dir/seama.entity
 
 	# Flash
 	local kernel_size=$(sed -n 's/mtd[0-9]*: \([0-9a-f]*\).*"\(kernel\|linux\)".*/\1/p' /proc/mtd)
@@ -367,8 +368,7 @@ platform_img_from_safeloader() {
 	mkdir -p $dir
 	osafeloader extract "$1" \
 		-p "os-image" \
-		-o $dir/os-image
-	osafeloader extract "$1" \
+		-o $dir/os-image \
 		-p "file-system" \
 		-o $dir/file-system
 
@@ -379,16 +379,12 @@ platform_img_from_safeloader() {
 
 platform_img_from_seama() {
 	local dir="/tmp/sysupgrade-bcm53xx"
-	local offset=$(oseama info "$1" -e 0 | grep "Entity offset:" | sed "s/.*:\s*//")
-	local size=$(oseama info "$1" -e 0 | grep "Entity size:" | sed "s/.*:\s*//")
-
-	# Busybox doesn't support required iflag-s
-	# echo -n dd iflag=skip_bytes,count_bytes skip=$offset count=$size
 
 	rm -fR $dir
 	mkdir -p $dir
-	dd if="$1" of=$dir/image-noheader.bin bs=$offset skip=1
-	dd if=$dir/image-noheader.bin of=$dir/image-entity.bin bs=$size count=1
+	oseama extract "$1" \
+		-e 0 \
+		-o $dir/image-entity.bin
 
 	echo -n $dir/image-entity.bin
 }
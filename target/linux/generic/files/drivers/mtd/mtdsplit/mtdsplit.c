@@ -16,6 +16,10 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/magic.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/byteorder/generic.h>
@@ -24,6 +28,187 @@
 
 #define UBI_EC_MAGIC			0x55424923	/* UBI# */
 
+/*
+ * Parsers mostly look for headers at the start of erase blocks, and several
+ * of them scan the same partition while the firmware split is probed. The
+ * head of every erase block is read once and kept around for a short while.
+ * The cache is only used while partitions are parsed at boot, the flash may
+ * be written once userspace runs.
+ */
+#define MTDSPLIT_PROBE_SIZE		512
+#define MTDSPLIT_PROBE_MAX_BLOCKS	4096
+#define MTDSPLIT_PROBE_TTL		(5 * HZ)
+
+struct mtdsplit_probe_cache {
+	struct list_head list;
+	struct mtd_info *mtd;
+	unsigned int n_blocks;
+	u8 *heads[];
+};
+
+static LIST_HEAD(probe_caches);
+static DEFINE_MUTEX(probe_lock);
+static bool probe_cache_done;
+
+static void mtdsplit_probe_cache_free(struct mtdsplit_probe_cache *cache)
+{
+	unsigned int i;
+
+	list_del(&cache->list);
+	for (i = 0; i < cache->n_blocks; i++)
+		kfree(cache->heads[i]);
+	kvfree(cache);
+}
+
+static void mtdsplit_probe_expire(struct work_struct *work)
+{
+	struct mtdsplit_probe_cache *cache, *tmp;
+
+	mutex_lock(&probe_lock);
+	list_for_each_entry_safe(cache, tmp, &probe_caches, list)
+		mtdsplit_probe_cache_free(cache);
+	mutex_unlock(&probe_lock);
+}
+
+static DECLARE_DELAYED_WORK(probe_expire_work, mtdsplit_probe_expire);
+
+static struct mtdsplit_probe_cache *
+mtdsplit_probe_cache_get(struct mtd_info *mtd)
+{
+	struct mtdsplit_probe_cache *cache;
+	unsigned int n_blocks;
+
+	if (probe_cache_done)
+		return NULL;
+
+	list_for_each_entry(cache, &probe_caches, list)
+		if (cache->mtd == mtd)
+			return cache;
+
+	if (mtd->erasesize < MTDSPLIT_PROBE_SIZE)
+		return NULL;
+
+	n_blocks = min_t(u64, mtd_div_by_eb(mtd->size, mtd),
+			 MTDSPLIT_PROBE_MAX_BLOCKS);
+	if (!n_blocks)
+		return NULL;
+
+	cache = kvzalloc(sizeof(*cache) + n_blocks * sizeof(cache->heads[0]),
+			 GFP_KERNEL);
+	if (!cache)
+		return NULL;
+
+	cache->mtd = mtd;
+	cache->n_blocks = n_blocks;
+	list_add(&cache->list, &probe_caches);
+
+	return cache;
+}
+
+/**
+ * mtd_probe_read - read a probe header, going through the probe cache
+ *
+ * Same semantics as mtd_read(). Reads that fit into the first
+ * %MTDSPLIT_PROBE_SIZE bytes of an erase block are served from a per-mtd
+ * cache, everything else goes straight to the flash.
+ */
+int mtd_probe_read(struct mtd_info *mtd, loff_t from, size_t len,
+		   size_t *retlen, u_char *buf)
+{
+	struct mtdsplit_probe_cache *cache;
+	size_t block_offset, block_len;
+	unsigned int block;
+	u8 *head;
+	int ret;
+
+	block = mtd_div_by_eb(from, mtd);
+	block_offset = mtd_mod_by_eb(from, mtd);
+	if (block_offset + len > MTDSPLIT_PROBE_SIZE ||
+	    from + len > mtd->size)
+		return mtd_read(mtd, from, len, retlen, buf);
+
+	mutex_lock(&probe_lock);
+
+	cache = mtdsplit_probe_cache_get(mtd);
+	if (!cache || block >= cache->n_blocks)
+		goto uncached;
+
+	head = cache->heads[block];
+	if (!head) {
+		head = kmalloc(MTDSPLIT_PROBE_SIZE, GFP_KERNEL);
+		if (!head)
+			goto uncached;
+
+		block_len = min_t(u64, MTDSPLIT_PROBE_SIZE,
+				  mtd->size - (from - block_offset));
+		ret = mtd_read(mtd, from - block_offset, block_len,
+			       retlen, head);
+		if ((ret && !mtd_is_bitflip(ret)) || *retlen != block_len) {
+			kfree(head);
+			goto uncached;
+		}
+
+		cache->heads[block] = head;
+	}
+
+	memcpy(buf, head + block_offset, len);
+	*retlen = len;
+
+	mod_delayed_work(system_wq, &probe_expire_work, MTDSPLIT_PROBE_TTL);
+	mutex_unlock(&probe_lock);
+
+	return 0;
+
+uncached:
+	mutex_unlock(&probe_lock);
+	return mtd_read(mtd, from, len, retlen, buf);
+}
+EXPORT_SYMBOL_GPL(mtd_probe_read);
+
+static void mtdsplit_notify_add(struct mtd_info *mtd)
+{
+}
+
+static void mtdsplit_notify_remove(struct mtd_info *mtd)
+{
+	struct mtdsplit_probe_cache *cache;
+
+	mutex_lock(&probe_lock);
+	list_for_each_entry(cache, &probe_caches, list) {
+		if (cache->mtd != mtd)
+			continue;
+
+		mtdsplit_probe_cache_free(cache);
+		break;
+	}
+	mutex_unlock(&probe_lock);
+}
+
+static struct mtd_notifier mtdsplit_notifier = {
+	.add	= mtdsplit_notify_add,
+	.remove	= mtdsplit_notify_remove,
+};
+
+static int __init mtdsplit_init(void)
+{
+	register_mtd_user(&mtdsplit_notifier);
+	return 0;
+}
+subsys_initcall(mtdsplit_init);
+
+static int __init mtdsplit_probe_done(void)
+{
+	mutex_lock(&probe_lock);
+	probe_cache_done = true;
+	mutex_unlock(&probe_lock);
+
+	cancel_delayed_work_sync(&probe_expire_work);
+	mtdsplit_probe_expire(NULL);
+
+	return 0;
+}
+late_initcall_sync(mtdsplit_probe_done);
+
 struct squashfs_super_block {
 	__le32 s_magic;
 	__le32 pad0[9];
@@ -38,7 +223,7 @@ int mtd_get_squashfs_len(struct mtd_info *master,
 	size_t retlen;
 	int err;
 
-	err = mtd_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
+	err = mtd_probe_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
 	if (err || (retlen != sizeof(sb))) {
 		pr_alert("error occured while reading from \"%s\"\n",
 			 master->name);
@@ -79,8 +264,8 @@ int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset,
 	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, sizeof(magic), &retlen,
-		       (unsigned char *) &magic);
+	ret = mtd_probe_read(mtd, offset, sizeof(magic), &retlen,
+			     (unsigned char *) &magic);
 	if (ret)
 		return ret;
 
@@ -99,6 +99,67 @@ static const struct file_operations mtk_ppe_debugfs_foe_fops = {
 	.release = single_release,
 };
 
+static int mtk_ppe_debugfs_stats_show(struct seq_file *m, void *private)
+{
+	struct mtk_eth *eth = _eth;
+	struct mtk_foe_stats *stats = &eth->foe_stats;
+	unsigned int state[4] = {}, bound[MTK_PPE_WAYS + 1] = {};
+	unsigned int pressure[4] = {};
+	int i, j, n;
+
+	for (i = 0; i < MTK_PPE_BUCKET_CNT; i++) {
+		struct mtk_foe_entry *entry = &eth->foe_table[i * MTK_PPE_WAYS];
+		u8 p = eth->foe_bucket_pressure[i];
+
+		for (j = 0, n = 0; j < MTK_PPE_WAYS; j++, entry++) {
+			state[entry->bfib1.state]++;
+			if (entry->bfib1.state == FOE_STATE_BIND)
+				n++;
+		}
+		bound[n]++;
+
+		if (!p)
+			pressure[0]++;
+		else if (p < 16)
+			pressure[1]++;
+		else if (p < U8_MAX)
+			pressure[2]++;
+		else
+			pressure[3]++;
+	}
+
+	seq_printf(m, "bind: %u\nunbind: %u\n",
+		   atomic_read(&stats->bind), atomic_read(&stats->unbind));
+	seq_printf(m, "replaced unbind: %u\nreplaced stale: %u\n",
+		   atomic_read(&stats->replace_unbind),
+		   atomic_read(&stats->replace_stale));
+	seq_printf(m, "collisions: %u\n\n", atomic_read(&stats->collision));
+
+	for (i = 0; i < ARRAY_SIZE(state); i++)
+		seq_printf(m, "entries %s: %u\n", mtk_foe_entry_state_str[i],
+			   state[i]);
+
+	for (i = 0; i <= MTK_PPE_WAYS; i++)
+		seq_printf(m, "buckets with %d bound: %u\n", i, bound[i]);
+
+	seq_printf(m, "\nbucket collisions 0: %u, 1-15: %u, 16-254: %u, 255+: %u\n",
+		   pressure[0], pressure[1], pressure[2], pressure[3]);
+
+	return 0;
+}
+
+static int mtk_ppe_debugfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mtk_ppe_debugfs_stats_show, file->private_data);
+}
+
+static const struct file_operations mtk_ppe_debugfs_stats_fops = {
+	.open = mtk_ppe_debugfs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 int mtk_ppe_debugfs_init(struct mtk_eth *eth)
 {
 	struct dentry *root;
@@ -110,6 +171,7 @@ int mtk_ppe_debugfs_init(struct mtk_eth *eth)
 		return -ENOMEM;
 
 	debugfs_create_file("all_entry", S_IRUGO, root, eth, &mtk_ppe_debugfs_foe_fops);
+	debugfs_create_file("stats", S_IRUGO, root, eth, &mtk_ppe_debugfs_stats_fops);
 
 	return 0;
 }
@@ -463,6 +463,14 @@ struct fe_rx_ring {
 	u16 rx_calc_idx;
 };
 
+struct mtk_foe_stats {
+	atomic_t bind;
+	atomic_t unbind;
+	atomic_t replace_unbind;
+	atomic_t replace_stale;
+	atomic_t collision;
+};
+
 struct fe_priv {
 	/* make sure that register operations are atomic */
 	spinlock_t			page_lock;
@@ -497,6 +505,10 @@ struct fe_priv {
 	struct mtk_foe_entry		*foe_table;
 	dma_addr_t			foe_table_phys;
 	struct flow_offload __rcu	**foe_flow_table;
+	u8				*foe_bucket_pressure;
+	struct mtk_foe_stats		foe_stats;
+	struct delayed_work		foe_flush_work;
+	atomic_t			foe_flush_pending;
 };
 
 extern const struct of_device_id of_fe_match[];
@@ -0,0 +1,92 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   Copyright (C) 2020 OpenWrt.org
+ */
+
+/*
+ * FOE hashing and way selection. This has no kernel dependencies so that
+ * the host model in target/linux/ramips/tools can replay conntrack traces
+ * through the same code.
+ */
+
+#ifndef _MTK_FOE_POLICY_H
+#define _MTK_FOE_POLICY_H
+
+/* our table size is 4K */
+#define MTK_PPE_ENTRY_CNT		0x1000
+
+/* the table is hashed into buckets of two consecutive entries */
+#define MTK_PPE_WAYS			2
+#define MTK_PPE_BUCKET_CNT		(MTK_PPE_ENTRY_CNT / MTK_PPE_WAYS)
+
+enum mtk_foe_entry_state {
+	FOE_STATE_INVALID = 0,
+	FOE_STATE_UNBIND = 1,
+	FOE_STATE_BIND = 2,
+	FOE_STATE_FIN = 3
+};
+
+/* first entry of the bucket of an IPv4 flow, addresses and ports in host order */
+static inline unsigned int
+mtk_foe_hash_v4(unsigned int saddr, unsigned int daddr,
+		unsigned short sport, unsigned short dport)
+{
+	unsigned int ports = (unsigned int)sport << 16 | dport;
+	unsigned int src = daddr;
+	unsigned int dst = saddr;
+	unsigned int hash = (ports & src) | ((~ports) & dst);
+	unsigned int hash_23_0 = hash & 0xffffff;
+	unsigned int hash_31_24 = hash & 0xff000000;
+
+	hash = ports ^ src ^ dst ^ ((hash_23_0 << 8) | (hash_31_24 >> 24));
+	hash = ((hash & 0xffff0000) >> 16 ) ^ (hash & 0xfffff);
+	hash &= 0x7ff;
+
+	return hash * MTK_PPE_WAYS;
+}
+
+/*
+ * Placement cost of a FOE way, lower is better and -1 means the way holds a
+ * live bound flow. Entries the PPE is still learning (UNBIND) are cheaper to
+ * take over the fewer packets they have seen.
+ */
+static inline int
+mtk_foe_way_cost(unsigned int state, unsigned int pcnt, int live)
+{
+	switch (state) {
+	case FOE_STATE_BIND:
+		/* bound by a flow that no longer exists */
+		return live ? -1 : 1;
+	case FOE_STATE_UNBIND:
+		return 2 + pcnt;
+	default:
+		return 0;
+	}
+}
+
+/* cheapest way of a bucket other than busy, or -1 if there is none */
+static inline int
+mtk_foe_select_way(const int *cost, int busy)
+{
+	int best = -1;
+	int i;
+
+	for (i = 0; i < MTK_PPE_WAYS; i++) {
+		if (i == busy || cost[i] < 0)
+			continue;
+
+		if (best < 0 || cost[i] < cost[best])
+			best = i;
+	}
+
+	return best;
+}
+
+#endif
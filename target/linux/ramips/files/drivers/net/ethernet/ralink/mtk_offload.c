@@ -23,19 +23,9 @@
 static u32
 mtk_flow_hash_v4(struct flow_offload_tuple *tuple)
 {
-	u32 ports = ntohs(tuple->src_port)  << 16 | ntohs(tuple->dst_port);
-	u32 src = ntohl(tuple->dst_v4.s_addr);
-	u32 dst = ntohl(tuple->src_v4.s_addr);
-	u32 hash = (ports & src) | ((~ports) & dst);
-	u32 hash_23_0 = hash & 0xffffff;
-	u32 hash_31_24 = hash & 0xff000000;
-
-	hash = ports ^ src ^ dst ^ ((hash_23_0 << 8) | (hash_31_24 >> 24));
-	hash = ((hash & 0xffff0000) >> 16 ) ^ (hash & 0xfffff);
-	hash &= 0x7ff;
-	hash *= 2;;
-
-	return hash;
+	return mtk_foe_hash_v4(ntohl(tuple->src_v4.s_addr),
+			       ntohl(tuple->dst_v4.s_addr),
+			       ntohs(tuple->src_port), ntohs(tuple->dst_port));
 }
 
 static int
@@ -119,11 +109,78 @@ mtk_foe_set_mac(struct mtk_foe_entry *entry, u8 *smac, u8 *dmac)
 }
 
 static int
-mtk_check_entry_available(struct mtk_eth *eth, u32 hash)
+mtk_foe_select(struct mtk_eth *eth, u32 hash, int busy)
 {
-	struct mtk_foe_entry entry = ((struct mtk_foe_entry *)eth->foe_table)[hash];
+	int cost[MTK_PPE_WAYS];
+	int best, i;
 
-	return (entry.bfib1.state == BIND)? 0:1;
+	for (i = 0; i < MTK_PPE_WAYS; i++) {
+		struct mtk_foe_entry *entry = &eth->foe_table[hash + i];
+
+		cost[i] = mtk_foe_way_cost(entry->bfib1.state,
+					   entry->udib1.pcnt,
+					   !!rcu_access_pointer(eth->foe_flow_table[hash + i]));
+	}
+
+	best = mtk_foe_select_way(cost, busy - (int)hash);
+	if (best < 0) {
+		u8 *pressure = &eth->foe_bucket_pressure[hash / MTK_PPE_WAYS];
+
+		if (*pressure < U8_MAX)
+			(*pressure)++;
+		atomic_inc(&eth->foe_stats.collision);
+		return -1;
+	}
+
+	if (cost[best] == 1)
+		atomic_inc(&eth->foe_stats.replace_stale);
+	else if (cost[best] > 1)
+		atomic_inc(&eth->foe_stats.replace_unbind);
+
+	return hash + best;
+}
+
+static void
+mtk_foe_cache_clear(struct mtk_eth *eth)
+{
+	mtk_m32(eth, 0, MTK_PPE_CAH_CTRL_CLEAR, MTK_REG_PPE_CAH_CTRL);
+	mtk_m32(eth, MTK_PPE_CAH_CTRL_CLEAR, 0, MTK_REG_PPE_CAH_CTRL);
+}
+
+/*
+ * Invalidated entries may still sit in the PPE cache. Clearing it drops every
+ * cached entry, so deletions only mark it dirty and the cache is cleared once
+ * per batch: from the flush work, or before an add reuses the ways.
+ */
+static void
+mtk_foe_flush(struct mtk_eth *eth)
+{
+	if (atomic_xchg(&eth->foe_flush_pending, 0))
+		mtk_foe_cache_clear(eth);
+}
+
+static void
+mtk_foe_flush_work(struct work_struct *work)
+{
+	struct mtk_eth *eth = container_of(to_delayed_work(work),
+					   struct mtk_eth, foe_flush_work);
+
+	mtk_foe_flush(eth);
+}
+
+static void
+mtk_foe_unbind(struct mtk_eth *eth, u32 hash, struct flow_offload *flow)
+{
+	int i;
+
+	for (i = 0; i < MTK_PPE_WAYS; i++) {
+		if (rcu_access_pointer(eth->foe_flow_table[hash + i]) != flow)
+			continue;
+
+		eth->foe_table[hash + i].bfib1.state = INVALID;
+		RCU_INIT_POINTER(eth->foe_flow_table[hash + i], NULL);
+		atomic_inc(&eth->foe_stats.unbind);
+	}
 }
 
 static void
@@ -144,7 +201,7 @@ int mtk_flow_offload(struct mtk_eth *eth,
 	struct flow_offload_tuple *otuple = &flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple;
 	struct flow_offload_tuple *rtuple = &flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple;
 	u32 time_stamp = mtk_r32(eth, 0x0010) & (0x7fff);
-	u32 ohash, rhash;
+	int ohash, rhash;
 	struct mtk_foe_entry orig = {
 		.bfib1.time_stamp = time_stamp,
 		.bfib1.psn = 0,
@@ -157,40 +214,37 @@ int mtk_flow_offload(struct mtk_eth *eth,
 	if (otuple->l4proto != IPPROTO_TCP && otuple->l4proto != IPPROTO_UDP)
 		return -EINVAL;
 	
+	if (otuple->l3proto != AF_INET)
+		return -EINVAL;
+
+	ohash = mtk_flow_hash_v4(otuple);
+	rhash = mtk_flow_hash_v4(rtuple);
+
+	/* release the ways right away instead of waiting for the PPE to age them */
 	if (type == FLOW_OFFLOAD_DEL) {
-		flow = NULL;
-		synchronize_rcu();
+		mtk_foe_unbind(eth, ohash, flow);
+		mtk_foe_unbind(eth, rhash, flow);
+		atomic_set(&eth->foe_flush_pending, 1);
+		schedule_delayed_work(&eth->foe_flush_work, HZ / 10);
 		return 0;
 	}
 
-	switch (otuple->l3proto) {
-	case AF_INET:
-		if (mtk_foe_prepare_v4(&orig, otuple, rtuple, src, dest) ||
-		    mtk_foe_prepare_v4(&reply, rtuple, otuple, dest, src))
-			return -EINVAL;
+	mtk_foe_flush(eth);
 
-		ohash = mtk_flow_hash_v4(otuple);
-		rhash = mtk_flow_hash_v4(rtuple);
-		break;
+	if (mtk_foe_prepare_v4(&orig, otuple, rtuple, src, dest) ||
+	    mtk_foe_prepare_v4(&reply, rtuple, otuple, dest, src))
+		return -EINVAL;
 
-	case AF_INET6:
+	/* Two-way hash: each bucket has MTK_PPE_WAYS consecutive entries */
+	ohash = mtk_foe_select(eth, ohash, -1);
+	if (ohash < 0)
 		return -EINVAL;
 
-	default:
+	rhash = mtk_foe_select(eth, rhash, ohash);
+	if (rhash < 0)
 		return -EINVAL;
-	}
 
-	/* Two-way hash: when hash collision occurs, the hash value will be shifted to the next position. */
-	if (!mtk_check_entry_available(eth, ohash)){       
-		if (!mtk_check_entry_available(eth, ohash + 1))
-			return -EINVAL;
-                ohash += 1;
-        }
-        if (!mtk_check_entry_available(eth, rhash)){
-		if (!mtk_check_entry_available(eth, rhash + 1))
-                        return -EINVAL;
-                rhash += 1;
-	}
+	atomic_inc(&eth->foe_stats.bind);
 
 	mtk_foe_set_mac(&orig, dest->eth_src, dest->eth_dest);
 	mtk_foe_set_mac(&reply, src->eth_src, src->eth_dest);
@@ -288,6 +342,12 @@ static int mtk_init_foe_table(struct mtk_eth *eth)
 	if (!eth->foe_flow_table)
 		return -EINVAL;
 
+	eth->foe_bucket_pressure = devm_kcalloc(eth->dev, MTK_PPE_BUCKET_CNT,
+						sizeof(*eth->foe_bucket_pressure),
+						GFP_KERNEL);
+	if (!eth->foe_bucket_pressure)
+		return -ENOMEM;
+
 	/* map the FOE table */
 	eth->foe_table = dmam_alloc_coherent(eth->dev, MTK_PPE_TBL_SZ,
 					     &eth->foe_table_phys, GFP_KERNEL);
@@ -297,6 +357,7 @@ static int mtk_init_foe_table(struct mtk_eth *eth)
 		return -ENOMEM;
 	}
 
+	INIT_DELAYED_WORK(&eth->foe_flush_work, mtk_foe_flush_work);
 
 	return 0;
 }
@@ -536,5 +597,7 @@ int mtk_ppe_probe(struct mtk_eth *eth)
 
 void mtk_ppe_remove(struct mtk_eth *eth)
 {
+	if (eth->foe_table)
+		cancel_delayed_work_sync(&eth->foe_flush_work);
 	mtk_ppe_stop(eth);
 }
@@ -27,6 +27,7 @@
 #include <linux/bitfield.h>
 
 #include "mtk_eth_soc.h"
+#include "mtk_foe_policy.h"
 
 #ifdef CONFIG_RALINK
 /* ramips compat */
@@ -121,6 +122,7 @@ mtk_w32(struct mtk_eth *eth, u32 val, u32 reg)
 
 #define MTK_REG_PPE_CAH_CTRL			0xf20
 #define   MTK_PPE_CAH_CTRL_X_MODE		BIT(9)
+#define   MTK_PPE_CAH_CTRL_CLEAR		BIT(8)
 #define   MTK_PPE_CAH_CTRL_EN			BIT(0)
 
 struct mtk_foe_unbind_info_blk {
@@ -207,13 +209,6 @@ struct mtk_foe_entry {
 	};
 };
 
-enum mtk_foe_entry_state {
-	FOE_STATE_INVALID = 0,
-	FOE_STATE_UNBIND = 1,
-	FOE_STATE_BIND = 2,
-	FOE_STATE_FIN = 3
-};
-
 
 #define MTK_RXD4_FOE_ENTRY		GENMASK(13, 0)
 #define MTK_RXD4_CPU_REASON		GENMASK(18, 14)
@@ -250,8 +245,6 @@ enum mtk_foe_cpu_reason {
 };
 
 
-/* our table size is 4K */
-#define MTK_PPE_ENTRY_CNT		0x1000
 #define MTK_PPE_TBL_SZ			\
 			(MTK_PPE_ENTRY_CNT * sizeof(struct mtk_foe_entry))
 
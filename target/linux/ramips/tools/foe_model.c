@@ -0,0 +1,457 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   Copyright (C) 2020 OpenWrt.org
+ */
+
+/*
+ * Host model of the PPE FOE table, not part of the kernel build.
+ *
+ *   cc -O2 -I ../files/drivers/net/ethernet/ralink -o foe_model foe_model.c
+ *   conntrack -E -o timestamp > trace.txt
+ *   ./foe_model < trace.txt
+ *
+ * The trace is replayed through the hash and way selection of
+ * mtk_foe_policy.h and, for comparison, through the placement the driver
+ * used before (first way that is not bound, deleted flows left for the PPE
+ * to age out). A flow is offloaded when conntrack marks it [ASSURED].
+ *
+ * The PPE is modelled coarsely: conntrack events stand in for packets, so
+ * every event of a flow that is not bound teaches the PPE an UNBIND entry
+ * (or bumps its packet count), UNBIND entries age out after the unbind
+ * delta and BIND entries of destroyed flows after the bind delta. Bound
+ * live flows are kept alive by keepalive and never age.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "mtk_foe_policy.h"
+
+/* aging deltas programmed by mtk_ppe_start() */
+#define FOE_UNBIND_AGE		3.0
+#define FOE_BIND_AGE		5.0
+
+#define FLOW_HASH_SIZE		(1 << 20)
+
+enum {
+	POLICY_LEGACY,
+	POLICY_COST,
+	__POLICY_MAX
+};
+
+static const char *policy_names[__POLICY_MAX] = {
+	[POLICY_LEGACY] = "legacy",
+	[POLICY_COST] = "cost",
+};
+
+struct tuple {
+	unsigned int saddr, daddr;
+	unsigned short sport, dport;
+	unsigned char proto;
+};
+
+struct flow {
+	struct tuple orig, reply;
+	int alive;
+	double destroyed;
+	int requested;
+	int bound[__POLICY_MAX];
+};
+
+struct foe_entry {
+	unsigned int state;
+	unsigned int pcnt;
+	double last;
+	int flow;
+};
+
+struct foe_model {
+	int policy;
+	struct foe_entry table[MTK_PPE_ENTRY_CNT];
+	unsigned int pressure[MTK_PPE_BUCKET_CNT];
+	unsigned long requests, bound, collisions;
+	unsigned long replace_stale, replace_unbind;
+};
+
+static struct flow *flows;
+static int *flow_hash;
+static int n_flows;
+
+static struct foe_model models[__POLICY_MAX];
+
+static unsigned int
+tuple_hash(const struct tuple *t)
+{
+	unsigned int h = t->saddr * 2654435761u;
+
+	h ^= t->daddr * 2246822519u;
+	h ^= ((unsigned int)t->sport << 16 | t->dport) * 3266489917u;
+	h ^= t->proto;
+
+	return h & (FLOW_HASH_SIZE - 1);
+}
+
+static int
+tuple_equal(const struct tuple *a, const struct tuple *b)
+{
+	return a->saddr == b->saddr && a->daddr == b->daddr &&
+	       a->sport == b->sport && a->dport == b->dport &&
+	       a->proto == b->proto;
+}
+
+static struct flow *
+flow_get(const struct tuple *orig, int create)
+{
+	unsigned int i = tuple_hash(orig);
+	int n;
+
+	for (n = 0; n < FLOW_HASH_SIZE; n++, i = (i + 1) & (FLOW_HASH_SIZE - 1)) {
+		if (flow_hash[i] < 0)
+			break;
+
+		if (flows[flow_hash[i]].alive &&
+		    tuple_equal(&flows[flow_hash[i]].orig, orig))
+			return &flows[flow_hash[i]];
+	}
+
+	if (!create)
+		return NULL;
+
+	if (n == FLOW_HASH_SIZE || n_flows == FLOW_HASH_SIZE / 2) {
+		fprintf(stderr, "Too many flows in trace\n");
+		exit(1);
+	}
+
+	flow_hash[i] = n_flows;
+	memset(&flows[n_flows], 0, sizeof(flows[n_flows]));
+	flows[n_flows].orig = *orig;
+	flows[n_flows].alive = 1;
+
+	return &flows[n_flows++];
+}
+
+static unsigned int
+foe_hash(const struct tuple *t)
+{
+	return mtk_foe_hash_v4(t->saddr, t->daddr, t->sport, t->dport);
+}
+
+/* apply the PPE aging that happened to an entry until now */
+static struct foe_entry *
+foe_entry(struct foe_model *m, unsigned int hash, double now)
+{
+	struct foe_entry *e = &m->table[hash];
+	struct flow *f = e->flow >= 0 ? &flows[e->flow] : NULL;
+
+	switch (e->state) {
+	case FOE_STATE_UNBIND:
+		if (now - e->last >= FOE_UNBIND_AGE)
+			e->state = FOE_STATE_INVALID;
+		break;
+	case FOE_STATE_BIND:
+		if (f && !f->alive && now - f->destroyed >= FOE_BIND_AGE)
+			e->state = FOE_STATE_INVALID;
+		break;
+	}
+
+	if (e->state == FOE_STATE_INVALID)
+		e->flow = -1;
+
+	return e;
+}
+
+static void
+foe_learn(struct foe_model *m, struct flow *f, const struct tuple *t,
+	  double now)
+{
+	unsigned int hash = foe_hash(t);
+	struct foe_entry *free = NULL;
+	int i;
+
+	for (i = 0; i < MTK_PPE_WAYS; i++) {
+		struct foe_entry *e = foe_entry(m, hash + i, now);
+
+		if (e->state == FOE_STATE_INVALID && !free)
+			free = e;
+
+		if (e->state != FOE_STATE_UNBIND || e->flow != f - flows)
+			continue;
+
+		e->pcnt++;
+		e->last = now;
+		return;
+	}
+
+	if (!free)
+		return;
+
+	free->state = FOE_STATE_UNBIND;
+	free->pcnt = 1;
+	free->last = now;
+	free->flow = f - flows;
+}
+
+/* the placement mtk_flow_offload() used before the cost policy */
+static int
+foe_select_legacy(struct foe_model *m, unsigned int hash, double now)
+{
+	int i;
+
+	for (i = 0; i < MTK_PPE_WAYS; i++)
+		if (foe_entry(m, hash + i, now)->state != FOE_STATE_BIND)
+			return hash + i;
+
+	return -1;
+}
+
+static int
+foe_select_cost(struct foe_model *m, unsigned int hash, int busy, double now)
+{
+	int cost[MTK_PPE_WAYS];
+	int best, i;
+
+	for (i = 0; i < MTK_PPE_WAYS; i++) {
+		struct foe_entry *e = foe_entry(m, hash + i, now);
+
+		cost[i] = mtk_foe_way_cost(e->state, e->pcnt,
+					   e->state == FOE_STATE_BIND &&
+					   e->flow >= 0);
+	}
+
+	best = mtk_foe_select_way(cost, busy - (int)hash);
+	if (best < 0)
+		return -1;
+
+	if (cost[best] == 1)
+		m->replace_stale++;
+	else if (cost[best] > 1)
+		m->replace_unbind++;
+
+	return hash + best;
+}
+
+static void
+foe_bind(struct foe_model *m, struct flow *f, double now)
+{
+	unsigned int ohash = foe_hash(&f->orig);
+	unsigned int rhash = foe_hash(&f->reply);
+	int o, r;
+
+	m->requests++;
+
+	if (m->policy == POLICY_LEGACY) {
+		/* both ways are picked before either is written */
+		o = foe_select_legacy(m, ohash, now);
+		r = foe_select_legacy(m, rhash, now);
+		if (o == r)
+			o = -1;
+	} else {
+		o = foe_select_cost(m, ohash, -1, now);
+		r = o < 0 ? -1 : foe_select_cost(m, rhash, o, now);
+	}
+
+	if (o < 0 || r < 0) {
+		m->pressure[(o < 0 ? ohash : rhash) / MTK_PPE_WAYS]++;
+		m->collisions++;
+		return;
+	}
+
+	m->table[o].state = FOE_STATE_BIND;
+	m->table[o].flow = f - flows;
+	m->table[r].state = FOE_STATE_BIND;
+	m->table[r].flow = f - flows;
+	f->bound[m->policy] = 1;
+	m->bound++;
+}
+
+static void
+foe_unbind(struct foe_model *m, struct flow *f, double now)
+{
+	unsigned int hash[2] = { foe_hash(&f->orig), foe_hash(&f->reply) };
+	int i, j;
+
+	/* the legacy driver left the entries for the PPE to age out */
+	if (m->policy == POLICY_LEGACY)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < MTK_PPE_WAYS; j++) {
+			struct foe_entry *e = foe_entry(m, hash[i] + j, now);
+
+			if (e->state != FOE_STATE_BIND || e->flow != f - flows)
+				continue;
+
+			e->state = FOE_STATE_INVALID;
+			e->flow = -1;
+		}
+	}
+}
+
+static int
+parse_tuple(const char **s, struct tuple *t)
+{
+	char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+	struct in_addr addr;
+	const char *p = strstr(*s, "src=");
+	int n;
+
+	if (!p || sscanf(p, "src=%15s dst=%15s sport=%hu dport=%hu%n",
+			 src, dst, &t->sport, &t->dport, &n) != 4)
+		return -1;
+
+	if (inet_pton(AF_INET, src, &addr) != 1)
+		return -1;
+	t->saddr = ntohl(addr.s_addr);
+
+	if (inet_pton(AF_INET, dst, &addr) != 1)
+		return -1;
+	t->daddr = ntohl(addr.s_addr);
+
+	*s = p + n;
+
+	return 0;
+}
+
+static void
+replay_event(double now, const char *event, const char *line)
+{
+	struct tuple orig = {}, reply = {};
+	struct flow *f;
+	const char *p;
+	int i;
+
+	p = strstr(line, event);
+	p += strlen(event);
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	if (!strncmp(p, "tcp", 3))
+		orig.proto = 6;
+	else if (!strncmp(p, "udp", 3))
+		orig.proto = 17;
+	else
+		return;
+
+	if (parse_tuple(&p, &orig) || parse_tuple(&p, &reply))
+		return;
+	reply.proto = orig.proto;
+
+	f = flow_get(&orig, !strcmp(event, "[NEW]"));
+	if (!f)
+		return;
+
+	if (!strcmp(event, "[DESTROY]")) {
+		f->alive = 0;
+		f->destroyed = now;
+		for (i = 0; i < __POLICY_MAX; i++)
+			if (f->bound[i])
+				foe_unbind(&models[i], f, now);
+		return;
+	}
+
+	f->reply = reply;
+
+	for (i = 0; i < __POLICY_MAX; i++) {
+		if (f->bound[i])
+			continue;
+
+		foe_learn(&models[i], f, &f->orig, now);
+		foe_learn(&models[i], f, &f->reply, now);
+	}
+
+	if (f->requested || !strstr(line, "[ASSURED]"))
+		return;
+
+	f->requested = 1;
+	for (i = 0; i < __POLICY_MAX; i++)
+		foe_bind(&models[i], f, now);
+}
+
+static void
+print_stats(void)
+{
+	int i, j;
+
+	printf("%-8s %10s %10s %10s %8s %10s %10s %12s\n",
+	       "policy", "requests", "bound", "collisions", "hit rate",
+	       "stale", "unbind", "max pressure");
+
+	for (i = 0; i < __POLICY_MAX; i++) {
+		struct foe_model *m = &models[i];
+		unsigned int max = 0;
+
+		for (j = 0; j < MTK_PPE_BUCKET_CNT; j++)
+			if (m->pressure[j] > max)
+				max = m->pressure[j];
+
+		printf("%-8s %10lu %10lu %10lu %7.2f%% %10lu %10lu %12u\n",
+		       policy_names[i], m->requests, m->bound, m->collisions,
+		       m->requests ? 100.0 * m->bound / m->requests : 0.0,
+		       m->replace_stale, m->replace_unbind, max);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const char *events[] = { "[NEW]", "[UPDATE]", "[DESTROY]" };
+	char line[1024];
+	unsigned long lines = 0, skipped = 0;
+	double now;
+	int i, j;
+
+	if (argc > 1) {
+		fprintf(stderr, "Usage: %s < trace\n"
+			"Replay a 'conntrack -E -o timestamp' trace through the FOE table\n",
+			argv[0]);
+		return 1;
+	}
+
+	flows = calloc(FLOW_HASH_SIZE / 2, sizeof(*flows));
+	flow_hash = malloc(FLOW_HASH_SIZE * sizeof(*flow_hash));
+	if (!flows || !flow_hash) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	memset(flow_hash, 0xff, FLOW_HASH_SIZE * sizeof(*flow_hash));
+
+	for (i = 0; i < __POLICY_MAX; i++) {
+		models[i].policy = i;
+		for (j = 0; j < MTK_PPE_ENTRY_CNT; j++)
+			models[i].table[j].flow = -1;
+	}
+
+	while (fgets(line, sizeof(line), stdin)) {
+		lines++;
+
+		if (sscanf(line, " [%lf]", &now) != 1) {
+			skipped++;
+			continue;
+		}
+
+		for (i = 0; i < 3; i++)
+			if (strstr(line, events[i]))
+				break;
+
+		if (i == 3) {
+			skipped++;
+			continue;
+		}
+
+		replay_event(now, events[i], line);
+	}
+
+	printf("%lu events, %lu skipped, %d flows\n\n",
+	       lines - skipped, skipped, n_flows);
+	print_stats();
+
+	return 0;
+}
@@ -35,6 +35,10 @@
 #include <inttypes.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include "cyg_crc.h"
 
 #if __BYTE_ORDER == __BIG_ENDIAN
@@ -49,6 +53,12 @@
 #error unknown endianness!
 #endif
 
+/* hidden behind _GNU_SOURCE by glibc, endian.h is included before us */
+#if defined(__linux__) && !defined(SEEK_DATA)
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
+
 #define swap(a, b) \
 	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
 
@@ -95,6 +105,8 @@ typedef struct {
 
 #define DISK_SECTOR_SIZE        512
 
+#define COPY_BLOCK_SIZE         (64 * 1024)
+
 /* Partition table entry */
 struct pte {
 	uint8_t active;
@@ -109,6 +121,9 @@ struct partinfo {
 	unsigned long start;
 	unsigned long size;
 	int type;
+	char *image;
+	uint64_t offset;
+	uint64_t length;
 };
 
 /* GPT Partition table header */
@@ -147,6 +162,7 @@ int sectors = -1;
 int kb_align = 0;
 bool ignore_null_sized_partition = false;
 bool use_guid_partition_table = false;
+bool pad_image = false;
 struct partinfo parts[GPT_ENTRY_MAX];
 char *filename = NULL;
 
@@ -271,6 +287,133 @@ static inline void init_utf16(char *str, uint16_t *buf, unsigned bufsize)
 	}
 }
 
+/* copy a range within the kernel, which shares the blocks where it can */
+static ssize_t copy_range(int in, off_t in_off, int out, off_t out_off, size_t len)
+{
+#if defined(__linux__) && defined(__NR_copy_file_range)
+	loff_t src = in_off, dst = out_off;
+
+	return syscall(__NR_copy_file_range, in, &src, out, &dst, len, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* copy a range through a buffer, leaving holes for blocks of zeroes */
+static int copy_sparse(int in, off_t in_off, int out, off_t out_off, size_t len)
+{
+	static char buf[COPY_BLOCK_SIZE];
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(in, buf, len < sizeof(buf) ? len : sizeof(buf), in_off);
+		if (n <= 0)
+			return -1;
+
+		if ((buf[0] || memcmp(buf, buf + 1, n - 1)) &&
+		    pwrite(out, buf, n, out_off) != n)
+			return -1;
+
+		in_off += n;
+		out_off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* copy the data of a partition image, holes in the image stay holes */
+static int copy_image(int out, struct partinfo *part)
+{
+	static bool no_copy_range;
+	off_t data, hole, size;
+	struct stat st;
+	ssize_t n;
+	int in, ret = -1;
+
+	if ((in = open(part->image, O_RDONLY)) < 0) {
+		fprintf(stderr, "Can't open image file '%s'\n", part->image);
+		return ret;
+	}
+
+	if (fstat(in, &st)) {
+		fprintf(stderr, "Can't stat image file '%s'\n", part->image);
+		goto fail;
+	}
+
+	size = st.st_size;
+	if ((uint64_t)size > part->length) {
+		fprintf(stderr, "Image file '%s' does not fit into its partition\n",
+			part->image);
+		goto fail;
+	}
+
+	for (data = 0; data < size; data = hole) {
+#ifdef SEEK_DATA
+		data = lseek(in, data, SEEK_DATA);
+		if (data < 0 && errno == ENXIO)
+			break;
+		hole = data < 0 ? -1 : lseek(in, data, SEEK_HOLE);
+		if (data < 0 || hole < 0)
+#endif
+		{
+			data = 0;
+			hole = size;
+		}
+
+		while (data < hole && !no_copy_range) {
+			n = copy_range(in, data, out, part->offset + data, hole - data);
+			if (n <= 0) {
+				no_copy_range = true;
+				break;
+			}
+			data += n;
+		}
+
+		if (data < hole &&
+		    copy_sparse(in, data, out, part->offset + data, hole - data)) {
+			fprintf(stderr, "Can't copy image file '%s'\n", part->image);
+			goto fail;
+		}
+	}
+
+	ret = 0;
+fail:
+	close(in);
+	return ret;
+}
+
+/* copy the partition images and size the output file */
+static int write_images(int fd, unsigned nr, uint64_t disk_size)
+{
+	uint64_t size = 0;
+	struct stat st;
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		if (!parts[i].image || !parts[i].length)
+			continue;
+
+		if (copy_image(fd, &parts[i]))
+			return -1;
+
+		if (stat(parts[i].image, &st) == 0 &&
+		    parts[i].offset + st.st_size > size)
+			size = parts[i].offset + st.st_size;
+	}
+
+	if (pad_image)
+		size = disk_size;
+
+	if (fstat(fd, &st) || ((uint64_t)st.st_size < size && ftruncate(fd, size))) {
+		fputs("Can't resize output file\n", stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
 /* check the partition sizes and write the partition table */
 static int gen_ptable(uint32_t signature, int nr)
 {
@@ -319,6 +462,9 @@ static int gen_ptable(uint32_t signature, int nr)
 					(long)len * DISK_SECTOR_SIZE);
 		printf("%ld\n", (long)start * DISK_SECTOR_SIZE);
 		printf("%ld\n", (long)len * DISK_SECTOR_SIZE);
+
+		parts[i].offset = (uint64_t)start * DISK_SECTOR_SIZE;
+		parts[i].length = (uint64_t)len * DISK_SECTOR_SIZE;
 	}
 
 	if ((fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
@@ -343,6 +489,9 @@ static int gen_ptable(uint32_t signature, int nr)
 		goto fail;
 	}
 
+	if (write_images(fd, nr, (uint64_t)sect * DISK_SECTOR_SIZE))
+		goto fail;
+
 	ret = 0;
 fail:
 	close(fd);
@@ -410,6 +559,9 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 					(sect - start) * DISK_SECTOR_SIZE);
 		printf("%" PRIu64 "\n", start * DISK_SECTOR_SIZE);
 		printf("%" PRIu64 "\n", (sect - start) * DISK_SECTOR_SIZE);
+
+		parts[i].offset = start * DISK_SECTOR_SIZE;
+		parts[i].length = (sect - start) * DISK_SECTOR_SIZE;
 	}
 
 	gpte[GPT_ENTRY_MAX - 1].start = cpu_to_le64(GPT_FIRST_ENTRY_SECTOR + GPT_ENTRY_SIZE * GPT_ENTRY_MAX / DISK_SECTOR_SIZE);
@@ -490,6 +642,9 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 	}
 #endif
 
+	if (write_images(fd, nr, (end + 1) * DISK_SECTOR_SIZE))
+		goto fail;
+
 	ret = 0;
 fail:
 	close(fd);
@@ -498,13 +653,14 @@ fail:
 
 static void usage(char *prog)
 {
-	fprintf(stderr, "Usage: %s [-v] [-n] [-g] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [-G <guid>] [[-t <type>] -p <size>[@<start>]...] \n", prog);
+	fprintf(stderr, "Usage: %s [-v] [-n] [-g] [-z] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [-G <guid>] [[-t <type>] [-f <image>] -p <size>[@<start>]...] \n", prog);
 	exit(EXIT_FAILURE);
 }
 
 int main (int argc, char **argv)
 {
 	unsigned char type = 0x83;
+	char *image = NULL;
 	char *p;
 	int ch;
 	int part = 0;
@@ -512,7 +668,7 @@ int main (int argc, char **argv)
 	guid_t guid = GUID_INIT( signature, 0x2211, 0x4433, \
 			0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0x00);
 
-	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vngl:S:G:")) != -1) {
+	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:f:vngzl:S:G:")) != -1) {
 		switch (ch) {
 		case 'o':
 			filename = optarg;
@@ -526,6 +682,12 @@ int main (int argc, char **argv)
 		case 'g':
 			use_guid_partition_table = 1;
 			break;
+		case 'z':
+			pad_image = true;
+			break;
+		case 'f':
+			image = optarg;
+			break;
 		case 'h':
 			heads = (int)strtoul(optarg, NULL, 0);
 			break;
@@ -544,6 +706,8 @@ int main (int argc, char **argv)
 			}
 			parts[part].size = to_kbytes(optarg);
 			fprintf(stderr, "part %ld %ld\n", parts[part].start, parts[part].size);
+			parts[part].image = image;
+			image = NULL;
 			parts[part++].type = type;
 			break;
 		case 't':
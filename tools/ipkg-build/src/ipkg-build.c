@@ -0,0 +1,955 @@
+/*
+ * ipkg-build - construct a .ipk from a directory
+ *
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * Based on the ipkg-build shell script by Carl Worth and Steve Redler IV.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * The tar streams are generated in memory, with entries sorted by name
+ * and laid out exactly like GNU tar --format=gnu --sort=name writes them.
+ * data.tar.gz and control.tar.gz are compressed in independent 128 KiB
+ * blocks, each primed with the 32 KiB of input preceding it, the same
+ * way pigz does it. The result is a regular single member gzip stream
+ * that only depends on the input, not on the number of threads used.
+ * The outer archive only holds the two compressed tarballs, so it is
+ * wrapped in stored deflate blocks instead of being compressed again.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include <zlib.h>
+
+#define TAR_BLOCK	512
+#define TAR_RECORD	(20 * TAR_BLOCK)
+#define TAR_NAME_LEN	100
+
+#define GZ_BLOCK	(128 * 1024)
+#define GZ_DICT		(32 * 1024)
+#define GZ_LEVEL	6
+
+struct buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct tar_hdr {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[8];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char pad[167];
+};
+
+struct hardlink {
+	struct hardlink *next;
+	dev_t dev;
+	ino_t ino;
+	char *name;
+};
+
+struct gz_job {
+	const uint8_t *in;
+	size_t len;
+	int level;
+	int blocks;
+	int next;
+	struct buf *out;
+	uint32_t *crc;
+	pthread_mutex_t lock;
+	bool error;
+};
+
+static const char *progname;
+static time_t timestamp;
+static int jobs;
+
+static bool force_owner, force_group;
+static uid_t owner;
+static gid_t group;
+static char owner_name[32], group_name[32];
+
+static struct hardlink *hardlinks;
+
+static void __attribute__((noreturn))
+fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr)
+		fatal("*** Error: Out of memory\n");
+
+	return ptr;
+}
+
+static char *
+xstrdup(const char *s)
+{
+	return strcpy(xrealloc(NULL, strlen(s) + 1), s);
+}
+
+static uint8_t *
+buf_grow(struct buf *b, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		if (b->size < 64 * 1024)
+			b->size = 64 * 1024;
+		b->data = xrealloc(b->data, b->size);
+	}
+
+	b->len += len;
+	return b->data + b->len - len;
+}
+
+static void
+buf_add(struct buf *b, const void *data, size_t len)
+{
+	memcpy(buf_grow(b, len), data, len);
+}
+
+static void
+buf_pad(struct buf *b, size_t align)
+{
+	size_t pad = (align - b->len % align) % align;
+
+	memset(buf_grow(b, pad), 0, pad);
+}
+
+static int
+read_file(const char *path, struct buf *b)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	do {
+		uint8_t *p = buf_grow(b, 64 * 1024);
+
+		len = read(fd, p, 64 * 1024);
+		b->len -= 64 * 1024 - (len > 0 ? len : 0);
+	} while (len > 0);
+
+	close(fd);
+	return len < 0 ? -1 : 0;
+}
+
+static int
+write_file(const char *path, const void *data, size_t len, mode_t mode)
+{
+	const uint8_t *p = data;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0)
+		return -1;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return close(fd);
+}
+
+static const char *
+uid_name(uid_t uid)
+{
+	static char name[32];
+	static uid_t cached = (uid_t) -1;
+	struct passwd *pw;
+
+	if (force_owner && uid == owner && owner_name[0])
+		return owner_name;
+
+	if (uid != cached) {
+		pw = getpwuid(uid);
+		snprintf(name, sizeof(name), "%s", pw ? pw->pw_name : "");
+		cached = uid;
+	}
+
+	return name;
+}
+
+static const char *
+gid_name(gid_t gid)
+{
+	static char name[32];
+	static gid_t cached = (gid_t) -1;
+	struct group *gr;
+
+	if (force_group && gid == group && group_name[0])
+		return group_name;
+
+	if (gid != cached) {
+		gr = getgrgid(gid);
+		snprintf(name, sizeof(name), "%s", gr ? gr->gr_name : "");
+		cached = gid;
+	}
+
+	return name;
+}
+
+/* octal, or base-256 like GNU tar when the value does not fit */
+static void
+tar_num(char *field, size_t len, uint64_t val)
+{
+	int i;
+
+	if (val < (1ULL << (3 * (len - 1)))) {
+		snprintf(field, len, "%0*llo", (int) len - 1, (unsigned long long) val);
+		return;
+	}
+
+	for (i = len - 1; i > 0; i--, val >>= 8)
+		field[i] = val & 0xff;
+	field[0] = 0x80;
+}
+
+/* string field, not necessarily NUL terminated when it is full */
+static void
+tar_str(char *field, size_t len, const char *s)
+{
+	size_t slen = strlen(s);
+
+	memcpy(field, s, slen < len ? slen : len);
+}
+
+static void
+tar_write_hdr(struct buf *b, struct tar_hdr *h)
+{
+	unsigned int sum = 0;
+	size_t i;
+
+	memcpy(h->magic, "ustar  ", 8);
+	memset(h->chksum, ' ', sizeof(h->chksum));
+	for (i = 0; i < sizeof(*h); i++)
+		sum += ((uint8_t *) h)[i];
+	snprintf(h->chksum, 7, "%06o", sum);
+
+	buf_add(b, h, sizeof(*h));
+}
+
+static void
+tar_long_name(struct buf *b, char type, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct tar_hdr h = {};
+
+	strcpy(h.name, "././@LongLink");
+	tar_num(h.mode, sizeof(h.mode), 0644);
+	tar_num(h.uid, sizeof(h.uid), 0);
+	tar_num(h.gid, sizeof(h.gid), 0);
+	tar_num(h.size, sizeof(h.size), len);
+	tar_num(h.mtime, sizeof(h.mtime), 0);
+	h.typeflag = type;
+	tar_str(h.uname, sizeof(h.uname), uid_name(0));
+	tar_str(h.gname, sizeof(h.gname), gid_name(0));
+	tar_write_hdr(b, &h);
+
+	buf_add(b, name, len);
+	buf_pad(b, TAR_BLOCK);
+}
+
+static void
+tar_add(struct buf *b, const char *name, const struct stat *st, char type,
+	const char *link, uint64_t size)
+{
+	uid_t uid = force_owner ? owner : st->st_uid;
+	gid_t gid = force_group ? group : st->st_gid;
+	struct tar_hdr h = {};
+
+	if (strlen(name) > TAR_NAME_LEN)
+		tar_long_name(b, 'L', name);
+	if (link && strlen(link) > TAR_NAME_LEN)
+		tar_long_name(b, 'K', link);
+
+	tar_str(h.name, sizeof(h.name), name);
+	tar_num(h.mode, sizeof(h.mode), st->st_mode & 07777);
+	tar_num(h.uid, sizeof(h.uid), uid);
+	tar_num(h.gid, sizeof(h.gid), gid);
+	tar_num(h.size, sizeof(h.size), size);
+	tar_num(h.mtime, sizeof(h.mtime), timestamp);
+	h.typeflag = type;
+	if (link)
+		tar_str(h.linkname, sizeof(h.linkname), link);
+	tar_str(h.uname, sizeof(h.uname), uid_name(uid));
+	tar_str(h.gname, sizeof(h.gname), gid_name(gid));
+	if (type == '3' || type == '4') {
+		tar_num(h.devmajor, sizeof(h.devmajor), major(st->st_rdev));
+		tar_num(h.devminor, sizeof(h.devminor), minor(st->st_rdev));
+	}
+	tar_write_hdr(b, &h);
+}
+
+static int
+tar_add_file(struct buf *b, const char *path, const char *name,
+	     const struct stat *st)
+{
+	struct hardlink *hl;
+	size_t len;
+
+	if (st->st_nlink > 1) {
+		for (hl = hardlinks; hl; hl = hl->next) {
+			if (hl->dev == st->st_dev && hl->ino == st->st_ino) {
+				tar_add(b, name, st, '1', hl->name, 0);
+				return 0;
+			}
+		}
+
+		hl = xrealloc(NULL, sizeof(*hl));
+		hl->dev = st->st_dev;
+		hl->ino = st->st_ino;
+		hl->name = xstrdup(name);
+		hl->next = hardlinks;
+		hardlinks = hl;
+	}
+
+	tar_add(b, name, st, '0', NULL, st->st_size);
+
+	len = b->len;
+	if (read_file(path, b) || b->len - len != (size_t) st->st_size) {
+		fprintf(stderr, "*** Error: Failed to read %s\n", path);
+		return -1;
+	}
+	buf_pad(b, TAR_BLOCK);
+
+	return 0;
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* add path as name, and everything below it in name order */
+static int
+tar_add_tree(struct buf *b, const char *path, const char *name,
+	     const char *exclude)
+{
+	char **entries = NULL;
+	size_t n_entries = 0, i;
+	struct dirent *e;
+	struct stat st;
+	char link[PATH_MAX];
+	ssize_t len;
+	DIR *d;
+	int ret = 0;
+
+	if (lstat(path, &st)) {
+		fprintf(stderr, "*** Error: Cannot stat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	switch (st.st_mode & S_IFMT) {
+	case S_IFREG:
+		return tar_add_file(b, path, name, &st);
+	case S_IFLNK:
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len < 0) {
+			fprintf(stderr, "*** Error: Cannot read link %s\n", path);
+			return -1;
+		}
+		link[len] = 0;
+		tar_add(b, name, &st, '2', link, 0);
+		return 0;
+	case S_IFCHR:
+		tar_add(b, name, &st, '3', NULL, 0);
+		return 0;
+	case S_IFBLK:
+		tar_add(b, name, &st, '4', NULL, 0);
+		return 0;
+	case S_IFIFO:
+		tar_add(b, name, &st, '6', NULL, 0);
+		return 0;
+	case S_IFDIR:
+		break;
+	default:
+		fprintf(stderr, "%s: %s: socket ignored\n", progname, path);
+		return 0;
+	}
+
+	tar_add(b, name, &st, '5', NULL, 0);
+
+	d = opendir(path);
+	if (!d) {
+		fprintf(stderr, "*** Error: Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while ((e = readdir(d)) != NULL) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+		if (exclude && !strcmp(e->d_name, exclude))
+			continue;
+
+		entries = xrealloc(entries, (n_entries + 1) * sizeof(*entries));
+		entries[n_entries++] = xstrdup(e->d_name);
+	}
+	closedir(d);
+
+	qsort(entries, n_entries, sizeof(*entries), name_cmp);
+
+	for (i = 0; i < n_entries; i++) {
+		size_t plen = strlen(path) + strlen(entries[i]) + 2;
+		size_t nlen = strlen(name) + strlen(entries[i]) + 2;
+		char *cpath = xrealloc(NULL, plen);
+		char *cname = xrealloc(NULL, nlen);
+		struct stat cst;
+
+		snprintf(cpath, plen, "%s/%s", path, entries[i]);
+		if (!lstat(cpath, &cst) && S_ISDIR(cst.st_mode))
+			snprintf(cname, nlen, "%s%s/", name, entries[i]);
+		else
+			snprintf(cname, nlen, "%s%s", name, entries[i]);
+
+		if (!ret)
+			ret = tar_add_tree(b, cpath, cname, exclude);
+
+		free(cpath);
+		free(cname);
+		free(entries[i]);
+	}
+	free(entries);
+
+	return ret;
+}
+
+static void
+tar_add_data(struct buf *b, const char *name, const void *data, size_t len)
+{
+	struct stat st = {
+		.st_mode = S_IFREG | 0644,
+		.st_uid = getuid(),
+		.st_gid = getgid(),
+	};
+
+	tar_add(b, name, &st, '0', NULL, len);
+	buf_add(b, data, len);
+	buf_pad(b, TAR_BLOCK);
+}
+
+static void
+tar_finish(struct buf *b)
+{
+	memset(buf_grow(b, 2 * TAR_BLOCK), 0, 2 * TAR_BLOCK);
+	buf_pad(b, TAR_RECORD);
+}
+
+static void *
+gz_worker(void *arg)
+{
+	struct gz_job *job = arg;
+
+	for (;;) {
+		size_t start, len, dict;
+		z_stream z = {};
+		struct buf *out;
+		bool last;
+		int i, ret;
+
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (i >= job->blocks)
+			break;
+
+		start = (size_t) i * GZ_BLOCK;
+		last = (i == job->blocks - 1);
+		len = last ? job->len - start : GZ_BLOCK;
+		dict = start < GZ_DICT ? start : GZ_DICT;
+		out = &job->out[i];
+
+		out->size = deflateBound(&z, len) + 16;
+		out->data = malloc(out->size);
+		if (!out->data ||
+		    deflateInit2(&z, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			job->error = true;
+			break;
+		}
+
+		if (dict)
+			deflateSetDictionary(&z, job->in + start - dict, dict);
+
+		z.next_in = (uint8_t *) job->in + start;
+		z.avail_in = len;
+		z.next_out = out->data;
+		z.avail_out = out->size;
+
+		/* a sync flush ends each block on a byte boundary without
+		 * marking it final, so the blocks can simply be concatenated */
+		ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+		if (ret != (last ? Z_STREAM_END : Z_OK) || z.avail_in)
+			job->error = true;
+
+		out->len = out->size - z.avail_out;
+		job->crc[i] = crc32(0, job->in + start, len);
+		deflateEnd(&z);
+	}
+
+	return NULL;
+}
+
+static int
+gz_compress(const struct buf *in, struct buf *out, int level)
+{
+	static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	struct gz_job job = {
+		.in = in->data,
+		.len = in->len,
+		.level = level,
+		.blocks = in->len ? (in->len + GZ_BLOCK - 1) / GZ_BLOCK : 1,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t *threads;
+	int n_threads, i;
+	uint32_t crc = 0;
+	uint8_t trailer[8];
+
+	job.out = xrealloc(NULL, job.blocks * sizeof(*job.out));
+	job.crc = xrealloc(NULL, job.blocks * sizeof(*job.crc));
+	memset(job.out, 0, job.blocks * sizeof(*job.out));
+
+	n_threads = jobs < job.blocks ? jobs : job.blocks;
+	threads = xrealloc(NULL, n_threads * sizeof(*threads));
+	for (i = 1; i < n_threads; i++)
+		if (pthread_create(&threads[i], NULL, gz_worker, &job))
+			n_threads = i;
+
+	gz_worker(&job);
+	for (i = 1; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	buf_add(out, header, sizeof(header));
+	for (i = 0; i < job.blocks; i++) {
+		size_t len = (i == job.blocks - 1) ? in->len - (size_t) i * GZ_BLOCK : GZ_BLOCK;
+
+		buf_add(out, job.out[i].data, job.out[i].len);
+		crc = crc32_combine(crc, job.crc[i], len);
+		free(job.out[i].data);
+	}
+
+	for (i = 0; i < 4; i++) {
+		trailer[i] = crc >> (8 * i);
+		trailer[i + 4] = in->len >> (8 * i);
+	}
+	buf_add(out, trailer, sizeof(trailer));
+
+	free(job.out);
+	free(job.crc);
+
+	return job.error ? -1 : 0;
+}
+
+/* value of the first "field: value" line of a control file */
+static char *
+control_field(const char *control, const char *field)
+{
+	size_t flen = strlen(field);
+	const char *p = control;
+	size_t len;
+
+	while (p && *p) {
+		if (!strncmp(p, field, flen) && p[flen] == ':') {
+			p += flen + 1;
+			p += strspn(p, " \t");
+			len = strcspn(p, "\n");
+			return strndup(p, len);
+		}
+
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+
+	return xstrdup("");
+}
+
+static void
+find_files(const char *pkg_dir, const char *path, struct buf *out)
+{
+	char **entries = NULL;
+	size_t n_entries = 0, i;
+	struct dirent *e;
+	struct stat st;
+	DIR *d;
+
+	if (lstat(path, &st)) {
+		fprintf(stderr, "find: '%s': %s\n", path, strerror(errno));
+		return;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		const char *rel = path + strlen(pkg_dir);
+
+		buf_add(out, rel, strlen(rel));
+		buf_add(out, "\n", 1);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode) || !(d = opendir(path)))
+		return;
+
+	while ((e = readdir(d)) != NULL) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+
+		entries = xrealloc(entries, (n_entries + 1) * sizeof(*entries));
+		entries[n_entries++] = xstrdup(e->d_name);
+	}
+	closedir(d);
+
+	qsort(entries, n_entries, sizeof(*entries), name_cmp);
+
+	for (i = 0; i < n_entries; i++) {
+		size_t len = strlen(path) + strlen(entries[i]) + 2;
+		char *child = xrealloc(NULL, len);
+
+		snprintf(child, len, "%s/%s", path, entries[i]);
+		find_files(pkg_dir, child, out);
+		free(child);
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+/* expand directories in CONTROL/conffiles to the regular files they hold */
+static void
+resolve_conffiles(const char *pkg_dir)
+{
+	struct buf in = {}, out = {};
+	char path[PATH_MAX];
+	char *line, *next, *end;
+
+	snprintf(path, sizeof(path), "%s/CONTROL/conffiles", pkg_dir);
+	if (read_file(path, &in))
+		return;
+	buf_add(&in, "", 1);
+	end = (char *) in.data + in.len - 1;
+
+	for (line = (char *) in.data; line && line < end; line = next) {
+		char file[PATH_MAX];
+		size_t len;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		/* directories are listed as /etc/config/, like find drop the slash */
+		len = strlen(line);
+		while (len > 1 && line[len - 1] == '/')
+			line[--len] = 0;
+
+		if (!*line)
+			continue;
+
+		snprintf(file, sizeof(file), "%s%s%s", pkg_dir,
+			 *line == '/' ? "/" : "", line + (*line == '/'));
+		find_files(pkg_dir, file, &out);
+	}
+
+	unlink(path);
+	if (out.len && write_file(path, out.data, out.len, 0644))
+		fatal("*** Error: Cannot write %s\n", path);
+
+	free(in.data);
+	free(out.data);
+}
+
+static time_t
+source_timestamp(void)
+{
+	const char *epoch = getenv("SOURCE_DATE_EPOCH");
+	const char *topdir = getenv("TOPDIR");
+	char cmd[PATH_MAX + 64], line[64], path[PATH_MAX];
+	struct tm tm = {};
+	struct stat st;
+	time_t ts = 0;
+	FILE *f = NULL;
+
+	if (epoch && *epoch)
+		return strtoll(epoch, NULL, 10);
+
+	if (topdir) {
+		snprintf(path, sizeof(path), "%s/.git", topdir);
+		if (!stat(path, &st) && S_ISDIR(st.st_mode)) {
+			snprintf(cmd, sizeof(cmd), "git -C '%s' log -1 -s --format=%%ct", topdir);
+			f = popen(cmd, "r");
+		}
+
+		snprintf(path, sizeof(path), "%s/.svn", topdir);
+		if (!f && !stat(path, &st) && S_ISDIR(st.st_mode)) {
+			snprintf(cmd, sizeof(cmd), "svn info --show-item last-changed-date '%s'", topdir);
+			f = popen(cmd, "r");
+		}
+	}
+
+	if (f) {
+		if (fgets(line, sizeof(line), f)) {
+			if (strptime(line, "%Y-%m-%dT%H:%M:%S", &tm))
+				ts = timegm(&tm);
+			else
+				ts = strtoll(line, NULL, 10);
+		}
+		pclose(f);
+	}
+
+	return ts ? ts : time(NULL);
+}
+
+static void
+set_owner(const char *arg)
+{
+	struct passwd *pw;
+	char *end;
+
+	force_owner = true;
+	owner = strtoul(arg, &end, 10);
+	if (*arg && !*end)
+		return;
+
+	pw = getpwnam(arg);
+	if (!pw)
+		fatal("%s: %s: Invalid owner\n", progname, arg);
+
+	owner = pw->pw_uid;
+	snprintf(owner_name, sizeof(owner_name), "%s", arg);
+}
+
+static void
+set_group(const char *arg)
+{
+	struct group *gr;
+	char *end;
+
+	force_group = true;
+	group = strtoul(arg, &end, 10);
+	if (*arg && !*end)
+		return;
+
+	gr = getgrnam(arg);
+	if (!gr)
+		fatal("%s: %s: Invalid group\n", progname, arg);
+
+	group = gr->gr_gid;
+	snprintf(group_name, sizeof(group_name), "%s", arg);
+}
+
+static void
+set_installed_size(const char *path, struct buf *control, size_t size)
+{
+	static const char field[] = "Installed-Size: ";
+	struct buf out = {};
+	char *line, *next, *end;
+	struct stat st;
+
+	buf_add(control, "", 1);
+	end = (char *) control->data + control->len - 1;
+	for (line = (char *) control->data; line && line < end; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		if (!strncmp(line, field, sizeof(field) - 1)) {
+			char val[32];
+
+			snprintf(val, sizeof(val), "%zu", size);
+			buf_add(&out, field, sizeof(field) - 1);
+			buf_add(&out, val, strlen(val));
+		} else {
+			buf_add(&out, line, strlen(line));
+		}
+
+		if (next)
+			buf_add(&out, "\n", 1);
+	}
+
+	if (stat(path, &st) || write_file(path, out.data, out.len, st.st_mode & 07777))
+		fatal("*** Error: Cannot write %s\n", path);
+
+	free(control->data);
+	*control = out;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: %s [-c] [-C] [-j jobs] [-o owner] [-g group] <pkg_directory> [<destination_directory>]\n",
+		progname);
+}
+
+int main(int argc, char **argv)
+{
+	struct buf control = {}, tar = {}, data_gz = {}, control_gz = {}, ipk = {};
+	char path[PATH_MAX], pkg_file[PATH_MAX], tmp_file[PATH_MAX + 16];
+	const char *pkg_dir, *dest_dir = ".";
+	char *pkg, *version, *arch;
+	struct stat st;
+	int ch;
+
+	progname = argv[0];
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((ch = getopt(argc, argv, "cCg:hj:o:v")) != -1) {
+		switch (ch) {
+		case 'o':
+			set_owner(optarg);
+			break;
+		case 'g':
+			set_group(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'c':
+		case 'C':
+			break;
+		case 'v':
+			printf("1.0\n");
+			return 0;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (jobs < 1)
+		jobs = 1;
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1 || argc > 2) {
+		usage();
+		return 1;
+	}
+
+	pkg_dir = argv[0];
+	if (argc > 1)
+		dest_dir = argv[1];
+
+	if (stat(pkg_dir, &st) || !S_ISDIR(st.st_mode))
+		fatal("*** Error: Directory %s does not exist\n", pkg_dir);
+
+	snprintf(path, sizeof(path), "%s/CONTROL", pkg_dir);
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+		fatal("*** Error: Directory %s has no CONTROL subdirectory.\n", pkg_dir);
+
+	snprintf(path, sizeof(path), "%s/CONTROL/control", pkg_dir);
+	if (read_file(path, &control))
+		fatal("*** Error: Cannot read %s\n", path);
+	buf_add(&control, "", 1);
+	control.len--;
+
+	pkg = control_field((char *) control.data, "Package");
+	version = control_field((char *) control.data, "Version");
+	arch = control_field((char *) control.data, "Architecture");
+
+	/* the epoch is not part of the file name */
+	if (version[0] && version[1] == ':')
+		memmove(version, version + 2, strlen(version + 2) + 1);
+
+	if (pkg[strspn(pkg, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.+-")])
+		fatal("%s\n*** Error: Package name %s contains illegal characters, (other than [a-z0-9.+-])\n\n"
+		      "ipkg-build: Please fix the above errors and try again.\n", pkg, pkg);
+
+	resolve_conffiles(pkg_dir);
+	timestamp = source_timestamp();
+
+	snprintf(path, sizeof(path), "%s/.", pkg_dir);
+	if (tar_add_tree(&tar, path, "./", "CONTROL"))
+		return 1;
+	tar_finish(&tar);
+	if (gz_compress(&tar, &data_gz, GZ_LEVEL))
+		fatal("*** Error: Failed to compress data.tar.gz\n");
+
+	snprintf(path, sizeof(path), "%s/CONTROL/control", pkg_dir);
+	set_installed_size(path, &control, data_gz.len);
+
+	tar.len = 0;
+	snprintf(path, sizeof(path), "%s/CONTROL/.", pkg_dir);
+	if (tar_add_tree(&tar, path, "./", NULL))
+		return 1;
+	tar_finish(&tar);
+	if (gz_compress(&tar, &control_gz, GZ_LEVEL))
+		fatal("*** Error: Failed to compress control.tar.gz\n");
+
+	tar.len = 0;
+	tar_add_data(&tar, "./debian-binary", "2.0\n", 4);
+	tar_add_data(&tar, "./data.tar.gz", data_gz.data, data_gz.len);
+	tar_add_data(&tar, "./control.tar.gz", control_gz.data, control_gz.len);
+	tar_finish(&tar);
+	if (gz_compress(&tar, &ipk, Z_NO_COMPRESSION))
+		fatal("*** Error: Failed to create package\n");
+
+	snprintf(pkg_file, sizeof(pkg_file), "%s/%s_%s_%s.ipk", dest_dir, pkg, version, arch);
+	snprintf(tmp_file, sizeof(tmp_file), "%s.%d", pkg_file, getpid());
+	if (write_file(tmp_file, ipk.data, ipk.len, 0644) || rename(tmp_file, pkg_file)) {
+		unlink(tmp_file);
+		fatal("*** Error: Cannot write %s: %s\n", pkg_file, strerror(errno));
+	}
+
+	printf("Packaged contents of %s into %s\n", pkg_dir, pkg_file);
+
+	return 0;
+}
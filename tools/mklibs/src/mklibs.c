@@ -0,0 +1,1262 @@
+/*
+ * mklibs - reduce shared libraries to the symbols actually used
+ *
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * Modelled after the Debian mklibs script and the OpenWrt patches that
+ * were carried for it.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * The given directories are walked once and every dynamically linked ELF
+ * file found is read directly: DT_NEEDED and DT_SONAME from the dynamic
+ * segment, and the undefined and provided symbols of the dynamic symbol
+ * table along with their versions. Only program headers are used, so
+ * files with their section headers stripped work as well.
+ *
+ * For each library that has a <name>_pic.a archive next to it, all the
+ * symbols used from it are passed to the linker to build a reduced copy
+ * of it. A reduced library might itself need fewer symbols than the
+ * original did, so the symbol closure is recomputed with the reduced
+ * copies until no link list changes anymore.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <elf.h>
+
+#ifndef VERSYM_HIDDEN
+#define VERSYM_HIDDEN	0x8000
+#endif
+#define VERSYM_VERSION	0x7fff
+
+#define MAX_PASSES	16
+
+struct strmap {
+	char **keys;
+	int *vals;
+	size_t size;
+	size_t count;
+};
+
+struct undef {
+	char *name;
+	bool weak;
+};
+
+struct object {
+	struct object *next;
+	char *path;
+	char *soname;
+	char **needed;
+	int n_needed;
+	struct undef *undef;
+	int n_undef;
+	struct strmap provided;
+	bool is_lib;
+};
+
+struct library {
+	struct library *next;
+	struct object *obj;
+	char *name;		/* soname, or the file name without one */
+	char *pic;
+	char *map;
+	char *reduced;		/* output path, once it has been built */
+	struct strmap used;
+	char *linked;		/* link list of the last build */
+};
+
+struct elf {
+	const uint8_t *data;
+	size_t size;
+	bool is64;
+	bool swap;
+};
+
+static struct object *objects;
+static struct library *libraries;
+
+static const char *sysroot = "";
+static const char *dest_path;
+static const char *target = "";
+static const char *ldlib;
+static char **lib_path;
+static int n_lib_path;
+static int verbose;
+
+static void __attribute__((noreturn))
+fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "mklibs: ");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr && size)
+		fatal("out of memory\n");
+
+	return ptr;
+}
+
+static char *
+xstrdup(const char *s)
+{
+	return strcpy(xrealloc(NULL, strlen(s) + 1), s);
+}
+
+static char *
+xasprintf(const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	s = xrealloc(NULL, len + 1);
+	va_start(ap, fmt);
+	vsnprintf(s, len + 1, fmt, ap);
+	va_end(ap);
+
+	return s;
+}
+
+static uint32_t
+str_hash(const char *s)
+{
+	uint32_t h = 5381;
+
+	while (*s)
+		h = h * 33 + (uint8_t) *s++;
+
+	return h;
+}
+
+static size_t
+strmap_slot(const struct strmap *m, const char *key)
+{
+	size_t i = str_hash(key) & (m->size - 1);
+
+	while (m->keys[i] && strcmp(m->keys[i], key))
+		i = (i + 1) & (m->size - 1);
+
+	return i;
+}
+
+static int *
+strmap_lookup(const struct strmap *m, const char *key)
+{
+	size_t i;
+
+	if (!m->size)
+		return NULL;
+
+	i = strmap_slot(m, key);
+	return m->keys[i] ? &m->vals[i] : NULL;
+}
+
+/* returns the value slot of key, adding it with val when it is new */
+static int *
+strmap_add(struct strmap *m, const char *key, int val)
+{
+	size_t i;
+
+	if ((m->count + 1) * 2 > m->size) {
+		struct strmap n = { .size = m->size ? m->size * 2 : 64 };
+
+		n.keys = xrealloc(NULL, n.size * sizeof(*n.keys));
+		n.vals = xrealloc(NULL, n.size * sizeof(*n.vals));
+		memset(n.keys, 0, n.size * sizeof(*n.keys));
+
+		for (i = 0; i < m->size; i++) {
+			if (m->keys[i]) {
+				size_t j = strmap_slot(&n, m->keys[i]);
+
+				n.keys[j] = m->keys[i];
+				n.vals[j] = m->vals[i];
+			}
+		}
+		n.count = m->count;
+
+		free(m->keys);
+		free(m->vals);
+		*m = n;
+	}
+
+	i = strmap_slot(m, key);
+	if (!m->keys[i]) {
+		m->keys[i] = xstrdup(key);
+		m->vals[i] = val;
+		m->count++;
+	}
+
+	return &m->vals[i];
+}
+
+static void
+strmap_free(struct strmap *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->size; i++)
+		free(m->keys[i]);
+	free(m->keys);
+	free(m->vals);
+	memset(m, 0, sizeof(*m));
+}
+
+static int
+str_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* sorted keys of a map, NULL terminated */
+static char **
+strmap_keys(const struct strmap *m)
+{
+	char **keys = xrealloc(NULL, (m->count + 1) * sizeof(*keys));
+	size_t i, n = 0;
+
+	for (i = 0; i < m->size; i++)
+		if (m->keys[i])
+			keys[n++] = m->keys[i];
+	keys[n] = NULL;
+
+	qsort(keys, n, sizeof(*keys), str_cmp);
+
+	return keys;
+}
+
+static uint64_t
+rd(const struct elf *e, const void *p, size_t len)
+{
+	uint8_t b[8];
+	uint64_t v = 0;
+	size_t i;
+
+	memcpy(b, p, len);
+	for (i = 0; i < len; i++) {
+		if (e->swap)
+			v |= (uint64_t) b[i] << (8 * (len - 1 - i));
+		else
+			v |= (uint64_t) b[i] << (8 * i);
+	}
+
+	return v;
+}
+
+#define ELF_FIELD(e, type, p, field) \
+	((e)->is64 ? \
+	 rd(e, &((const Elf64_##type *)(p))->field, sizeof(((Elf64_##type *) 0)->field)) : \
+	 rd(e, &((const Elf32_##type *)(p))->field, sizeof(((Elf32_##type *) 0)->field)))
+
+#define ELF_SIZE(e, type) \
+	((e)->is64 ? sizeof(Elf64_##type) : sizeof(Elf32_##type))
+
+/* file data at a virtual address, with at least len bytes */
+static const uint8_t *
+elf_ptr(const struct elf *e, uint64_t addr, uint64_t len)
+{
+	uint64_t phoff = ELF_FIELD(e, Ehdr, e->data, e_phoff);
+	int phnum = ELF_FIELD(e, Ehdr, e->data, e_phnum);
+	int phentsize = ELF_FIELD(e, Ehdr, e->data, e_phentsize);
+	int i;
+
+	for (i = 0; i < phnum; i++) {
+		const uint8_t *ph = e->data + phoff + i * phentsize;
+		uint64_t vaddr, offset, filesz;
+
+		if (ELF_FIELD(e, Phdr, ph, p_type) != PT_LOAD)
+			continue;
+
+		vaddr = ELF_FIELD(e, Phdr, ph, p_vaddr);
+		offset = ELF_FIELD(e, Phdr, ph, p_offset);
+		filesz = ELF_FIELD(e, Phdr, ph, p_filesz);
+
+		if (addr < vaddr || addr - vaddr >= filesz)
+			continue;
+
+		if (addr - vaddr + len > filesz || offset + (addr - vaddr) + len > e->size)
+			return NULL;
+
+		return e->data + offset + (addr - vaddr);
+	}
+
+	return NULL;
+}
+
+static const char *
+elf_str(const uint8_t *strtab, uint64_t strsz, uint64_t off)
+{
+	if (!strtab || off >= strsz || !memchr(strtab + off, 0, strsz - off))
+		return NULL;
+
+	return (const char *) strtab + off;
+}
+
+/* number of dynamic symbols, from DT_HASH or DT_GNU_HASH */
+static uint64_t
+elf_nsyms(const struct elf *e, uint64_t hash, uint64_t gnu_hash)
+{
+	const uint8_t *p, *buckets;
+	uint64_t chains;
+	uint32_t nbuckets, symoffset, bloom_size, max = 0, i;
+
+	if (hash && (p = elf_ptr(e, hash, 8)) != NULL)
+		return rd(e, p + 4, 4);
+
+	if (!gnu_hash || !(p = elf_ptr(e, gnu_hash, 16)))
+		return 0;
+
+	nbuckets = rd(e, p, 4);
+	symoffset = rd(e, p + 4, 4);
+	bloom_size = rd(e, p + 8, 4);
+
+	chains = gnu_hash + 16 + (uint64_t) bloom_size * (e->is64 ? 8 : 4);
+	buckets = elf_ptr(e, chains, (uint64_t) nbuckets * 4);
+	if (!buckets)
+		return 0;
+	chains += (uint64_t) nbuckets * 4;
+
+	for (i = 0; i < nbuckets; i++) {
+		uint32_t b = rd(e, buckets + i * 4, 4);
+
+		if (b > max)
+			max = b;
+	}
+
+	if (max < symoffset)
+		return symoffset;
+
+	/* walk the chain of the last bucket to its end marker */
+	for (;;) {
+		const uint8_t *c = elf_ptr(e, chains + (uint64_t) (max - symoffset) * 4, 4);
+
+		if (!c || (rd(e, c, 4) & 1))
+			break;
+		max++;
+	}
+
+	return max + 1;
+}
+
+/* name of version index idx, from the definitions or the requirements */
+static const char *
+elf_version(const struct elf *e, const uint8_t *strtab, uint64_t strsz,
+	    uint64_t verdef, uint64_t verdefnum, uint64_t verneed,
+	    uint64_t verneednum, unsigned int idx, bool def)
+{
+	const uint8_t *p;
+	uint64_t addr, i, j;
+
+	if (def) {
+		for (addr = verdef, i = 0; verdef && i < verdefnum; i++) {
+			p = elf_ptr(e, addr, sizeof(Elf32_Verdef));
+			if (!p)
+				break;
+
+			if (rd(e, &((Elf32_Verdef *) p)->vd_ndx, 2) == idx) {
+				const uint8_t *aux;
+
+				if (rd(e, &((Elf32_Verdef *) p)->vd_flags, 2) & VER_FLG_BASE)
+					return NULL;
+
+				aux = elf_ptr(e, addr + rd(e, &((Elf32_Verdef *) p)->vd_aux, 4),
+					      sizeof(Elf32_Verdaux));
+				if (!aux)
+					return NULL;
+
+				return elf_str(strtab, strsz,
+					       rd(e, &((Elf32_Verdaux *) aux)->vda_name, 4));
+			}
+
+			if (!rd(e, &((Elf32_Verdef *) p)->vd_next, 4))
+				break;
+			addr += rd(e, &((Elf32_Verdef *) p)->vd_next, 4);
+		}
+
+		return NULL;
+	}
+
+	for (addr = verneed, i = 0; verneed && i < verneednum; i++) {
+		uint64_t aux;
+
+		p = elf_ptr(e, addr, sizeof(Elf32_Verneed));
+		if (!p)
+			break;
+
+		aux = addr + rd(e, &((Elf32_Verneed *) p)->vn_aux, 4);
+		for (j = 0; j < rd(e, &((Elf32_Verneed *) p)->vn_cnt, 2); j++) {
+			const uint8_t *a = elf_ptr(e, aux, sizeof(Elf32_Vernaux));
+
+			if (!a)
+				break;
+
+			if (rd(e, &((Elf32_Vernaux *) a)->vna_other, 2) == idx)
+				return elf_str(strtab, strsz,
+					       rd(e, &((Elf32_Vernaux *) a)->vna_name, 4));
+
+			if (!rd(e, &((Elf32_Vernaux *) a)->vna_next, 4))
+				break;
+			aux += rd(e, &((Elf32_Vernaux *) a)->vna_next, 4);
+		}
+
+		if (!rd(e, &((Elf32_Verneed *) p)->vn_next, 4))
+			break;
+		addr += rd(e, &((Elf32_Verneed *) p)->vn_next, 4);
+	}
+
+	return NULL;
+}
+
+static void
+object_add_undef(struct object *obj, const char *name, bool weak)
+{
+	obj->undef = xrealloc(obj->undef, (obj->n_undef + 1) * sizeof(*obj->undef));
+	obj->undef[obj->n_undef].name = xstrdup(name);
+	obj->undef[obj->n_undef].weak = weak;
+	obj->n_undef++;
+}
+
+static int
+elf_parse(struct object *obj, const struct elf *e)
+{
+	uint64_t strtab = 0, strsz = 0, symtab = 0, syment = 0, hash = 0, gnu_hash = 0;
+	uint64_t versym = 0, verdef = 0, verdefnum = 0, verneed = 0, verneednum = 0;
+	uint64_t phoff, dynoff = 0, dynsz = 0, soname = 0, nsyms, i;
+	const uint8_t *str, *dyn;
+	int phnum, phentsize, n;
+	uint64_t *needed = NULL;
+	int n_needed = 0;
+
+	phoff = ELF_FIELD(e, Ehdr, e->data, e_phoff);
+	phnum = ELF_FIELD(e, Ehdr, e->data, e_phnum);
+	phentsize = ELF_FIELD(e, Ehdr, e->data, e_phentsize);
+
+	if (phentsize < (int) ELF_SIZE(e, Phdr) || phoff + (uint64_t) phnum * phentsize > e->size)
+		return -1;
+
+	for (n = 0; n < phnum; n++) {
+		const uint8_t *ph = e->data + phoff + n * phentsize;
+
+		if (ELF_FIELD(e, Phdr, ph, p_type) == PT_DYNAMIC) {
+			dynoff = ELF_FIELD(e, Phdr, ph, p_offset);
+			dynsz = ELF_FIELD(e, Phdr, ph, p_filesz);
+		}
+	}
+
+	if (!dynsz || dynoff + dynsz > e->size)
+		return -1;
+
+	for (dyn = e->data + dynoff; dyn + ELF_SIZE(e, Dyn) <= e->data + dynoff + dynsz;
+	     dyn += ELF_SIZE(e, Dyn)) {
+		uint64_t val = ELF_FIELD(e, Dyn, dyn, d_un.d_val);
+
+		switch (ELF_FIELD(e, Dyn, dyn, d_tag)) {
+		case DT_NULL:
+			dyn = e->data + dynoff + dynsz;
+			break;
+		case DT_NEEDED:
+			needed = xrealloc(needed, (n_needed + 1) * sizeof(*needed));
+			needed[n_needed++] = val;
+			break;
+		case DT_SONAME:
+			soname = val;
+			break;
+		case DT_STRTAB:
+			strtab = val;
+			break;
+		case DT_STRSZ:
+			strsz = val;
+			break;
+		case DT_SYMTAB:
+			symtab = val;
+			break;
+		case DT_SYMENT:
+			syment = val;
+			break;
+		case DT_HASH:
+			hash = val;
+			break;
+		case DT_GNU_HASH:
+			gnu_hash = val;
+			break;
+		case DT_VERSYM:
+			versym = val;
+			break;
+		case DT_VERDEF:
+			verdef = val;
+			break;
+		case DT_VERDEFNUM:
+			verdefnum = val;
+			break;
+		case DT_VERNEED:
+			verneed = val;
+			break;
+		case DT_VERNEEDNUM:
+			verneednum = val;
+			break;
+		}
+		if (dyn >= e->data + dynoff + dynsz)
+			break;
+	}
+
+	str = elf_ptr(e, strtab, strsz);
+	if (!str) {
+		free(needed);
+		return -1;
+	}
+
+	for (n = 0; n < n_needed; n++) {
+		const char *name = elf_str(str, strsz, needed[n]);
+
+		if (!name)
+			continue;
+
+		obj->needed = xrealloc(obj->needed, (obj->n_needed + 1) * sizeof(*obj->needed));
+		obj->needed[obj->n_needed++] = xstrdup(name);
+	}
+	free(needed);
+
+	if (soname && elf_str(str, strsz, soname))
+		obj->soname = xstrdup(elf_str(str, strsz, soname));
+
+	if (!syment)
+		syment = ELF_SIZE(e, Sym);
+
+	nsyms = elf_nsyms(e, hash, gnu_hash);
+	for (i = 1; symtab && i < nsyms; i++) {
+		const uint8_t *sym = elf_ptr(e, symtab + i * syment, ELF_SIZE(e, Sym));
+		const uint8_t *vs = versym ? elf_ptr(e, versym + i * 2, 2) : NULL;
+		unsigned int info, type, bind, shndx, ver = 0;
+		const char *name, *version = NULL;
+		char buf[512];
+
+		if (!sym)
+			break;
+
+		info = ELF_FIELD(e, Sym, sym, st_info);
+		shndx = ELF_FIELD(e, Sym, sym, st_shndx);
+		type = ELF32_ST_TYPE(info);
+		bind = ELF32_ST_BIND(info);
+
+		if (bind != STB_GLOBAL && bind != STB_WEAK)
+			continue;
+		if (shndx == SHN_ABS)
+			continue;
+		if (type != STT_NOTYPE && type != STT_OBJECT && type != STT_FUNC &&
+		    type != STT_GNU_IFUNC && type != STT_COMMON && type != STT_TLS)
+			continue;
+
+		name = elf_str(str, strsz, ELF_FIELD(e, Sym, sym, st_name));
+		if (!name || !*name)
+			continue;
+
+		if (vs)
+			ver = rd(e, vs, 2);
+		if ((ver & VERSYM_VERSION) > 1)
+			version = elf_version(e, str, strsz, verdef, verdefnum,
+					      verneed, verneednum, ver & VERSYM_VERSION,
+					      shndx != SHN_UNDEF);
+
+		if (shndx == SHN_UNDEF) {
+			if (version) {
+				snprintf(buf, sizeof(buf), "%s@%s", name, version);
+				name = buf;
+			}
+			object_add_undef(obj, name, bind == STB_WEAK);
+			continue;
+		}
+
+		/* the default version also answers unversioned references */
+		if (!version || !(ver & VERSYM_HIDDEN))
+			strmap_add(&obj->provided, name, 0);
+		if (version) {
+			snprintf(buf, sizeof(buf), "%s@%s", name, version);
+			strmap_add(&obj->provided, buf, 0);
+		}
+	}
+
+	return 0;
+}
+
+static struct object *
+object_load(const char *path, bool quiet)
+{
+	struct object *obj;
+	struct elf e = {};
+	struct stat st;
+	void *map;
+	int fd, type;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (!quiet)
+			fprintf(stderr, "mklibs: %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < EI_NIDENT + (off_t) sizeof(Elf32_Ehdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	e.data = map;
+	e.size = st.st_size;
+
+	if (memcmp(e.data, ELFMAG, SELFMAG) ||
+	    (e.data[EI_CLASS] != ELFCLASS32 && e.data[EI_CLASS] != ELFCLASS64) ||
+	    (e.data[EI_DATA] != ELFDATA2LSB && e.data[EI_DATA] != ELFDATA2MSB)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	e.is64 = e.data[EI_CLASS] == ELFCLASS64;
+	e.swap = e.data[EI_DATA] == ELFDATA2MSB;
+
+	if (e.is64 && e.size < sizeof(Elf64_Ehdr)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	type = ELF_FIELD(&e, Ehdr, e.data, e_type);
+	if (type != ET_EXEC && type != ET_DYN) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	obj = xrealloc(NULL, sizeof(*obj));
+	memset(obj, 0, sizeof(*obj));
+	obj->path = xstrdup(path);
+	obj->is_lib = (type == ET_DYN);
+
+	if (elf_parse(obj, &e)) {
+		/* statically linked, nothing to do with it */
+		strmap_free(&obj->provided);
+		free(obj->path);
+		free(obj);
+		obj = NULL;
+	}
+
+	munmap(map, st.st_size);
+	return obj;
+}
+
+static void
+object_free(struct object *obj)
+{
+	int i;
+
+	for (i = 0; i < obj->n_needed; i++)
+		free(obj->needed[i]);
+	for (i = 0; i < obj->n_undef; i++)
+		free(obj->undef[i].name);
+	free(obj->needed);
+	free(obj->undef);
+	free(obj->soname);
+	free(obj->path);
+	strmap_free(&obj->provided);
+	free(obj);
+}
+
+static void
+lib_path_add(const char *dir)
+{
+	int i;
+
+	for (i = 0; i < n_lib_path; i++)
+		if (!strcmp(lib_path[i], dir))
+			return;
+
+	lib_path = xrealloc(lib_path, (n_lib_path + 1) * sizeof(*lib_path));
+	lib_path[n_lib_path++] = xstrdup(dir);
+}
+
+static void
+walk(const char *path)
+{
+	char **entries = NULL;
+	size_t n = 0, i;
+	struct object *obj;
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	if (lstat(path, &st))
+		return;
+
+	if (S_ISREG(st.st_mode)) {
+		obj = object_load(path, false);
+		if (!obj)
+			return;
+
+		obj->next = objects;
+		objects = obj;
+
+		/* directories holding shared libraries are searched for NEEDED */
+		if (obj->is_lib && strstr(path, ".so") && !strncmp(path, sysroot, strlen(sysroot))) {
+			char *dir = xstrdup(path + strlen(sysroot));
+			char *slash = strrchr(dir, '/');
+
+			if (slash) {
+				*slash = 0;
+				lib_path_add(*dir ? dir : "/");
+			}
+			free(dir);
+		}
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode) || !(dir = opendir(path)))
+		return;
+
+	while ((d = readdir(dir)) != NULL) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		entries = xrealloc(entries, (n + 1) * sizeof(*entries));
+		entries[n++] = xasprintf("%s/%s", path, d->d_name);
+	}
+	closedir(dir);
+
+	qsort(entries, n, sizeof(*entries), str_cmp);
+	for (i = 0; i < n; i++) {
+		walk(entries[i]);
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+/* resolve a path inside the sysroot, following links relative to it */
+static char *
+sysroot_resolve(const char *path)
+{
+	char *cur = xasprintf("%s%s", sysroot, path);
+	char link[PATH_MAX];
+	struct stat st;
+	int depth;
+
+	for (depth = 0; depth < 16; depth++) {
+		ssize_t len;
+		char *next;
+
+		if (lstat(cur, &st)) {
+			free(cur);
+			return NULL;
+		}
+
+		if (!S_ISLNK(st.st_mode))
+			return cur;
+
+		len = readlink(cur, link, sizeof(link) - 1);
+		if (len < 0)
+			break;
+		link[len] = 0;
+
+		if (link[0] == '/') {
+			next = xasprintf("%s%s", sysroot, link);
+		} else {
+			char *slash = strrchr(cur, '/');
+
+			*slash = 0;
+			next = xasprintf("%s/%s", cur, link);
+		}
+
+		free(cur);
+		cur = next;
+	}
+
+	free(cur);
+	return NULL;
+}
+
+static char *
+find_lib(const char *name)
+{
+	char *path, *found;
+	int i;
+
+	if (name[0] == '/')
+		return sysroot_resolve(name);
+
+	for (i = 0; i < n_lib_path; i++) {
+		path = xasprintf("%s/%s", lib_path[i], name);
+		found = sysroot_resolve(path);
+		free(path);
+
+		if (found)
+			return found;
+	}
+
+	return NULL;
+}
+
+/* libfoo.so.1 -> libfoo<suffix>, searched in the library path */
+static char *
+find_pic(const char *file, const char *suffix)
+{
+	const char *base = strrchr(file, '/');
+	const char *p;
+	char *name, *found;
+
+	base = base ? base + 1 : file;
+	p = strstr(base, ".so");
+	if (!p)
+		return NULL;
+
+	name = xasprintf("%.*s%s", (int) (p - base), base, suffix);
+	found = find_lib(name);
+	free(name);
+
+	return found;
+}
+
+static struct library *
+library_get(const char *name)
+{
+	struct library *lib;
+	struct object *obj;
+	char *path;
+
+	path = find_lib(name);
+	if (!path) {
+		if (verbose)
+			fprintf(stderr, "mklibs: library %s not found\n", name);
+		return NULL;
+	}
+
+	for (lib = libraries; lib; lib = lib->next) {
+		if (!strcmp(lib->obj->path, path)) {
+			free(path);
+			return lib;
+		}
+	}
+
+	obj = object_load(path, false);
+	if (!obj) {
+		free(path);
+		return NULL;
+	}
+
+	lib = xrealloc(NULL, sizeof(*lib));
+	memset(lib, 0, sizeof(*lib));
+	lib->obj = obj;
+	lib->name = xstrdup(obj->soname ? obj->soname : strrchr(path, '/') + 1);
+	lib->pic = find_pic(lib->name, "_pic.a");
+	if (lib->pic)
+		lib->map = find_pic(lib->name, "_pic.map");
+	lib->next = libraries;
+	libraries = lib;
+
+	free(path);
+	return lib;
+}
+
+/* all libraries needed by obj, recursively */
+static void
+library_depends(struct object *obj, int depth)
+{
+	struct library *lib;
+	int i;
+
+	if (depth > 32)
+		return;
+
+	for (i = 0; i < obj->n_needed; i++) {
+		bool known = false;
+
+		for (lib = libraries; lib; lib = lib->next)
+			if (lib->obj->soname && !strcmp(lib->obj->soname, obj->needed[i]))
+				known = true;
+
+		if (known)
+			continue;
+
+		lib = library_get(obj->needed[i]);
+		if (lib)
+			library_depends(lib->obj, depth + 1);
+	}
+}
+
+static void
+needed_add(struct strmap *needed, struct object *obj)
+{
+	int i;
+
+	for (i = 0; i < obj->n_undef; i++) {
+		int *weak = strmap_add(needed, obj->undef[i].name, obj->undef[i].weak);
+
+		if (!obj->undef[i].weak)
+			*weak = 0;
+	}
+}
+
+static int
+run(char **argv)
+{
+	int status, i;
+	pid_t pid;
+
+	if (verbose) {
+		for (i = 0; argv[i]; i++)
+			fprintf(stderr, "%s%s", i ? " " : "", argv[i]);
+		fprintf(stderr, "\n");
+	}
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (!pid) {
+		execvp(argv[0], argv);
+		fprintf(stderr, "mklibs: %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static char *
+libc_extra(const char *name)
+{
+	char *path = xasprintf("%s/usr/lib/libc_pic/%s", sysroot, name);
+
+	if (access(path, F_OK)) {
+		free(path);
+		return NULL;
+	}
+
+	return path;
+}
+
+/* link a reduced copy of lib, exporting the symbols in lib->used */
+static int
+library_reduce(struct library *lib)
+{
+	const char *soname = lib->obj->soname ? lib->obj->soname : lib->name;
+	char **argv = NULL, **syms, *soinit = NULL, *sofini = NULL, *libgcc;
+	char *list, *p;
+	size_t len = 1;
+	int argc = 0, ret, i;
+
+#define ARG(x) do { \
+		argv = xrealloc(argv, (argc + 2) * sizeof(*argv)); \
+		argv[argc++] = (x); \
+		argv[argc] = NULL; \
+	} while (0)
+
+	if (!strncmp(soname, "libc.so.", 8)) {
+		soinit = libc_extra("soinit.o");
+		sofini = libc_extra("sofini.o");
+		if (soinit && sofini)
+			strmap_add(&lib->used, "__dso_handle", 0);
+	}
+
+	if (!strcmp(soname, "libc.so.0")) {
+		strmap_add(&lib->used, "__uClibc_init", 0);
+		strmap_add(&lib->used, "__uClibc_fini", 0);
+	}
+
+	if (!strcmp(soname, "libpthread.so.0"))
+		strmap_add(&lib->used, "__pthread_initialize_minimal_internal", 0);
+
+	/* nothing to do when the link list did not change */
+	syms = strmap_keys(&lib->used);
+	for (i = 0; syms[i]; i++)
+		len += strlen(syms[i]) + 1;
+	list = p = xrealloc(NULL, len);
+	for (i = 0; syms[i]; i++)
+		p += sprintf(p, "%s\n", syms[i]);
+	*p = 0;
+
+	if (lib->linked && !strcmp(lib->linked, list)) {
+		free(list);
+		free(syms);
+		free(soinit);
+		free(sofini);
+		return 0;
+	}
+
+	ARG(xasprintf("%sgcc", target));
+	ARG(xstrdup("-nostdlib"));
+	ARG(xstrdup("-nostartfiles"));
+	ARG(xstrdup("-shared"));
+	ARG(xstrdup("-Wl,--gc-sections"));
+	ARG(xasprintf("-Wl,-soname=%s", soname));
+	for (i = 0; syms[i]; i++) {
+		char *at = strchr(syms[i], '@');
+
+		ARG(xasprintf("-u%.*s", at ? (int) (at - syms[i]) : (int) strlen(syms[i]), syms[i]));
+	}
+	ARG(xstrdup("-o"));
+	ARG(xasprintf("%s/%s-so", dest_path, lib->name));
+
+	if (soinit && sofini)
+		ARG(xstrdup(soinit));
+	if (!strcmp(soname, "libc.so.0"))
+		ARG(xstrdup("-Wl,-init,__uClibc_init"));
+
+	ARG(xstrdup(lib->pic));
+
+	if (soinit && sofini)
+		ARG(xstrdup(sofini));
+	if (!strcmp(soname, "libpthread.so.0"))
+		ARG(xstrdup("-Wl,-z,nodelete,-z,initfirst,-init=__pthread_initialize_minimal_internal"));
+	if (lib->map)
+		ARG(xasprintf("-Wl,--version-script=%s", lib->map));
+
+	ARG(xasprintf("-L%s", dest_path));
+	for (i = 0; i < n_lib_path; i++)
+		ARG(xasprintf("-L%s%s", sysroot, lib_path[i]));
+
+	if (strcmp(soname, "libgcc_s.so.1") != 0) {
+		/* link against the reduced dependencies where there are any */
+		for (i = 0; i < lib->obj->n_needed; i++) {
+			struct library *dep;
+			char *path = NULL;
+
+			for (dep = libraries; dep && !path; dep = dep->next)
+				if (dep->reduced && dep->obj->soname &&
+				    !strcmp(dep->obj->soname, lib->obj->needed[i]))
+					path = xstrdup(dep->reduced);
+
+			if (!path)
+				path = find_lib(lib->obj->needed[i]);
+			if (path)
+				ARG(path);
+		}
+
+		libgcc = find_lib("libgcc_s.so.1");
+		if (libgcc)
+			ARG(libgcc);
+	}
+#undef ARG
+
+	ret = run(argv);
+	if (ret)
+		fprintf(stderr, "mklibs: failed to link %s\n", lib->name);
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+	free(syms);
+	free(soinit);
+	free(sofini);
+
+	if (ret) {
+		free(list);
+		return -1;
+	}
+
+	free(lib->linked);
+	lib->linked = list;
+
+	if (!lib->reduced)
+		lib->reduced = xasprintf("%s/%s-so", dest_path, lib->name);
+
+	return 1;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <dir|file>...\n"
+		"  -d, --dest-dir DIRECTORY     create libraries in DIRECTORY\n"
+		"  -D, --no-default-lib         omit default libpath (/lib:/usr/lib)\n"
+		"  -L DIRECTORY[:DIRECTORY]...  add DIRECTORY(s) to the library search path\n"
+		"      --ldlib LDLIB            use LDLIB for the dynamic linker\n"
+		"      --sysroot ROOT           prepend ROOT to all paths for libraries\n"
+		"      --target TARGET          prepend TARGET- to the gcc command\n"
+		"  -v, --verbose                explain what is being done\n"
+		"\n"
+		"Directories are searched for dynamically linked ELF files.\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{ "dest-dir", required_argument, NULL, 'd' },
+		{ "no-default-lib", no_argument, NULL, 'D' },
+		{ "ldlib", required_argument, NULL, 'l' },
+		{ "sysroot", required_argument, NULL, 's' },
+		{ "target", required_argument, NULL, 't' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{}
+	};
+	bool default_lib = true;
+	struct library *lib;
+	struct object *obj;
+	int ch, pass, i;
+
+	while ((ch = getopt_long(argc, argv, "d:DL:vh", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'd':
+			dest_path = optarg;
+			break;
+		case 'D':
+			default_lib = false;
+			break;
+		case 'L': {
+			char *dirs = xstrdup(optarg), *dir, *save;
+
+			for (dir = strtok_r(dirs, ":", &save); dir; dir = strtok_r(NULL, ":", &save))
+				lib_path_add(dir);
+			free(dirs);
+			break;
+		}
+		case 'l':
+			ldlib = optarg;
+			break;
+		case 's':
+			sysroot = optarg;
+			break;
+		case 't':
+			target = xasprintf("%s-", optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!dest_path || optind >= argc)
+		usage(argv[0]);
+
+	if (default_lib) {
+		lib_path_add("/lib");
+		lib_path_add("/usr/lib");
+	}
+
+	for (i = optind; i < argc; i++)
+		walk(argv[i]);
+
+	for (obj = objects; obj; obj = obj->next)
+		library_depends(obj, 0);
+	if (ldlib)
+		library_get(ldlib);
+
+	for (pass = 1; pass <= MAX_PASSES; pass++) {
+		struct strmap needed = {};
+		char **names;
+		int changed = 0;
+
+		if (verbose)
+			fprintf(stderr, "mklibs: pass %d\n", pass);
+
+		/* symbols needed by all objects, including the reduced libraries */
+		for (obj = objects; obj; obj = obj->next)
+			needed_add(&needed, obj);
+		for (lib = libraries; lib; lib = lib->next) {
+			if (!lib->reduced)
+				continue;
+
+			obj = object_load(lib->reduced, false);
+			if (!obj)
+				fatal("cannot read %s\n", lib->reduced);
+			needed_add(&needed, obj);
+			object_free(obj);
+		}
+
+		/* which of them every library provides */
+		names = strmap_keys(&needed);
+		for (lib = libraries; lib; lib = lib->next) {
+			if (!lib->pic)
+				continue;
+
+			strmap_free(&lib->used);
+			for (i = 0; names[i]; i++)
+				if (strmap_lookup(&lib->obj->provided, names[i]))
+					strmap_add(&lib->used, names[i], 0);
+		}
+
+		if (verbose) {
+			for (i = 0; names[i]; i++) {
+				bool found = false;
+
+				for (lib = libraries; lib && !found; lib = lib->next)
+					found = strmap_lookup(&lib->obj->provided, names[i]) != NULL;
+
+				if (!found && !*strmap_lookup(&needed, names[i]))
+					fprintf(stderr, "WARNING: Unresolvable symbol %s\n", names[i]);
+			}
+		}
+		free(names);
+		strmap_free(&needed);
+
+		for (lib = libraries; lib; lib = lib->next) {
+			if (!lib->pic)
+				continue;
+
+			switch (library_reduce(lib)) {
+			case -1:
+				return 1;
+			case 1:
+				changed++;
+				break;
+			}
+		}
+
+		if (!changed)
+			break;
+	}
+
+	/* the reduced libraries are named after their soname */
+	for (lib = libraries; lib; lib = lib->next) {
+		char *path;
+
+		if (!lib->reduced)
+			continue;
+
+		path = xasprintf("%s/%s", dest_path, lib->name);
+		if (rename(lib->reduced, path))
+			fatal("cannot rename %s: %s\n", lib->reduced, strerror(errno));
+		if (verbose)
+			fprintf(stderr, "mklibs: reduced %s\n", lib->name);
+		free(path);
+	}
+
+	return 0;
+}